@@ -0,0 +1,77 @@
+/**
+ * @file bench_batch.cpp
+ * @author noahyzhang
+ * @brief 比较逐个查找与批量查找 find_many 的耗时
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：单线程，KEY_COUNT 个键（远大于 CPU 缓存），每批随机取 BATCH_SIZE 个键查找，共 ROUND_COUNT 批
+ * 1. 值为 uint64_t，支持乐观读，find_many 只做哈希与预取的流水
+ * 2. 值为 std::string，查找需要加读锁，find_many 同一锁分片只加一次锁
+ * 输出每个键的平均查找耗时
+ */
+
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include "concurrent_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+
+#define KEY_COUNT (4000000)
+#define BATCH_SIZE (256)
+#define ROUND_COUNT (20000)
+
+template <typename V>
+void bench(const std::string& name, V (*make_value)(uint64_t)) {
+    ConcurrentHashMap<uint64_t, V> mp(KEY_COUNT);
+    for (uint64_t i = 0; i < KEY_COUNT; ++i) {
+        mp.insert(i * 7919, make_value(i));
+    }
+    std::default_random_engine eng(12345);
+    std::uniform_int_distribution<uint64_t> rand_range(0, KEY_COUNT - 1);
+    std::vector<uint64_t> keys(static_cast<size_t>(BATCH_SIZE) * ROUND_COUNT);
+    for (auto& key : keys) {
+        key = rand_range(eng) * 7919;
+    }
+    std::vector<V> values(BATCH_SIZE);
+    bool found[BATCH_SIZE];
+
+    size_t found_count = 0;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        found_count += mp.find(keys[i], values[i % BATCH_SIZE]);
+    }
+    auto mid_tm = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < ROUND_COUNT; ++round) {
+        const uint64_t* batch = keys.data() + round * BATCH_SIZE;
+        found_count += mp.find_many(batch, batch + BATCH_SIZE, values.data(), found);
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+
+    double single_ns = std::chrono::duration<double, std::nano>(mid_tm - start_tm).count() / keys.size();
+    double batch_ns = std::chrono::duration<double, std::nano>(end_tm - mid_tm).count() / keys.size();
+    std::cout << name << " find: " << single_ns << " ns/key, find_many: " << batch_ns << " ns/key, found: "
+        << found_count << std::endl;
+}
+
+uint64_t make_integer(uint64_t i) {
+    return i;
+}
+
+std::string make_string(uint64_t i) {
+    return std::to_string(i);
+}
+
+int main() {
+    bench<uint64_t>("uint64_t", make_integer);
+    bench<std::string>("std::string", make_string);
+    return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file bench_bucket_index.cpp
+ * @author noahyzhang
+ * @brief 比较初始桶数为质数（取模定位桶）与 2 的幂（混合后用掩码定位桶）时的查找耗时
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：单线程，KEY_COUNT 个随机的 uint64_t 键，值为 uint64_t（乐观读），先 reserve 再插入，
+ * 用 2 * KEY_COUNT 个键（一半不存在）逐个 find、批量 find_many 各 ROUND_COUNT 轮
+ * 哈希表能放进 CPU 缓存，耗时主要是计算哈希值和定位桶，而不是访问内存的延迟
+ * 键是连续整数时，std::hash 的恒等映射对质数取模恰好每个桶一个元素，会掩盖定位桶本身的开销，因此使用随机的键
+ * 输出每个键的平均耗时
+ */
+
+#include <random>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include "concurrent_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+
+#define KEY_COUNT (1 << 14)
+#define ROUND_COUNT (300)
+
+void bench(const std::string& name, size_t hash_bucket_size) {
+    std::mt19937_64 eng(12345);
+    ConcurrentHashMap<uint64_t, uint64_t> mp(hash_bucket_size);
+    mp.reserve(KEY_COUNT);
+    std::vector<uint64_t> keys(2 * KEY_COUNT);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i] = eng();
+        if (i % 2 == 0) {
+            mp.insert(keys[i], i);
+        }
+    }
+    std::shuffle(keys.begin(), keys.end(), eng);
+    std::vector<uint64_t> values(keys.size());
+    std::vector<char> found(keys.size());
+
+    size_t found_count = 0;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < ROUND_COUNT; ++round) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            found_count += mp.find(keys[i], values[i]);
+        }
+    }
+    auto mid_tm = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < ROUND_COUNT; ++round) {
+        found_count += mp.find_many(keys.begin(), keys.end(), values.begin(), found.begin());
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+
+    double op_count = static_cast<double>(ROUND_COUNT) * keys.size();
+    std::cout << name << " find: " << std::chrono::duration<double, std::nano>(mid_tm - start_tm).count() / op_count
+        << " ns/key, find_many: " << std::chrono::duration<double, std::nano>(end_tm - mid_tm).count() / op_count
+        << " ns/key, found: " << found_count << std::endl;
+}
+
+int main() {
+    bench("prime 1031", 1031);
+    bench("power of two 1024", 1024);
+    return 0;
+}
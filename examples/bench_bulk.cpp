@@ -0,0 +1,91 @@
+/**
+ * @file bench_bulk.cpp
+ * @author noahyzhang
+ * @brief 比较批量构建、归约、清空的串行与并行版本的耗时
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：KEY_COUNT 个互不相同的 uint64_t 键，值为 uint64_t，并行版本使用 CPU 核数个线程
+ * 1. 构建：逐个 insert、bulk_load（检查重复的键）、bulk_load（调用者保证键唯一）
+ * 2. 求和：单线程的 reduce、多线程的 reduce
+ * 3. 清空：clear、parallel_clear
+ * 输出每一项的耗时
+ */
+
+#include <vector>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include "concurrent_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+
+#define KEY_COUNT (4000000)
+
+typedef ConcurrentHashMap<uint64_t, uint64_t> Map;
+
+template <typename Fn>
+double time_ms(Fn fn) {
+    auto start_tm = std::chrono::steady_clock::now();
+    fn();
+    auto end_tm = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end_tm - start_tm).count();
+}
+
+void print(const std::string& name, double ms, size_t size) {
+    std::cout << name << ": " << ms << " ms, size: " << size << std::endl;
+}
+
+int main() {
+    std::vector<uint64_t> keys(KEY_COUNT);
+    std::vector<uint64_t> values(KEY_COUNT);
+    for (uint64_t i = 0; i < KEY_COUNT; ++i) {
+        keys[i] = i * 7919;
+        values[i] = i;
+    }
+    auto sum = [](uint64_t lhs, uint64_t rhs) { return lhs + rhs; };
+    double ms = 0;
+
+    Map serial_map;
+    ms = time_ms([&]() {
+        for (size_t i = 0; i < KEY_COUNT; ++i) {
+            serial_map.insert(keys[i], values[i]);
+        }
+    });
+    print("insert", ms, serial_map.size());
+    Map load_map;
+    ms = time_ms([&]() {
+        load_map.bulk_load(keys.begin(), keys.end(), values.begin());
+    });
+    print("bulk_load", ms, load_map.size());
+    Map unique_map;
+    ms = time_ms([&]() {
+        unique_map.bulk_load(keys.begin(), keys.end(), values.begin(), true);
+    });
+    print("bulk_load unique", ms, unique_map.size());
+
+    uint64_t total = 0;
+    ms = time_ms([&]() {
+        total = unique_map.reduce(0, sum, 1);
+    });
+    std::cout << "reduce 1 thread: " << ms << " ms, sum: " << total << std::endl;
+    ms = time_ms([&]() {
+        total = unique_map.reduce(0, sum);
+    });
+    std::cout << "reduce: " << ms << " ms, sum: " << total << std::endl;
+
+    ms = time_ms([&]() {
+        serial_map.clear();
+    });
+    print("clear", ms, serial_map.size());
+    ms = time_ms([&]() {
+        unique_map.parallel_clear();
+    });
+    print("parallel_clear", ms, unique_map.size());
+    return 0;
+}
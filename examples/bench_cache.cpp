@@ -0,0 +1,96 @@
+/**
+ * @file bench_cache.cpp
+ * @author noahyzhang
+ * @brief 键的取值范围不断扩大时，ConcurrentCache 与不淘汰的 ConcurrentHashMap 的吞吐、命中率与元素个数
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：THREAD_COUNT 个线程，每个线程执行 OP_COUNT 次“先查找，不存在时插入”
+ * 其中 HOT_PERCENT% 的操作访问 HOT_KEY_COUNT 个热点键，其余访问一个不断递增、从不重复的冷键
+ * 1. ConcurrentHashMap：没有淘汰，元素个数随冷键的个数线性增长
+ * 2. ConcurrentCache：容量为 CAPACITY，CLOCK 淘汰冷键，热点键因为一直被访问而保留
+ * 输出吞吐、查找的命中率、结束时的元素个数与桶数
+ */
+
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <iostream>
+#include "concurrent_cache.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::ConcurrentCache;
+
+#define THREAD_COUNT (4)
+#define OP_COUNT (1000000)
+#define HOT_KEY_COUNT (50000)
+#define HOT_PERCENT (80)
+#define CAPACITY (100000)
+
+template <typename M>
+void bench(const std::string& name, M* mp) {
+    std::atomic<size_t> hit_count{0};
+    std::vector<std::thread> threads;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < THREAD_COUNT; ++t) {
+        threads.emplace_back([&, t]() {
+            std::default_random_engine eng(t);
+            std::uniform_int_distribution<uint64_t> rand_hot(0, HOT_KEY_COUNT - 1);
+            std::uniform_int_distribution<int> rand_percent(0, 99);
+            uint64_t cold_key = (t + 1) << 40;
+            size_t local_hit = 0;
+            uint64_t value;
+            for (size_t i = 0; i < OP_COUNT; ++i) {
+                uint64_t key = rand_percent(eng) < HOT_PERCENT ? rand_hot(eng) : cold_key++;
+                if (mp->find(key, value)) {
+                    ++local_hit;
+                } else {
+                    mp->put(key, key);
+                }
+            }
+            hit_count.fetch_add(local_hit);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_tm).count();
+    std::cout << name << ": " << THREAD_COUNT * OP_COUNT / seconds / 1e6 << " M ops/s, hit rate: "
+        << 100.0 * hit_count.load() / (THREAD_COUNT * OP_COUNT) << "%, size: " << mp->size()
+        << ", buckets: " << mp->map().bucket_count() << std::endl;
+}
+
+// 以与 ConcurrentCache 相同的接口包装不淘汰的 ConcurrentHashMap
+class UnboundedMap {
+public:
+    bool find(uint64_t key, uint64_t& value) const {
+        return map_.find(key, value);
+    }
+    void put(uint64_t key, uint64_t value) {
+        map_.insert(key, value);
+    }
+    size_t size() const {
+        return map_.size();
+    }
+    ConcurrentHashMap<uint64_t, uint64_t>& map() {
+        return map_;
+    }
+
+private:
+    ConcurrentHashMap<uint64_t, uint64_t> map_;
+};
+
+int main() {
+    UnboundedMap unbounded;
+    bench("ConcurrentHashMap", &unbounded);
+    ConcurrentCache<uint64_t, uint64_t> cache(CAPACITY);
+    bench("ConcurrentCache", &cache);
+    return 0;
+}
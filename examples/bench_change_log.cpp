@@ -0,0 +1,141 @@
+/**
+ * @file bench_change_log.cpp
+ * @author noahyzhang
+ * @brief 变更日志对写操作的开销，以及快照加日志重放的预热耗时
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：ConcurrentHashMap<uint64_t, uint64_t>，KEY_RANGE 个键预先插入一半，
+ * THREAD_COUNT 个线程各执行 OP_COUNT 次写操作，其中 50% insert、25% insert_and_inc、25% erase
+ * 1. 不订阅变更与订阅 ChangeLog 时写操作的平均耗时，以及日志的大小与写线程因缓冲区已满而等待的次数
+ * 2. 订阅之后保存快照，写操作完成后在新的哈希表上 load 快照并从快照前的序号 replay 日志，
+ *    分别输出 load 与 replay（1 个线程、CPU 核数个线程）的耗时，并检查与原哈希表一致
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include "concurrent_hash_map.h"
+#include "change_log.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::ChangeLog;
+
+#define KEY_RANGE (1 << 20)
+#define THREAD_COUNT (4)
+#define OP_COUNT (1000000)
+#define LOG_PATH "bench_change_log.log"
+#define SNAPSHOT_PATH "bench_change_log.snap"
+
+typedef ConcurrentHashMap<uint64_t, uint64_t> Map;
+
+double elapsed_ms(std::chrono::steady_clock::time_point start_tm) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_tm).count();
+}
+
+size_t file_size(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+}
+
+void prepare(Map& mp) {
+    for (uint64_t i = 0; i < KEY_RANGE; i += 2) {
+        mp.insert(i, i);
+    }
+}
+
+// 返回每次写操作的平均耗时（纳秒）
+double run_writes(Map& mp) {
+    std::vector<std::thread> threads;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < THREAD_COUNT; ++t) {
+        threads.emplace_back([&mp, t]() {
+            std::default_random_engine eng(t);
+            std::uniform_int_distribution<uint64_t> rand_key(0, KEY_RANGE - 1);
+            for (size_t i = 0; i < OP_COUNT; ++i) {
+                uint64_t key = rand_key(eng);
+                switch (i & 3) {
+                case 0:
+                case 1:
+                    mp.insert(key, i);
+                    break;
+                case 2:
+                    mp.insert_and_inc(key, 1);
+                    break;
+                default:
+                    mp.erase(key);
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    return elapsed_ms(start_tm) * 1e6 / (THREAD_COUNT * OP_COUNT);
+}
+
+bool same(Map& a, Map& b) {
+    bool ok = a.size() == b.size();
+    a.for_each([&](const uint64_t& key, const uint64_t& value) {
+        uint64_t other = 0;
+        ok = ok && b.find(key, other) && other == value;
+    }, 1);
+    return ok;
+}
+
+int main() {
+    unlink(LOG_PATH);
+    {
+        Map mp;
+        prepare(mp);
+        std::cout << "without change feed: " << run_writes(mp) << " ns/op" << std::endl;
+    }
+
+    Map mp;
+    prepare(mp);
+    ChangeLog<uint64_t, uint64_t> log;
+    if (!log.open(LOG_PATH)) {
+        std::cout << "open " << LOG_PATH << " failed" << std::endl;
+        return 1;
+    }
+    mp.set_change_feed(&log);
+    uint64_t from_sequence = log.sequence();
+    mp.save(SNAPSHOT_PATH);
+    double write_ns = run_writes(mp);
+    mp.set_change_feed(nullptr);
+    log.close();
+    std::cout << "with ChangeLog: " << write_ns << " ns/op, records: " << log.sequence() - from_sequence
+        << ", log bytes: " << file_size(LOG_PATH) << ", stalls: " << log.stall_count() << std::endl;
+
+    size_t max_thread_count = std::thread::hardware_concurrency();
+    std::vector<size_t> thread_counts = {1};
+    if (max_thread_count > 1) {
+        thread_counts.push_back(max_thread_count);
+    }
+    for (size_t thread_count : thread_counts) {
+        Map replica;
+        auto start_tm = std::chrono::steady_clock::now();
+        replica.load(SNAPSHOT_PATH, thread_count);
+        double load_ms = elapsed_ms(start_tm);
+        start_tm = std::chrono::steady_clock::now();
+        bool ok = replica.replay(LOG_PATH, from_sequence, thread_count);
+        double replay_ms = elapsed_ms(start_tm);
+        std::cout << "threads: " << thread_count << ", load snapshot: " << load_ms << " ms, replay: " << replay_ms
+            << " ms, ok: " << ok << ", same: " << same(mp, replica) << std::endl;
+    }
+    unlink(LOG_PATH);
+    unlink(SNAPSHOT_PATH);
+    return 0;
+}
@@ -0,0 +1,74 @@
+/**
+ * @file bench_counter.cpp
+ * @author noahyzhang
+ * @brief 比较 ConcurrentHashMap::insert_and_inc 与 ConcurrentCounterMap 在热点键上的计数吞吐
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：1 到 CPU 核数（每次翻倍）个线程，每个线程对 HOT_KEY_COUNT 个热点键轮流计数 OP_COUNT 次
+ * 1. ConcurrentHashMap<uint64_t, uint64_t>::insert_and_inc，每次计数加桶的写锁
+ * 2. ConcurrentCounterMap<uint64_t, uint64_t>::insert_and_inc，已存在的键不加锁，只做一次 fetch_add
+ * 输出总吞吐，并校验计数之和
+ */
+
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include "concurrent_counter_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::ConcurrentCounterMap;
+
+#define HOT_KEY_COUNT (16)
+#define OP_COUNT (2000000)
+
+template <typename Map>
+void bench(const std::string& name, size_t thread_count) {
+    Map mp;
+    std::vector<std::thread> threads;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&mp]() {
+            for (uint64_t i = 0; i < OP_COUNT; ++i) {
+                mp.insert_and_inc(i % HOT_KEY_COUNT, 1);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+    uint64_t total = 0;
+    for (uint64_t key = 0; key < HOT_KEY_COUNT; ++key) {
+        uint64_t value = 0;
+        mp.find(key, value);
+        total += value;
+    }
+    double seconds = std::chrono::duration<double>(end_tm - start_tm).count();
+    std::cout << name << " threads: " << thread_count << ", "
+        << static_cast<double>(thread_count) * OP_COUNT / seconds / 1e6 << " M ops/s, "
+        << (total == thread_count * OP_COUNT ? "count ok" : "count mismatch") << std::endl;
+}
+
+int main() {
+    size_t max_thread_count = std::thread::hardware_concurrency();
+    if (max_thread_count == 0) {
+        max_thread_count = 1;
+    }
+    for (size_t thread_count = 1; ; thread_count *= 2) {
+        if (thread_count > max_thread_count) {
+            thread_count = max_thread_count;
+        }
+        bench<ConcurrentHashMap<uint64_t, uint64_t>>("ConcurrentHashMap", thread_count);
+        bench<ConcurrentCounterMap<uint64_t, uint64_t>>("ConcurrentCounterMap", thread_count);
+        if (thread_count == max_thread_count) break;
+    }
+    return 0;
+}
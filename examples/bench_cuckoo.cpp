@@ -0,0 +1,125 @@
+/**
+ * @file bench_cuckoo.cpp
+ * @author noahyzhang
+ * @brief 比较布谷鸟哈希表与链表存储引擎在高负载下的内存占用与查找耗时分布
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：单线程，uint64_t 键值
+ * 1. 布谷鸟哈希表固定 CUCKOO_BUCKET_COUNT 个桶，不断插入直到扩容，输出扩容前达到的负载因子
+ * 2. 布谷鸟哈希表与 ConcurrentHashMap（默认负载因子）分别插入 LOAD_FACTOR 比例槽位数的键，
+ *    输出每个元素占用的内存（常驻内存的增量）、插入耗时，以及逐次计时的查找耗时的 p50/p99/p999/最大值
+ *    每个哈希表在单独的子进程中测试，释放的内存不会被下一个哈希表复用，常驻内存的增量互不影响
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include <iostream>
+#include "concurrent_hash_map.h"
+#include "cuckoo_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::ConcurrentCuckooMap;
+
+#define CUCKOO_BUCKET_COUNT (1 << 18)
+#define LOAD_FACTOR (0.9)
+#define LOOKUP_COUNT (4000000UL)
+
+// 当前进程的常驻内存字节数
+size_t resident_bytes() {
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp == nullptr) {
+        return 0;
+    }
+    unsigned long total = 0, resident = 0;
+    if (fscanf(fp, "%lu %lu", &total, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+uint64_t make_key(uint64_t i) {
+    return i * 0x9e3779b97f4a7c15ULL + 1;
+}
+
+// 在子进程中运行 fn，等待它结束
+template <typename Fn>
+void in_child_process(Fn&& fn) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn();
+        std::cout.flush();
+        _exit(0);
+    }
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+void max_load() {
+    ConcurrentCuckooMap<uint64_t, uint64_t> mp(CUCKOO_BUCKET_COUNT);
+    size_t capacity = mp.capacity();
+    uint64_t i = 0;
+    for (; mp.capacity() == capacity; ++i) {
+        mp.insert(make_key(i), i);
+    }
+    std::cout << "cuckoo capacity: " << capacity << ", resized after " << i - 1 << " elements, max load factor: "
+        << static_cast<double>(i - 1) / capacity << std::endl;
+}
+
+template <typename M>
+void bench(const std::string& name, size_t count) {
+    size_t base_bytes = resident_bytes();
+    std::unique_ptr<M> mp(new M(CUCKOO_BUCKET_COUNT));
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        mp->insert(make_key(i), i);
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+    double insert_ns = std::chrono::duration<double, std::nano>(end_tm - start_tm).count() / count;
+    double bytes = static_cast<double>(resident_bytes() - base_bytes) / count;
+
+    std::default_random_engine eng(12345);
+    std::uniform_int_distribution<size_t> rand_range(0, count - 1);
+    std::vector<uint64_t> order(LOOKUP_COUNT);
+    for (auto& x : order) {
+        x = make_key(rand_range(eng));
+    }
+    std::vector<uint32_t> latencies(LOOKUP_COUNT);
+    uint64_t value = 0;
+    size_t found = 0;
+    for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+        auto op_tm = std::chrono::steady_clock::now();
+        found += mp->find(order[i], value);
+        latencies[i] = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - op_tm).count());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << name << " elements: " << count << ", bytes/element: " << bytes << ", insert: " << insert_ns
+        << " ns/op, find p50: " << latencies[LOOKUP_COUNT / 2] << " ns, p99: " << latencies[LOOKUP_COUNT * 99 / 100]
+        << " ns, p999: " << latencies[LOOKUP_COUNT * 999 / 1000] << " ns, max: " << latencies.back()
+        << " ns, found: " << found << std::endl;
+}
+
+int main() {
+    max_load();
+    size_t count = static_cast<size_t>(CUCKOO_BUCKET_COUNT * CUCKOO_SLOTS_PER_BUCKET * LOAD_FACTOR);
+    in_child_process([count]() { bench<ConcurrentCuckooMap<uint64_t, uint64_t>>("ConcurrentCuckooMap", count); });
+    in_child_process([count]() { bench<ConcurrentHashMap<uint64_t, uint64_t>>("ConcurrentHashMap", count); });
+    return 0;
+}
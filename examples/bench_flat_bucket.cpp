@@ -0,0 +1,94 @@
+/**
+ * @file bench_flat_bucket.cpp
+ * @author noahyzhang
+ * @brief 比较不同存储引擎、不同指纹匹配方式的查找性能
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：单线程，100 万个 std::string 键（公共前缀较长，完整比较代价较高），
+ * 每个引擎分别查找命中的键和不存在的键各 1000 万次，输出每次查找的平均耗时
+ * 1. HashBucket：单链表，逐个节点比较完整的键
+ * 2. FlatHashBucket + ScalarTagGroup：64 位整数一次比较 8 个指纹
+ * 3. FlatHashBucket + Sse2TagGroup：一次比较 16 个指纹
+ * 4. FlatHashBucket + Avx2TagGroup：一次比较 32 个指纹，需要以 -DENABLE_AVX2=ON 编译
+ */
+
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include "concurrent_hash_map.h"
+#include "flat_hash_bucket.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::HashBucket;
+using noahyzhang::concurrent::FlatHashBucket;
+using noahyzhang::concurrent::ScalarTagGroup;
+
+#define KEY_COUNT (1000000)
+#define LOOKUP_COUNT (10000000)
+// 连续数组引擎使用较大的负载因子，让每个桶中有一组指纹需要比较
+#define FLAT_MAX_LOAD_FACTOR (8.0f)
+
+std::string make_key(size_t i) {
+    return "user:session:profile:" + std::to_string(i);
+}
+
+template <typename B>
+void bench(const std::string& name, float max_load_factor, const std::vector<std::string>& keys,
+    const std::vector<std::string>& missing_keys) {
+    ConcurrentHashMap<std::string, int, std::hash<std::string>, B> mp(DEFAULT_HASH_BUCKET_SIZE, max_load_factor);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        mp.insert(keys[i], static_cast<int>(i));
+    }
+    std::default_random_engine eng(12345);
+    std::uniform_int_distribution<size_t> rand_range(0, keys.size() - 1);
+    std::vector<size_t> order(LOOKUP_COUNT);
+    for (auto& x : order) {
+        x = rand_range(eng);
+    }
+
+    int value = 0;
+    size_t found = 0;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+        found += mp.find(keys[order[i]], value);
+    }
+    auto mid_tm = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+        found += mp.find(missing_keys[order[i]], value);
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+
+    double hit_ns = std::chrono::duration<double, std::nano>(mid_tm - start_tm).count() / LOOKUP_COUNT;
+    double miss_ns = std::chrono::duration<double, std::nano>(end_tm - mid_tm).count() / LOOKUP_COUNT;
+    std::cout << name << " buckets: " << mp.bucket_count() << ", hit: " << hit_ns << " ns/op, miss: "
+        << miss_ns << " ns/op, found: " << found << std::endl;
+}
+
+int main() {
+    std::vector<std::string> keys, missing_keys;
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        keys.push_back(make_key(i));
+        missing_keys.push_back(make_key(i + KEY_COUNT));
+    }
+    bench<HashBucket<std::string, int>>("HashBucket", DEFAULT_MAX_LOAD_FACTOR, keys, missing_keys);
+    bench<HashBucket<std::string, int>>("HashBucket(lf 8)", FLAT_MAX_LOAD_FACTOR, keys, missing_keys);
+    bench<FlatHashBucket<std::string, int, ScalarTagGroup>>("FlatHashBucket<Scalar>",
+        FLAT_MAX_LOAD_FACTOR, keys, missing_keys);
+#if defined(__SSE2__)
+    bench<FlatHashBucket<std::string, int, noahyzhang::concurrent::Sse2TagGroup>>("FlatHashBucket<SSE2>",
+        FLAT_MAX_LOAD_FACTOR, keys, missing_keys);
+#endif
+#if defined(__AVX2__)
+    bench<FlatHashBucket<std::string, int, noahyzhang::concurrent::Avx2TagGroup>>("FlatHashBucket<AVX2>",
+        FLAT_MAX_LOAD_FACTOR, keys, missing_keys);
+#endif
+    return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file bench_hash.cpp
+ * @author noahyzhang
+ * @brief 比较不同哈希函数、以及节点是否缓存哈希值时，长字符串键的构建（含扩容）与查找耗时
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：单线程，KEY_COUNT 个长度为 KEY_LENGTH 的字符串键（公共前缀很长，只有末尾不同，类似 URL），值为 uint64_t
+ * 哈希表能放进 CPU 缓存，耗时主要是计算哈希值和比较键，而不是访问内存的延迟
+ * 1. 构建：从默认桶数开始逐个插入，期间桶分裂多次，节点缓存了哈希值时分裂不需要重新计算哈希值
+ * 2. 查找：所有的键查找 ROUND_COUNT 轮，节点缓存了哈希值时，同一个桶中的其他键先比较哈希值，不需要比较完整的键
+ * 分别使用 std::hash、StringHash（MurmurHash64A）、FastHash（wyhash），以及 FastHash 但不缓存哈希值
+ * 输出每个键的平均耗时
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "concurrent_hash_map.h"
+#include "string_key.h"
+#include "fast_hash.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::StringHash;
+using noahyzhang::concurrent::FastHash;
+
+#define KEY_COUNT (1 << 14)
+#define KEY_LENGTH (96)
+#define ROUND_COUNT (200)
+
+// 与 std::string 相同，但节点中不缓存哈希值
+struct UncachedKey {
+    std::string str;
+    bool operator==(const UncachedKey& other) const {
+        return str == other.str;
+    }
+};
+
+struct UncachedKeyHash {
+    size_t operator()(const UncachedKey& key) const {
+        return FastHash()(key.str);
+    }
+};
+
+namespace noahyzhang {
+namespace concurrent {
+template <>
+struct StoreHash<UncachedKey> : std::false_type {};
+}  // namespace concurrent
+}  // namespace noahyzhang
+
+template <typename K, typename F>
+void bench(const std::string& name, const std::vector<K>& keys) {
+    ConcurrentHashMap<K, uint64_t, F> mp;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        mp.insert(keys[i], i);
+    }
+    auto mid_tm = std::chrono::steady_clock::now();
+    size_t found_count = 0;
+    uint64_t value;
+    for (size_t round = 0; round < ROUND_COUNT; ++round) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            found_count += mp.find(keys[i], value);
+        }
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+
+    double build_ns = std::chrono::duration<double, std::nano>(mid_tm - start_tm).count() / keys.size();
+    double find_ns = std::chrono::duration<double, std::nano>(end_tm - mid_tm).count()
+        / (static_cast<double>(keys.size()) * ROUND_COUNT);
+    std::cout << name << " build: " << build_ns << " ns/key, find: " << find_ns << " ns/key, found: "
+        << found_count << ", buckets: " << mp.bucket_count() << std::endl;
+}
+
+int main() {
+    std::vector<std::string> keys(KEY_COUNT);
+    std::vector<UncachedKey> uncached_keys(KEY_COUNT);
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        std::string suffix = std::to_string(i);
+        keys[i] = "https://example.com/" + std::string(KEY_LENGTH - 20 - suffix.size(), 'a') + suffix;
+        uncached_keys[i].str = keys[i];
+    }
+    bench<std::string, std::hash<std::string>>("std::hash", keys);
+    bench<std::string, StringHash>("StringHash", keys);
+    bench<std::string, FastHash>("FastHash", keys);
+    bench<UncachedKey, UncachedKeyHash>("FastHash (no cached hash)", uncached_keys);
+    return 0;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file bench_inline_bucket.cpp
+ * @author noahyzhang
+ * @brief 比较小键值在不同存储引擎下每个元素占用的内存与查找、插入耗时
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：单线程，ConcurrentHashMap<uint64_t, uint32_t>，插入 KEY_COUNT 个随机键（有效数据 12 字节），
+ * 各存储引擎使用默认的最大负载因子，在各自的子进程中测试，输出：
+ * 每个元素占用的内存（常驻内存的增量）、插入耗时、随机查找命中与不存在的键的耗时
+ * 1. HashBucket：单链表，每个元素一个节点（节点池分配）
+ * 2. FlatHashBucket：每个桶一个单独分配的槽位数组
+ * 3. InlineHashBucket：槽位内嵌在桶数组中，桶满时才分配溢出数组
+ * 开始之前先检查 InlineHashBucket 在 insert、insert_many、bulk_load 中遇到空键时抛出异常，之后哈希表仍然可用
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <memory>
+#include <limits>
+#include <stdexcept>
+#include <iostream>
+#include "concurrent_hash_map.h"
+#include "flat_hash_bucket.h"
+#include "inline_hash_bucket.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::FlatHashBucket;
+using noahyzhang::concurrent::InlineHashBucket;
+
+#define KEY_COUNT (4000000)
+#define LOOKUP_COUNT (4000000)
+
+// 当前进程的常驻内存字节数
+size_t resident_bytes() {
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (fp == nullptr) {
+        return 0;
+    }
+    unsigned long total = 0, resident = 0;
+    if (fscanf(fp, "%lu %lu", &total, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(fp);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+template <typename M>
+void bench(const std::string& name, const std::vector<uint64_t>& keys, const std::vector<uint64_t>& missing_keys) {
+    size_t base_bytes = resident_bytes();
+    std::unique_ptr<M> mp(new M());
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        mp->insert(keys[i], static_cast<uint32_t>(i));
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+    double insert_ns = std::chrono::duration<double, std::nano>(end_tm - start_tm).count() / keys.size();
+    double bytes = static_cast<double>(resident_bytes() - base_bytes) / keys.size();
+
+    std::default_random_engine eng(12345);
+    std::uniform_int_distribution<size_t> rand_range(0, keys.size() - 1);
+    std::vector<size_t> order(LOOKUP_COUNT);
+    for (auto& x : order) {
+        x = rand_range(eng);
+    }
+    uint32_t value = 0;
+    size_t found = 0;
+    start_tm = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+        found += mp->find(keys[order[i]], value);
+    }
+    auto mid_tm = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOKUP_COUNT; ++i) {
+        found += mp->find(missing_keys[order[i]], value);
+    }
+    end_tm = std::chrono::steady_clock::now();
+    double hit_ns = std::chrono::duration<double, std::nano>(mid_tm - start_tm).count() / LOOKUP_COUNT;
+    double miss_ns = std::chrono::duration<double, std::nano>(end_tm - mid_tm).count() / LOOKUP_COUNT;
+    std::cout << name << " buckets: " << mp->bucket_count() << ", bytes/element: " << bytes << ", insert: "
+        << insert_ns << " ns/op, hit: " << hit_ns << " ns/op, miss: " << miss_ns << " ns/op, found: " << found
+        << std::endl;
+}
+
+typedef ConcurrentHashMap<uint64_t, uint32_t, std::hash<uint64_t>, InlineHashBucket<uint64_t, uint32_t>> InlineMap;
+
+template <typename Fn>
+bool throws_invalid_argument(Fn&& fn) {
+    try {
+        fn();
+    } catch (const std::invalid_argument&) {
+        return true;
+    }
+    return false;
+}
+
+// 空键出现在单个插入、批量插入、并行批量插入中时都应该抛出异常，并且释放锁、元素个数与实际一致
+bool check_empty_key() {
+    const uint64_t empty_key = std::numeric_limits<uint64_t>::max();
+    InlineMap mp;
+    bool ok = throws_invalid_argument([&]() { mp.insert(empty_key, 1); });
+    std::vector<uint64_t> keys = {1, empty_key, 2};
+    std::vector<uint32_t> values = {1, 2, 3};
+    ok = ok && throws_invalid_argument([&]() { mp.insert_many(keys.begin(), keys.end(), values.begin()); });
+    keys.clear();
+    values.clear();
+    for (uint64_t i = 0; i < 100000; ++i) {
+        keys.push_back(i == 50000 ? empty_key : i);
+        values.push_back(static_cast<uint32_t>(i));
+    }
+    ok = ok && throws_invalid_argument([&]() { mp.bulk_load(keys.begin(), keys.end(), values.begin(), false, 2); });
+    ok = ok && throws_invalid_argument([&]() { mp.bulk_load(keys.begin(), keys.end(), values.begin(), true, 2); });
+    // 之前的异常如果没有释放锁，这里的写操作会一直等待
+    for (uint64_t i = 0; i < keys.size(); ++i) {
+        mp.insert(i + keys.size(), 0);
+    }
+    size_t count = 0;
+    mp.for_each([&](const uint64_t&, const uint32_t&) { ++count; }, 1);
+    return ok && count == mp.size();
+}
+
+// 在子进程中运行 fn，释放的内存不会被下一个哈希表复用
+template <typename Fn>
+void in_child_process(Fn&& fn) {
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        fn();
+        std::cout.flush();
+        _exit(0);
+    }
+    if (pid > 0) {
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+int main() {
+    std::cout << "empty key check: " << (check_empty_key() ? "ok" : "failed") << std::endl;
+    std::mt19937_64 eng(42);
+    std::vector<uint64_t> keys(KEY_COUNT), missing_keys(KEY_COUNT);
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        // 最高位区分命中与不存在的键，两者都不会等于空键
+        keys[i] = eng() >> 2;
+        missing_keys[i] = keys[i] | (static_cast<uint64_t>(1) << 62);
+    }
+    in_child_process([&]() {
+        bench<ConcurrentHashMap<uint64_t, uint32_t>>("HashBucket", keys, missing_keys);
+    });
+    in_child_process([&]() {
+        bench<ConcurrentHashMap<uint64_t, uint32_t, std::hash<uint64_t>, FlatHashBucket<uint64_t, uint32_t>>>(
+            "FlatHashBucket", keys, missing_keys);
+    });
+    in_child_process([&]() {
+        bench<InlineMap>("InlineHashBucket", keys, missing_keys);
+    });
+    return 0;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file bench_lock_stripe.cpp
+ * @author noahyzhang
+ * @brief 不同锁分片数下，吞吐随线程数的变化
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：KEY_RANGE 个 uint64_t 键预先插入一半，值为 std::string（查找需要加读锁），
+ * 每个线程随机选键执行 OP_COUNT 次操作，其中 80% 查找、10% 插入、10% 删除
+ * 分别以 1 到 CPU 核数（每次翻倍）个线程、不同的锁分片数运行，输出总吞吐
+ * 分片数为 1 时所有桶共用一把锁，分片数越多，写操作与相邻桶的读操作争抢同一缓存行的概率越小
+ */
+
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include "concurrent_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+
+#define KEY_RANGE (1 << 20)
+#define OP_COUNT (1000000)
+
+double bench(size_t stripe_count, size_t thread_count) {
+    ConcurrentHashMap<uint64_t, std::string> mp(KEY_RANGE, DEFAULT_MAX_LOAD_FACTOR, stripe_count);
+    for (uint64_t i = 0; i < KEY_RANGE; i += 2) {
+        mp.insert(i, "value");
+    }
+    std::vector<std::thread> threads;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            std::default_random_engine eng(t);
+            std::uniform_int_distribution<uint64_t> rand_key(0, KEY_RANGE - 1);
+            std::uniform_int_distribution<int> rand_op(0, 9);
+            std::string value;
+            for (size_t i = 0; i < OP_COUNT; ++i) {
+                uint64_t key = rand_key(eng);
+                int op = rand_op(eng);
+                if (op == 0) {
+                    mp.insert(key, "value");
+                } else if (op == 1) {
+                    mp.erase(key);
+                } else {
+                    mp.find(key, value);
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end_tm - start_tm).count();
+    return static_cast<double>(thread_count) * OP_COUNT / seconds / 1e6;
+}
+
+int main() {
+    size_t max_thread_count = std::thread::hardware_concurrency();
+    if (max_thread_count == 0) {
+        max_thread_count = 1;
+    }
+    std::vector<size_t> stripe_counts = {1, 16, DEFAULT_LOCK_STRIPE_COUNT, 4096};
+    for (size_t stripe_count : stripe_counts) {
+        for (size_t thread_count = 1; ; thread_count *= 2) {
+            if (thread_count > max_thread_count) {
+                thread_count = max_thread_count;
+            }
+            std::cout << "stripes: " << stripe_count << ", threads: " << thread_count << ", "
+                << bench(stripe_count, thread_count) << " M ops/s" << std::endl;
+            if (thread_count == max_thread_count) break;
+        }
+    }
+    return 0;
+}
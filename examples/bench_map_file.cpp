@@ -0,0 +1,72 @@
+/**
+ * @file bench_map_file.cpp
+ * @author noahyzhang
+ * @brief 比较逐个插入重建、从文件加载、映射文件只读查找三种启动方式的耗时
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：KEY_COUNT 个 uint64_t 键，值为 uint64_t
+ * 1. insert：从空的哈希表逐个插入，相当于从数据源重新预热
+ * 2. save：保存到文件 FILE_PATH
+ * 3. load：映射文件后以 bulk_load 批量插入，使用 CPU 核数个线程
+ * 4. mapped open：MappedHashTable 只映射文件、检查头部；mapped find：在映射的文件上查找所有的键
+ * 文件刚写入，内容都在页缓存中，不包含从磁盘读取的时间
+ */
+
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include "concurrent_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::MappedHashTable;
+
+#define KEY_COUNT (4000000)
+#define FILE_PATH "bench_map_file.bin"
+
+double elapsed_ms(std::chrono::steady_clock::time_point start_tm) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_tm).count();
+}
+
+int main() {
+    auto start_tm = std::chrono::steady_clock::now();
+    ConcurrentHashMap<uint64_t, uint64_t> mp;
+    for (uint64_t i = 0; i < KEY_COUNT; ++i) {
+        mp.insert(i * 7919, i);
+    }
+    double ms = elapsed_ms(start_tm);
+    std::cout << "insert: " << ms << " ms, size: " << mp.size() << std::endl;
+
+    start_tm = std::chrono::steady_clock::now();
+    bool ok = mp.save(FILE_PATH);
+    ms = elapsed_ms(start_tm);
+    std::cout << "save: " << ms << " ms, ok: " << ok << std::endl;
+
+    start_tm = std::chrono::steady_clock::now();
+    ConcurrentHashMap<uint64_t, uint64_t> loaded;
+    ok = loaded.load(FILE_PATH);
+    ms = elapsed_ms(start_tm);
+    std::cout << "load: " << ms << " ms, ok: " << ok << ", size: " << loaded.size() << std::endl;
+
+    start_tm = std::chrono::steady_clock::now();
+    MappedHashTable<uint64_t, uint64_t> table;
+    ok = table.open(FILE_PATH);
+    ms = elapsed_ms(start_tm);
+    std::cout << "mapped open: " << ms << " ms, ok: " << ok << ", size: " << table.size() << std::endl;
+
+    start_tm = std::chrono::steady_clock::now();
+    size_t found_count = 0;
+    for (uint64_t i = 0; i < KEY_COUNT; ++i) {
+        found_count += table.contains(i * 7919);
+    }
+    ms = elapsed_ms(start_tm);
+    std::cout << "mapped find: " << ms * 1e6 / KEY_COUNT << " ns/key, found: " << found_count << std::endl;
+    remove(FILE_PATH);
+    return 0;
+}
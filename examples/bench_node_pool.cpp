@@ -0,0 +1,76 @@
+/**
+ * @file bench_node_pool.cpp
+ * @author noahyzhang
+ * @brief 比较节点池与 malloc 在频繁插入、删除下的吞吐
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：THREAD_COUNT 个线程，每个线程插入 OP_COUNT 个新键，同时删除 WINDOW 个之前插入的键，
+ * map 的大小保持稳定，每次插入都分配一个节点，每次删除都释放一个节点
+ * 1. 本线程删除：每个线程删除自己插入的键，节点在同一个线程分配和释放
+ * 2. 跨线程删除：每个线程删除下一个线程插入的键（还没插入时删除为空操作），节点在一个线程分配、在另一个线程释放
+ * 分别使用 std::allocator（glibc malloc）和 NodePoolAllocator，输出每秒的操作次数
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <iostream>
+#include "concurrent_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::HashBucket;
+using noahyzhang::concurrent::HashNode;
+using noahyzhang::concurrent::EpochReclaimer;
+using noahyzhang::concurrent::NodePoolAllocator;
+
+#define THREAD_COUNT (8)
+#define OP_COUNT (1000000)
+#define WINDOW (10000)
+
+template <typename A>
+void bench(const std::string& name, bool cross_thread) {
+    typedef HashBucket<uint64_t, uint64_t, EpochReclaimer, A> Bucket;
+    ConcurrentHashMap<uint64_t, uint64_t, std::hash<uint64_t>, Bucket> mp(THREAD_COUNT * WINDOW);
+    std::atomic<int> ready{0};
+    std::vector<std::thread> threads;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (int t = 0; t < THREAD_COUNT; ++t) {
+        threads.emplace_back([&, t]() {
+            ready.fetch_add(1);
+            for (; ready.load() < THREAD_COUNT;) {
+                std::this_thread::yield();
+            }
+            // 键的高位为线程编号，跨线程删除时删除下一个线程插入的键
+            int victim = cross_thread ? (t + 1) % THREAD_COUNT : t;
+            for (uint64_t i = 0; i < OP_COUNT; ++i) {
+                mp.insert((static_cast<uint64_t>(t) << 32) | i, i);
+                if (i >= WINDOW) {
+                    mp.erase((static_cast<uint64_t>(victim) << 32) | (i - WINDOW));
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end_tm - start_tm).count();
+    std::cout << name << (cross_thread ? " cross-thread" : " same-thread") << ": "
+        << 2.0 * THREAD_COUNT * OP_COUNT / seconds / 1e6 << " M ops/s, size: " << mp.size() << std::endl;
+}
+
+int main() {
+    for (int cross = 0; cross < 2; ++cross) {
+        bench<std::allocator<HashNode<uint64_t, uint64_t>>>("std::allocator", cross != 0);
+        bench<NodePoolAllocator<HashNode<uint64_t, uint64_t>>>("NodePoolAllocator", cross != 0);
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * @file bench_rw_lock.cpp
+ * @author noahyzhang
+ * @brief 不同锁策略下，吞吐随线程数的变化，以及读者持续加锁时写者的进展
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：ConcurrentHashMap<uint64_t, std::string>（查找需要加读锁），锁策略分别为
+ * PthreadRWLock、RWSpinLock、WriterPreferringRWSpinLock
+ * 1. 吞吐：KEY_RANGE 个键预先插入一半，STRIPE_COUNT 个锁分片，每个线程随机选键执行 OP_COUNT 次操作，
+ *    其中 80% 查找、10% 插入、10% 删除，线程数从 1 开始翻倍，直到 CPU 核数的两倍（至少到 4），输出总吞吐
+ *    线程数多于核数时持锁线程可能被换出，可以看出自旋之后休眠的作用
+ * 2. 读者洪流：所有桶共用一个锁分片，FLOOD_READER_COUNT 个线程不停地查找，一个线程不停地插入、删除，
+ *    运行 FLOOD_SECONDS 秒，输出读者与写者各自完成的操作数；写者优先的锁不会让写者饿死
+ */
+
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <atomic>
+#include <iostream>
+#include "concurrent_hash_map.h"
+#include "spin_lock.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::HashBucket;
+using noahyzhang::concurrent::PthreadRWLock;
+using noahyzhang::concurrent::RWSpinLock;
+using noahyzhang::concurrent::WriterPreferringRWSpinLock;
+
+#define KEY_RANGE (1 << 16)
+#define STRIPE_COUNT (16)
+#define OP_COUNT (1000000)
+#define FLOOD_READER_COUNT (4)
+#define FLOOD_SECONDS (1)
+
+template <typename L>
+using Map = ConcurrentHashMap<uint64_t, std::string, std::hash<uint64_t>, HashBucket<uint64_t, std::string>,
+                              std::equal_to<uint64_t>, L>;
+
+template <typename L>
+double bench_throughput(size_t thread_count) {
+    Map<L> mp(KEY_RANGE, DEFAULT_MAX_LOAD_FACTOR, STRIPE_COUNT);
+    for (uint64_t i = 0; i < KEY_RANGE; i += 2) {
+        mp.insert(i, "value");
+    }
+    std::vector<std::thread> threads;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            std::default_random_engine eng(t);
+            std::uniform_int_distribution<uint64_t> rand_key(0, KEY_RANGE - 1);
+            std::uniform_int_distribution<int> rand_op(0, 9);
+            std::string value;
+            for (size_t i = 0; i < OP_COUNT; ++i) {
+                uint64_t key = rand_key(eng);
+                int op = rand_op(eng);
+                if (op == 0) {
+                    mp.insert(key, "value");
+                } else if (op == 1) {
+                    mp.erase(key);
+                } else {
+                    mp.find(key, value);
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    auto end_tm = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end_tm - start_tm).count();
+    return static_cast<double>(thread_count) * OP_COUNT / seconds / 1e6;
+}
+
+template <typename L>
+void bench_read_flood(const std::string& name) {
+    Map<L> mp(KEY_RANGE, DEFAULT_MAX_LOAD_FACTOR, 1);
+    for (uint64_t i = 0; i < KEY_RANGE; i += 2) {
+        mp.insert(i, "value");
+    }
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> read_ops{0};
+    uint64_t write_ops = 0;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < FLOOD_READER_COUNT; ++t) {
+        threads.emplace_back([&, t]() {
+            std::default_random_engine eng(t);
+            std::uniform_int_distribution<uint64_t> rand_key(0, KEY_RANGE - 1);
+            std::string value;
+            uint64_t ops = 0;
+            for (; !stop.load(std::memory_order_relaxed); ++ops) {
+                mp.find(rand_key(eng), value);
+            }
+            read_ops.fetch_add(ops);
+        });
+    }
+    threads.emplace_back([&]() {
+        std::default_random_engine eng(FLOOD_READER_COUNT);
+        std::uniform_int_distribution<uint64_t> rand_key(0, KEY_RANGE - 1);
+        for (; !stop.load(std::memory_order_relaxed); ++write_ops) {
+            uint64_t key = rand_key(eng);
+            if (write_ops & 1) {
+                mp.erase(key);
+            } else {
+                mp.insert(key, "value");
+            }
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::seconds(FLOOD_SECONDS));
+    stop.store(true);
+    for (auto& t : threads) {
+        t.join();
+    }
+    std::cout << "read flood, lock: " << name << ", reads: " << read_ops.load() / 1e6 << " M, writes: "
+        << write_ops / 1e6 << " M" << std::endl;
+}
+
+template <typename L>
+void bench_lock(const std::string& name, size_t max_thread_count) {
+    for (size_t thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+        std::cout << "lock: " << name << ", threads: " << thread_count << ", "
+            << bench_throughput<L>(thread_count) << " M ops/s" << std::endl;
+    }
+}
+
+int main() {
+    size_t max_thread_count = std::thread::hardware_concurrency() * 2;
+    if (max_thread_count < 4) {
+        max_thread_count = 4;
+    }
+    bench_lock<PthreadRWLock>("PthreadRWLock", max_thread_count);
+    bench_lock<RWSpinLock>("RWSpinLock", max_thread_count);
+    bench_lock<WriterPreferringRWSpinLock>("WriterPreferringRWSpinLock", max_thread_count);
+    bench_read_flood<PthreadRWLock>("PthreadRWLock");
+    bench_read_flood<RWSpinLock>("RWSpinLock");
+    bench_read_flood<WriterPreferringRWSpinLock>("WriterPreferringRWSpinLock");
+    return 0;
+}
@@ -0,0 +1,528 @@
+/**
+ * @file bench_suite.cpp
+ * @author noahyzhang
+ * @brief 可配置的混合读写负载，输出各个哈希表的吞吐与延迟分位数，格式为 CSV 或者 JSON
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 用法：bench_suite [--参数=取值 ...]，带 * 的参数可以给出以逗号分隔的多个取值，依次组合运行
+ *   --maps=*        要测试的哈希表，默认全部：
+ *                   node      ConcurrentHashMap，链表存储引擎
+ *                   flat      ConcurrentHashMap，FlatHashBucket 存储引擎
+ *                   fast      ConcurrentHashMap，FastHash，初始桶数取 2 的幂（掩码定位桶）
+ *                   sharded   ShardedConcurrentHashMap，多路服务器上各个分片放在不同的 NUMA 节点上
+ *                   cuckoo    ConcurrentCuckooMap，布谷鸟哈希
+ *                   mutex     std::unordered_map + std::mutex
+ *                   rwlock    std::unordered_map + pthread_rwlock_t（C++11 中没有 std::shared_mutex）
+ *   --dists=*       键的分布，uniform 或者 zipf，默认 uniform,zipf
+ *   --theta=        zipf 分布的参数，越大越集中，不能取 1，默认 0.99
+ *   --reads=*       查找所占的百分比，其余的操作一半插入、一半删除，默认 50,95
+ *   --threads=*     线程数，默认 1 到 CPU 核数，每次翻倍
+ *   --keys=         键的取值范围，默认 1048576
+ *   --prefill=      开始前插入的键的个数，默认为 keys 的一半
+ *   --key-size=     键的字节数，取 8 时为 uint64_t，否则为此长度的 std::string，默认 8
+ *   --value-size=   值的字节数，取 8 时为 uint64_t，否则为此长度的 std::string，默认 8
+ *   --ops=          每个线程执行的操作次数，默认 1000000
+ *   --format=       输出格式，csv 或者 json，默认 csv
+ * 每个线程的操作序列在开始计时之前生成好；每 LATENCY_SAMPLE_INTERVAL 次操作记录一次单次操作的耗时，
+ * 用于计算 p50/p99/p999，吞吐基本不受计时的影响
+ * 例如：bench_suite --maps=node,rwlock --dists=zipf --reads=95 --threads=1,4 --format=json
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+#include <iostream>
+#include "concurrent_hash_map.h"
+#include "flat_hash_bucket.h"
+#include "fast_hash.h"
+#include "sharded_hash_map.h"
+#include "cuckoo_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::FlatHashBucket;
+using noahyzhang::concurrent::FastHash;
+using noahyzhang::concurrent::ShardedConcurrentHashMap;
+using noahyzhang::concurrent::ConcurrentCuckooMap;
+
+#define LATENCY_SAMPLE_INTERVAL (64)
+#define FAST_MAP_BUCKET_SIZE (1024)
+
+enum OpType {
+    kOpFind,
+    kOpInsert,
+    kOpErase,
+};
+
+// 一次操作：键在键表中的下标与操作类型
+struct Op {
+    uint32_t key_index;
+    uint32_t type;
+};
+
+struct Config {
+    std::vector<std::string> maps = {"node", "flat", "fast", "sharded", "cuckoo", "mutex", "rwlock"};
+    std::vector<std::string> dists = {"uniform", "zipf"};
+    double theta = 0.99;
+    std::vector<size_t> reads = {50, 95};
+    std::vector<size_t> threads;
+    size_t keys = 1 << 20;
+    size_t prefill = SIZE_MAX;
+    size_t key_size = 8;
+    size_t value_size = 8;
+    size_t ops = 1000000;
+    std::string format = "csv";
+};
+
+struct Result {
+    std::string map;
+    std::string dist;
+    size_t read_percent;
+    size_t thread_count;
+    double mops;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+};
+
+/**
+ * @brief zipf 分布，下标越小越热，见 Gray 等人的 Quickly Generating Billion-Record Synthetic Databases
+ *        构造时需要 O(n) 计算 zeta(n)
+ */
+class ZipfGenerator {
+public:
+    ZipfGenerator(size_t n, double theta) : n_(n), theta_(theta) {
+        double zeta2 = 0;
+        zetan_ = 0;
+        for (size_t i = 1; i <= n; ++i) {
+            zetan_ += 1.0 / pow(static_cast<double>(i), theta);
+            if (i == 2) {
+                zeta2 = zetan_;
+            }
+        }
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+
+    template <typename G>
+    size_t operator()(G& eng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(eng);
+        double uz = u * zetan_;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + pow(0.5, theta_)) return 1;
+        size_t index = static_cast<size_t>(n_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+        return index < n_ ? index : n_ - 1;
+    }
+
+private:
+    size_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+// splitmix64 的混合步骤，是一个双射，把键表的下标打散为互不相同的键
+uint64_t scramble(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+void make_item(uint64_t x, size_t, uint64_t& out) {
+    out = x;
+}
+
+void make_item(uint64_t x, size_t size, std::string& out) {
+    out.assign(size, '0');
+    for (size_t i = 0; i < size && x != 0; ++i, x >>= 4) {
+        out[i] = "0123456789abcdef"[x & 0xf];
+    }
+}
+
+// ConcurrentHashMap 的各种配置，以及 ShardedConcurrentHashMap、ConcurrentCuckooMap
+template <typename K, typename V, typename M>
+class ConcurrentAdapter {
+public:
+    using key_type = K;
+    using mapped_type = V;
+
+    template <typename... Args>
+    explicit ConcurrentAdapter(Args&&... args) : map_(std::forward<Args>(args)...) {}
+    bool find(const K& key, V& value) const {
+        return map_.find(key, value);
+    }
+    void insert(const K& key, const V& value) {
+        map_.insert(key, value);
+    }
+    void erase(const K& key) {
+        map_.erase(key);
+    }
+
+private:
+    M map_;
+};
+
+// 以一把互斥锁保护的 std::unordered_map
+template <typename K, typename V>
+class MutexMap {
+public:
+    using key_type = K;
+    using mapped_type = V;
+
+    bool find(const K& key, V& value) const {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto iter = map_.find(key);
+        if (iter == map_.end()) return false;
+        value = iter->second;
+        return true;
+    }
+    void insert(const K& key, const V& value) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        map_[key] = value;
+    }
+    void erase(const K& key) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        map_.erase(key);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<K, V> map_;
+};
+
+// 以一把读写锁保护的 std::unordered_map，查找加读锁
+template <typename K, typename V>
+class RwLockMap {
+public:
+    using key_type = K;
+    using mapped_type = V;
+
+    RwLockMap() {
+        pthread_rwlock_init(&rw_lock_, nullptr);
+    }
+    ~RwLockMap() {
+        pthread_rwlock_destroy(&rw_lock_);
+    }
+    bool find(const K& key, V& value) const {
+        pthread_rwlock_rdlock(&rw_lock_);
+        auto iter = map_.find(key);
+        bool found = iter != map_.end();
+        if (found) {
+            value = iter->second;
+        }
+        pthread_rwlock_unlock(&rw_lock_);
+        return found;
+    }
+    void insert(const K& key, const V& value) {
+        pthread_rwlock_wrlock(&rw_lock_);
+        map_[key] = value;
+        pthread_rwlock_unlock(&rw_lock_);
+    }
+    void erase(const K& key) {
+        pthread_rwlock_wrlock(&rw_lock_);
+        map_.erase(key);
+        pthread_rwlock_unlock(&rw_lock_);
+    }
+
+private:
+    mutable pthread_rwlock_t rw_lock_;
+    std::unordered_map<K, V> map_;
+};
+
+uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+template <typename M>
+Result run(const std::string& name, M* mp, const Config& cfg, const std::vector<typename M::key_type>& keys,
+           const std::vector<std::vector<Op>>& traces) {
+    using V = typename M::mapped_type;
+    V value;
+    make_item(1, cfg.value_size, value);
+    for (size_t i = 0; i < cfg.prefill; ++i) {
+        mp->insert(keys[i], value);
+    }
+    size_t thread_count = traces.size();
+    std::vector<std::vector<uint64_t>> latencies(thread_count);
+    std::vector<std::thread> threads;
+    auto start_tm = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t]() {
+            const std::vector<Op>& trace = traces[t];
+            std::vector<uint64_t>& samples = latencies[t];
+            samples.reserve(trace.size() / LATENCY_SAMPLE_INTERVAL + 1);
+            V out;
+            for (size_t i = 0; i < trace.size(); ++i) {
+                bool sampled = i % LATENCY_SAMPLE_INTERVAL == 0;
+                std::chrono::steady_clock::time_point op_tm;
+                if (sampled) {
+                    op_tm = std::chrono::steady_clock::now();
+                }
+                const Op& op = trace[i];
+                if (op.type == kOpFind) {
+                    mp->find(keys[op.key_index], out);
+                } else if (op.type == kOpInsert) {
+                    mp->insert(keys[op.key_index], value);
+                } else {
+                    mp->erase(keys[op.key_index]);
+                }
+                if (sampled) {
+                    samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - op_tm).count());
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_tm).count();
+
+    std::vector<uint64_t> all;
+    for (auto& samples : latencies) {
+        all.insert(all.end(), samples.begin(), samples.end());
+    }
+    std::sort(all.begin(), all.end());
+    Result res;
+    res.map = name;
+    res.mops = static_cast<double>(thread_count) * cfg.ops / seconds / 1e6;
+    res.p50_ns = percentile(all, 0.5);
+    res.p99_ns = percentile(all, 0.99);
+    res.p999_ns = percentile(all, 0.999);
+    return res;
+}
+
+template <typename M>
+Result run_new(const std::string& name, const Config& cfg, const std::vector<typename M::key_type>& keys,
+               const std::vector<std::vector<Op>>& traces) {
+    std::unique_ptr<M> mp(new M());
+    return run(name, mp.get(), cfg, keys, traces);
+}
+
+void print_header(const Config& cfg) {
+    if (cfg.format == "csv") {
+        std::cout << "map,dist,theta,read_percent,threads,keys,prefill,key_size,value_size,ops_per_thread,"
+            << "mops,p50_ns,p99_ns,p999_ns" << std::endl;
+    } else {
+        std::cout << "[";
+    }
+}
+
+void print_result(const Config& cfg, const Result& res, bool first) {
+    if (cfg.format == "csv") {
+        std::cout << res.map << "," << res.dist << "," << cfg.theta << "," << res.read_percent << ","
+            << res.thread_count << "," << cfg.keys << "," << cfg.prefill << "," << cfg.key_size << ","
+            << cfg.value_size << "," << cfg.ops << "," << res.mops << "," << res.p50_ns << ","
+            << res.p99_ns << "," << res.p999_ns << std::endl;
+    } else {
+        std::cout << (first ? "\n" : ",\n") << "  {\"map\": \"" << res.map << "\", \"dist\": \"" << res.dist
+            << "\", \"theta\": " << cfg.theta << ", \"read_percent\": " << res.read_percent
+            << ", \"threads\": " << res.thread_count << ", \"keys\": " << cfg.keys
+            << ", \"prefill\": " << cfg.prefill << ", \"key_size\": " << cfg.key_size
+            << ", \"value_size\": " << cfg.value_size << ", \"ops_per_thread\": " << cfg.ops
+            << ", \"mops\": " << res.mops << ", \"p50_ns\": " << res.p50_ns << ", \"p99_ns\": " << res.p99_ns
+            << ", \"p999_ns\": " << res.p999_ns << "}";
+    }
+}
+
+void print_footer(const Config& cfg) {
+    if (cfg.format == "json") {
+        std::cout << "\n]" << std::endl;
+    }
+}
+
+template <typename K, typename V>
+void run_all(const Config& cfg) {
+    std::vector<K> keys(cfg.keys);
+    for (size_t i = 0; i < cfg.keys; ++i) {
+        make_item(scramble(i), cfg.key_size, keys[i]);
+    }
+    bool first = true;
+    print_header(cfg);
+    for (const std::string& dist : cfg.dists) {
+        std::unique_ptr<ZipfGenerator> zipf;
+        if (dist == "zipf") {
+            zipf.reset(new ZipfGenerator(cfg.keys, cfg.theta));
+        }
+        for (size_t read_percent : cfg.reads) {
+            for (size_t thread_count : cfg.threads) {
+                std::vector<std::vector<Op>> traces(thread_count);
+                for (size_t t = 0; t < thread_count; ++t) {
+                    std::default_random_engine eng(t);
+                    std::uniform_int_distribution<size_t> rand_key(0, cfg.keys - 1);
+                    std::uniform_int_distribution<size_t> rand_percent(0, 199);
+                    traces[t].resize(cfg.ops);
+                    for (auto& op : traces[t]) {
+                        op.key_index = static_cast<uint32_t>(zipf ? (*zipf)(eng) : rand_key(eng));
+                        size_t percent = rand_percent(eng);
+                        op.type = percent < read_percent * 2 ? kOpFind
+                            : (percent % 2 == 0 ? kOpInsert : kOpErase);
+                    }
+                }
+                for (const std::string& name : cfg.maps) {
+                    Result res;
+                    if (name == "node") {
+                        res = run_new<ConcurrentAdapter<K, V, ConcurrentHashMap<K, V>>>(name, cfg, keys, traces);
+                    } else if (name == "flat") {
+                        res = run_new<ConcurrentAdapter<K, V, ConcurrentHashMap<K, V, std::hash<K>, FlatHashBucket<K, V>>>>(
+                            name, cfg, keys, traces);
+                    } else if (name == "fast") {
+                        ConcurrentAdapter<K, V, ConcurrentHashMap<K, V, FastHash>> mp(FAST_MAP_BUCKET_SIZE);
+                        res = run(name, &mp, cfg, keys, traces);
+                    } else if (name == "sharded") {
+                        res = run_new<ConcurrentAdapter<K, V, ShardedConcurrentHashMap<K, V>>>(name, cfg, keys, traces);
+                    } else if (name == "cuckoo") {
+                        res = run_new<ConcurrentAdapter<K, V, ConcurrentCuckooMap<K, V>>>(name, cfg, keys, traces);
+                    } else if (name == "mutex") {
+                        res = run_new<MutexMap<K, V>>(name, cfg, keys, traces);
+                    } else {
+                        res = run_new<RwLockMap<K, V>>(name, cfg, keys, traces);
+                    }
+                    res.dist = dist;
+                    res.read_percent = read_percent;
+                    res.thread_count = thread_count;
+                    print_result(cfg, res, first);
+                    first = false;
+                }
+            }
+        }
+    }
+    print_footer(cfg);
+}
+
+std::vector<std::string> split(const std::string& str) {
+    std::vector<std::string> items;
+    size_t begin = 0;
+    for (;;) {
+        size_t end = str.find(',', begin);
+        items.push_back(str.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+        if (end == std::string::npos) break;
+        begin = end + 1;
+    }
+    return items;
+}
+
+std::vector<size_t> split_numbers(const std::string& str) {
+    std::vector<size_t> numbers;
+    for (const std::string& item : split(str)) {
+        numbers.push_back(strtoull(item.c_str(), nullptr, 10));
+    }
+    return numbers;
+}
+
+bool parse_args(int argc, char* argv[], Config& cfg) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+            std::cerr << "invalid argument: " << arg << std::endl;
+            return false;
+        }
+        std::string name = arg.substr(2, eq - 2);
+        std::string value = arg.substr(eq + 1);
+        if (name == "maps") {
+            cfg.maps = split(value);
+        } else if (name == "dists") {
+            cfg.dists = split(value);
+        } else if (name == "theta") {
+            cfg.theta = strtod(value.c_str(), nullptr);
+        } else if (name == "reads") {
+            cfg.reads = split_numbers(value);
+        } else if (name == "threads") {
+            cfg.threads = split_numbers(value);
+        } else if (name == "keys") {
+            cfg.keys = strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "prefill") {
+            cfg.prefill = strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "key-size") {
+            cfg.key_size = strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "value-size") {
+            cfg.value_size = strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "ops") {
+            cfg.ops = strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "format") {
+            cfg.format = value;
+        } else {
+            std::cerr << "unknown argument: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (cfg.keys == 0 || cfg.keys > UINT32_MAX || (cfg.theta == 1.0 && std::count(cfg.dists.begin(),
+        cfg.dists.end(), "zipf") != 0) || (cfg.format != "csv" && cfg.format != "json")) {
+        std::cerr << "invalid keys, theta or format" << std::endl;
+        return false;
+    }
+    const std::vector<std::string> all_maps = {"node", "flat", "fast", "sharded", "cuckoo", "mutex", "rwlock"};
+    for (const std::string& name : cfg.maps) {
+        if (std::count(all_maps.begin(), all_maps.end(), name) == 0) {
+            std::cerr << "unknown map: " << name << std::endl;
+            return false;
+        }
+    }
+    for (const std::string& dist : cfg.dists) {
+        if (dist != "uniform" && dist != "zipf") {
+            std::cerr << "unknown dist: " << dist << std::endl;
+            return false;
+        }
+    }
+    for (size_t read_percent : cfg.reads) {
+        if (read_percent > 100) {
+            std::cerr << "invalid read percent: " << read_percent << std::endl;
+            return false;
+        }
+    }
+    if (cfg.prefill == SIZE_MAX) {
+        cfg.prefill = cfg.keys / 2;
+    } else if (cfg.prefill > cfg.keys) {
+        std::cerr << "prefill is larger than keys" << std::endl;
+        return false;
+    }
+    if (cfg.threads.empty()) {
+        size_t max_thread_count = std::thread::hardware_concurrency();
+        if (max_thread_count == 0) {
+            max_thread_count = 1;
+        }
+        for (size_t thread_count = 1; thread_count < max_thread_count; thread_count *= 2) {
+            cfg.threads.push_back(thread_count);
+        }
+        cfg.threads.push_back(max_thread_count);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Config cfg;
+    if (!parse_args(argc, argv, cfg)) {
+        return 1;
+    }
+    if (cfg.key_size == 8 && cfg.value_size == 8) {
+        run_all<uint64_t, uint64_t>(cfg);
+    } else if (cfg.key_size == 8) {
+        run_all<uint64_t, std::string>(cfg);
+    } else if (cfg.value_size == 8) {
+        run_all<std::string, uint64_t>(cfg);
+    } else {
+        run_all<std::string, std::string>(cfg);
+    }
+    return 0;
+}
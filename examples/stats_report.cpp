@@ -0,0 +1,104 @@
+/**
+ * @file stats_report.cpp
+ * @author noahyzhang
+ * @brief 打开 CONCURRENT_HASH_MAP_STATS 后，输出一段混合读写负载的统计快照
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：THREAD_COUNT 个线程，值为 std::string（查找需要加读锁），每个线程执行 OP_COUNT 次操作，
+ * 其中 80% 查找、10% 插入、10% 删除；一半的操作集中在 HOT_KEY_COUNT 个热点键上，其余随机落在 KEY_RANGE 个键上
+ * 输出两次快照之间的操作次数、锁的争用与等待时间、链长直方图，以及加锁次数最多的几个锁分片
+ * 此目标以 CONCURRENT_HASH_MAP_STATS 编译，见 CMakeLists.txt
+ */
+
+#include <thread>
+#include <vector>
+#include <random>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include "concurrent_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+using noahyzhang::concurrent::MapStats;
+using noahyzhang::concurrent::kStatsFind;
+using noahyzhang::concurrent::kStatsUpsert;
+using noahyzhang::concurrent::kStatsErase;
+using noahyzhang::concurrent::kStatsNodeAlloc;
+using noahyzhang::concurrent::kStatsNodeFree;
+
+#define THREAD_COUNT (4)
+#define OP_COUNT (1000000)
+#define KEY_RANGE (1 << 20)
+#define HOT_KEY_COUNT (16)
+#define TOP_STRIPE_COUNT (5)
+
+int main() {
+    ConcurrentHashMap<uint64_t, std::string> mp;
+    for (uint64_t i = 0; i < KEY_RANGE; i += 2) {
+        mp.insert(i, "value");
+    }
+    MapStats before = mp.stats();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < THREAD_COUNT; ++t) {
+        threads.emplace_back([&, t]() {
+            std::default_random_engine eng(t);
+            std::uniform_int_distribution<uint64_t> rand_key(0, KEY_RANGE - 1);
+            std::uniform_int_distribution<int> rand_op(0, 9);
+            std::string value;
+            for (size_t i = 0; i < OP_COUNT; ++i) {
+                uint64_t key = rand_key(eng);
+                if (i % 2 == 0) {
+                    key %= HOT_KEY_COUNT;
+                }
+                int op = rand_op(eng);
+                if (op == 0) {
+                    mp.insert(key, "value");
+                } else if (op == 1) {
+                    mp.erase(key);
+                } else {
+                    mp.find(key, value);
+                }
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    MapStats after = mp.stats();
+
+    std::cout << "size: " << after.size << ", buckets: " << after.bucket_count << ", load factor: "
+        << after.load_factor << ", max chain length: " << after.max_chain_length << std::endl;
+    std::cout << "find: " << after.counts[kStatsFind] - before.counts[kStatsFind]
+        << ", upsert: " << after.counts[kStatsUpsert] - before.counts[kStatsUpsert]
+        << ", erase: " << after.counts[kStatsErase] - before.counts[kStatsErase]
+        << ", node alloc: " << after.counts[kStatsNodeAlloc] - before.counts[kStatsNodeAlloc]
+        << ", node free: " << after.counts[kStatsNodeFree] - before.counts[kStatsNodeFree] << std::endl;
+    std::cout << "lock read: " << after.lock_read_count - before.lock_read_count
+        << ", lock write: " << after.lock_write_count - before.lock_write_count
+        << ", contended: " << after.lock_contended_count - before.lock_contended_count
+        << ", wait: " << (after.lock_wait_ns - before.lock_wait_ns) / 1000 << " us" << std::endl;
+    std::cout << "chain length histogram:";
+    for (size_t i = 0; i < after.chain_length_histogram.size(); ++i) {
+        std::cout << " " << i << ":" << after.chain_length_histogram[i];
+    }
+    std::cout << std::endl;
+
+    std::vector<size_t> order(after.stripe_lock_counts.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    auto delta = [&](size_t i) { return after.stripe_lock_counts[i] - before.stripe_lock_counts[i]; };
+    std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) { return delta(lhs) > delta(rhs); });
+    for (size_t i = 0; i < order.size() && i < TOP_STRIPE_COUNT; ++i) {
+        size_t stripe = order[i];
+        std::cout << "stripe " << stripe << ": locks " << delta(stripe) << ", contended "
+            << after.stripe_contended_counts[stripe] - before.stripe_contended_counts[stripe] << std::endl;
+    }
+    return 0;
+}
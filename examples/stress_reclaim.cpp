@@ -0,0 +1,101 @@
+/**
+ * @file stress_reclaim.cpp
+ * @author noahyzhang
+ * @brief 删除与不加锁读者、迭代器并发的压力测试，用于在 ASan/TSan 下检查节点回收
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+/**
+ * 测试条件：
+ * 1. 写线程各自负责一部分键，反复插入、删除，值始终为 key * VALUE_FACTOR，因此不会原地修改已有节点的值
+ * 2. 读线程不加锁乐观读，读到的值必须和键对应
+ * 3. 迭代线程不加锁遍历整个 map，访问到的每个元素的值也必须和键对应
+ * 删除的节点如果被立即释放，读线程和迭代线程会访问到已释放的内存，ASan 会报 heap-use-after-free
+ * 编译：cmake -DSANITIZER=address 或者 cmake -DSANITIZER=thread
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include "concurrent_hash_map.h"
+
+using noahyzhang::concurrent::ConcurrentHashMap;
+
+#define WRITER_COUNT (4)
+#define READER_COUNT (4)
+#define KEY_RANGE (1 << 14)
+#define VALUE_FACTOR (7)
+#define RUN_SECONDS (3)
+
+int main() {
+    // 桶数较少，让删除频繁触发收缩和扩容
+    ConcurrentHashMap<uint64_t, uint64_t> mp(16);
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> reads{0}, writes{0}, iterations{0};
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < WRITER_COUNT; ++w) {
+        threads.emplace_back([&, w]() {
+            std::default_random_engine eng(w);
+            std::uniform_int_distribution<uint64_t> rand_range(0, KEY_RANGE / WRITER_COUNT - 1);
+            // 每个写线程只操作 key % WRITER_COUNT == w 的键，插入之前键一定不存在
+            std::vector<bool> present(KEY_RANGE / WRITER_COUNT, false);
+            uint64_t count = 0;
+            for (; !stop.load(std::memory_order_relaxed); ++count) {
+                uint64_t idx = rand_range(eng);
+                uint64_t key = idx * WRITER_COUNT + w;
+                if (present[idx]) {
+                    mp.erase(key);
+                } else {
+                    mp.insert(key, key * VALUE_FACTOR);
+                }
+                present[idx] = !present[idx];
+            }
+            writes.fetch_add(count);
+        });
+    }
+    for (int r = 0; r < READER_COUNT; ++r) {
+        threads.emplace_back([&, r]() {
+            std::default_random_engine eng(WRITER_COUNT + r);
+            std::uniform_int_distribution<uint64_t> rand_range(0, KEY_RANGE - 1);
+            uint64_t count = 0;
+            for (; !stop.load(std::memory_order_relaxed); ++count) {
+                uint64_t key = rand_range(eng);
+                uint64_t value = 0;
+                if (mp.find(key, value) && value != key * VALUE_FACTOR) {
+                    errors.fetch_add(1);
+                }
+            }
+            reads.fetch_add(count);
+        });
+    }
+    threads.emplace_back([&]() {
+        uint64_t count = 0;
+        for (; !stop.load(std::memory_order_relaxed); ++count) {
+            auto iter = mp.get_iterator();
+            for (; iter != nullptr; iter++) {
+                if (iter->get_value() != iter->get_key() * VALUE_FACTOR) {
+                    errors.fetch_add(1);
+                }
+            }
+        }
+        iterations.fetch_add(count);
+    });
+
+    std::this_thread::sleep_for(std::chrono::seconds(RUN_SECONDS));
+    stop.store(true);
+    for (auto& t : threads) {
+        t.join();
+    }
+    std::cout << "writes: " << writes.load() << ", reads: " << reads.load() << ", iterations: "
+        << iterations.load() << ", size: " << mp.size() << ", errors: " << errors.load() << std::endl;
+    return errors.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file cache_aligned.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <new>
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 缓存行大小
+#define CACHE_LINE_SIZE (64)
+
+/**
+ * @brief 按缓存行（或者 T 本身更大的对齐）对齐分配并构造 count 个对象
+ *        C++11 的 new 不保证超过 16 字节的对齐，需要缓存行对齐的对象都通过这里分配
+ * 
+ * @tparam T 
+ * @param count 
+ * @return T* 
+ */
+template <typename T>
+T* cache_aligned_new(size_t count) {
+    void* mem = nullptr;
+    size_t align = alignof(T) > CACHE_LINE_SIZE ? alignof(T) : CACHE_LINE_SIZE;
+    if (posix_memalign(&mem, align, sizeof(T) * count) != 0) {
+        throw std::bad_alloc();
+    }
+    T* objs = static_cast<T*>(mem);
+    for (size_t i = 0; i < count; ++i) {
+        new (objs + i) T();
+    }
+    return objs;
+}
+
+/**
+ * @brief 析构并释放 cache_aligned_new 分配的对象
+ * 
+ * @tparam T 
+ * @param objs 
+ * @param count 
+ */
+template <typename T>
+void cache_aligned_delete(T* objs, size_t count) {
+    if (objs == nullptr) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        objs[i].~T();
+    }
+    free(objs);
+}
+
+}  // namespace concurrent
+}  // namespace noahyzhang
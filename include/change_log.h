@@ -0,0 +1,589 @@
+/**
+ * @file change_log.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "cache_aligned.h"
+#include "map_file.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 每个写线程的环形缓冲区的默认字节数，必须是 2 的幂
+#define CHANGE_LOG_RING_SIZE (1 << 20)
+// 后台线程两次写出之间的最长间隔（毫秒），某个环形缓冲区用掉一半时会提前唤醒
+#define CHANGE_LOG_FLUSH_INTERVAL_MS (10)
+// 后台线程的写缓冲区超过此大小时先写入文件，再继续收集
+#define CHANGE_LOG_WRITE_BUFFER_SIZE (4 << 20)
+
+/**
+ * @brief 变更的订阅者，设置到 ConcurrentHashMap 后，每次修改都在桶的写锁下回调
+ *        回调顺序与同一个键上的修改顺序一致；回调中不能访问此哈希表，应该尽快返回
+ * 
+ * @tparam K 
+ * @tparam V 
+ */
+template <typename K, typename V>
+class ChangeFeed {
+public:
+    virtual ~ChangeFeed() = default;
+
+    /**
+     * @brief 键被插入或者值被修改，value 是修改之后的值
+     * 
+     * @param key 
+     * @param value 
+     */
+    virtual void on_assign(const K& key, const V& value) = 0;
+
+    /**
+     * @brief 键被删除
+     * 
+     * @param key 
+     */
+    virtual void on_erase(const K& key) = 0;
+};
+
+/**
+ * @brief 变更日志中记录的类型
+ */
+enum ChangeType : uint8_t {
+    kChangeAssign = 1,
+    kChangeErase = 2,
+};
+
+/**
+ * @brief 变更日志文件的头部，之后是依次追加的记录，各字段都是本机字节序
+ *        每条记录：4 字节的长度（不含自身），1 字节的 ChangeType，8 字节的序号，
+ *        然后是以 append_map_file_field 编码的键，kChangeAssign 时再跟着同样编码的值
+ */
+struct ChangeLogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+static constexpr char kChangeLogMagic[8] = {'C', 'H', 'M', 'A', 'P', 'L', 'O', 'G'};
+static constexpr uint32_t kChangeLogVersion = 1;
+
+/**
+ * @brief 解析出的一条记录，fields 指向键（和值）的编码
+ */
+struct ChangeRecord {
+    uint8_t type;
+    uint64_t sequence;
+    const char* fields;
+    const char* fields_end;
+};
+
+/**
+ * @brief 检查文件开头是否为变更日志的头部
+ * 
+ * @param data 
+ * @param size 
+ * @return true 
+ * @return false 
+ */
+inline bool check_change_log_header(const char* data, size_t size) {
+    ChangeLogHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    return memcmp(header.magic, kChangeLogMagic, sizeof(kChangeLogMagic)) == 0 && header.version == kChangeLogVersion;
+}
+
+/**
+ * @brief 从 [pos, end) 解析一条记录，成功后 pos 移动到下一条记录
+ * 
+ * @param pos 
+ * @param end 
+ * @param record 
+ * @return true 
+ * @return false 数据被截断（例如进程在写入过程中崩溃）或者类型不合法
+ */
+inline bool read_change_record(const char*& pos, const char* end, ChangeRecord& record) {
+    uint32_t len;
+    if (static_cast<size_t>(end - pos) < sizeof(len)) {
+        return false;
+    }
+    memcpy(&len, pos, sizeof(len));
+    if (len < sizeof(record.type) + sizeof(record.sequence) || static_cast<size_t>(end - pos) - sizeof(len) < len) {
+        return false;
+    }
+    const char* payload = pos + sizeof(len);
+    memcpy(&record.type, payload, sizeof(record.type));
+    memcpy(&record.sequence, payload + sizeof(record.type), sizeof(record.sequence));
+    if (record.type != kChangeAssign && record.type != kChangeErase) {
+        return false;
+    }
+    record.fields = payload + sizeof(record.type) + sizeof(record.sequence);
+    record.fields_end = payload + len;
+    pos = record.fields_end;
+    return true;
+}
+
+/**
+ * @brief 把变更写入只追加的日志文件，用于在备机上重建哈希表，或者与 save 的快照一起实现快速的重启预热
+ *        每个写线程有自己的单生产者单消费者环形缓冲区，写操作在桶的写锁下取一个全局序号、编码记录并放入缓冲区，
+ *        不做任何 I/O，也不加锁；后台线程每 CHANGE_LOG_FLUSH_INTERVAL_MS 毫秒把所有缓冲区中的记录成批写入文件
+ *        缓冲区满时写线程唤醒后台线程，在桶的写锁下让出 CPU 等待，直到后台线程腾出空间（计入 stall_count）；
+ *        超过缓冲区容量的单条记录放入一个共享的队列，同样由后台线程写出，写线程只在入队时短暂加锁
+ * 
+ *        记录的是修改之后的值而不是增量，重放同一条记录多次的结果相同；
+ *        文件中的记录不按序号排列，ConcurrentHashMap::replay 按键分组、组内按序号重放
+ * 
+ * @tparam K 
+ * @tparam V 
+ * @tparam KS 键的序列化器，要求见 PodSerializer
+ * @tparam VS 值的序列化器
+ */
+template <typename K, typename V, typename KS = PodSerializer<K>, typename VS = PodSerializer<V>>
+class ChangeLog : public ChangeFeed<K, V> {
+public:
+    /**
+     * @brief 构造函数
+     * 
+     * @param key_serializer 
+     * @param value_serializer 
+     * @param ring_size 每个写线程的环形缓冲区的字节数，向上取整到 2 的幂
+     */
+    explicit ChangeLog(const KS& key_serializer = KS(), const VS& value_serializer = VS(),
+                       size_t ring_size = CHANGE_LOG_RING_SIZE)
+        : key_serializer_(key_serializer), value_serializer_(value_serializer),
+          id_(next_log_id().fetch_add(1, std::memory_order_relaxed)) {
+        ring_size_ = 1;
+        for (; ring_size_ < ring_size;) {
+            ring_size_ <<= 1;
+        }
+    }
+    ~ChangeLog() {
+        close();
+        std::lock_guard<std::mutex> guard(rings_mutex_);
+        for (auto& ring : rings_) {
+            ring->closed.store(true, std::memory_order_release);
+        }
+    }
+    ChangeLog(const ChangeLog&) = delete;
+    ChangeLog& operator=(const ChangeLog&) = delete;
+
+public:
+    /**
+     * @brief 打开日志文件并启动后台线程，文件不存在时创建；之前打开的文件会先被关闭
+     *        追加到已有的日志时，序号从其中最大的序号之后继续，末尾不完整的记录被截断
+     * 
+     * @param path 
+     * @param sync 是否在每次写出后调用 fdatasync，为 false 时只保证进程崩溃不丢失已写出的记录
+     * @return true 
+     * @return false 文件无法打开或者不是变更日志
+     */
+    bool open(const std::string& path, bool sync = false) {
+        close();
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        uint64_t valid_size = 0;
+        uint64_t next_sequence = 0;
+        if (!recover(path, valid_size, next_sequence) || ftruncate(fd, static_cast<off_t>(valid_size)) != 0) {
+            ::close(fd);
+            return false;
+        }
+        if (valid_size == 0) {
+            ChangeLogHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, kChangeLogMagic, sizeof(kChangeLogMagic));
+            header.version = kChangeLogVersion;
+            if (!write_all(fd, &header, sizeof(header))) {
+                ::close(fd);
+                return false;
+            }
+        }
+        fd_ = fd;
+        sync_ = sync;
+        ok_ = true;
+        stopping_ = false;
+        sequence_.store(next_sequence, std::memory_order_relaxed);
+        accepting_.store(true, std::memory_order_release);
+        flusher_ = std::thread(&ChangeLog::run_flusher, this);
+        return true;
+    }
+
+    /**
+     * @brief 停止接收新的记录，写出缓冲区中剩余的记录并关闭文件
+     *        调用前应该先从哈希表上取消订阅（set_change_feed(nullptr)），否则之后的修改不会被记录
+     */
+    void close() {
+        if (fd_ < 0) {
+            return;
+        }
+        accepting_.store(false, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> guard(wake_mutex_);
+            stopping_ = true;
+        }
+        wake_cv_.notify_one();
+        flusher_.join();
+        flush();
+        std::lock_guard<std::mutex> guard(drain_mutex_);
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    /**
+     * @brief 在调用线程上立即把所有缓冲区中的记录写入文件，sync 为 true 时同时同步到磁盘
+     *        返回后，调用之前已经完成的修改都已写出
+     * 
+     * @return true 
+     * @return false 文件未打开，或者此前某次写入失败
+     */
+    bool flush() {
+        std::lock_guard<std::mutex> guard(drain_mutex_);
+        flush_requested_.store(false, std::memory_order_relaxed);
+        if (fd_ < 0) {
+            return false;
+        }
+        buffer_.clear();
+        for (Ring* ring : ring_list()) {
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            if (head == tail) {
+                continue;
+            }
+            size_t begin = static_cast<size_t>(tail & (ring_size_ - 1));
+            size_t len = static_cast<size_t>(head - tail);
+            size_t first = len < ring_size_ - begin ? len : ring_size_ - begin;
+            buffer_.append(ring->data.get() + begin, first);
+            buffer_.append(ring->data.get(), len - first);
+            ring->tail.store(head, std::memory_order_release);
+            if (buffer_.size() >= CHANGE_LOG_WRITE_BUFFER_SIZE) {
+                ok_ = write_all(fd_, buffer_.data(), buffer_.size()) && ok_;
+                buffer_.clear();
+            }
+        }
+        std::vector<std::string> oversized;
+        {
+            std::lock_guard<std::mutex> oversized_guard(oversized_mutex_);
+            oversized.swap(oversized_);
+            oversized_bytes_ = 0;
+        }
+        for (const std::string& record : oversized) {
+            buffer_ += record;
+        }
+        ok_ = write_all(fd_, buffer_.data(), buffer_.size()) && ok_;
+        if (sync_) {
+            ok_ = fdatasync(fd_) == 0 && ok_;
+        }
+        return ok_;
+    }
+
+    /**
+     * @brief 下一条记录的序号，取快照之前读取，重启时从这个序号开始重放即可
+     * 
+     * @return uint64_t 
+     */
+    uint64_t sequence() const {
+        return sequence_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 写线程因为缓冲区已满而等待的次数，等待期间写线程持有桶的写锁
+     *        持续增长时需要增大缓冲区或者缩短写出间隔
+     * 
+     * @return uint64_t 
+     */
+    uint64_t stall_count() const {
+        return stall_count_.load(std::memory_order_relaxed);
+    }
+
+    void on_assign(const K& key, const V& value) override {
+        append(kChangeAssign, key, &value);
+    }
+
+    void on_erase(const K& key) override {
+        append(kChangeErase, key, nullptr);
+    }
+
+private:
+    /**
+     * @brief 一个写线程的环形缓冲区，head 只由写线程推进，tail 只由持有 drain_mutex_ 的线程推进
+     *        写线程退出后缓冲区可以被新的写线程复用
+     */
+    struct alignas(CACHE_LINE_SIZE) Ring {
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head{0};
+        // 编码记录用的临时缓冲区，只有写线程访问
+        std::string scratch;
+        alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail{0};
+        // 是否被某个写线程占用
+        std::atomic<bool> in_use{false};
+        // 所属的日志已经析构，线程本地的引用可以丢弃
+        std::atomic<bool> closed{false};
+        std::unique_ptr<char[]> data;
+    };
+
+    // 线程本地的缓冲区引用，线程退出时归还缓冲区；引用计数保证日志先于线程析构时缓冲区仍然有效
+    struct LocalRings {
+        std::vector<std::pair<uint64_t, std::shared_ptr<Ring>>> rings;
+        ~LocalRings() {
+            for (auto& entry : rings) {
+                entry.second->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    static std::atomic<uint64_t>& next_log_id() {
+        static std::atomic<uint64_t> id{1};
+        return id;
+    }
+
+    Ring* local_ring() {
+        static thread_local LocalRings local;
+        for (auto& entry : local.rings) {
+            if (entry.first == id_) {
+                return entry.second.get();
+            }
+        }
+        for (size_t i = 0; i < local.rings.size();) {
+            if (local.rings[i].second->closed.load(std::memory_order_acquire)) {
+                local.rings[i] = local.rings.back();
+                local.rings.pop_back();
+            } else {
+                ++i;
+            }
+        }
+        std::shared_ptr<Ring> ring = acquire_ring();
+        local.rings.emplace_back(id_, ring);
+        return ring.get();
+    }
+
+    // 优先复用已退出线程的缓冲区，否则新建一个
+    std::shared_ptr<Ring> acquire_ring() {
+        std::lock_guard<std::mutex> guard(rings_mutex_);
+        for (auto& ring : rings_) {
+            bool expected = false;
+            if (!ring->in_use.load(std::memory_order_relaxed)
+                && ring->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                return ring;
+            }
+        }
+        Ring* raw = cache_aligned_new<Ring>(1);
+        std::shared_ptr<Ring> ring(raw, [](Ring* r) { cache_aligned_delete(r, 1); });
+        ring->data.reset(new char[ring_size_]);
+        ring->in_use.store(true, std::memory_order_relaxed);
+        rings_.push_back(ring);
+        return ring;
+    }
+
+    std::vector<Ring*> ring_list() {
+        std::lock_guard<std::mutex> guard(rings_mutex_);
+        std::vector<Ring*> list;
+        list.reserve(rings_.size());
+        for (auto& ring : rings_) {
+            list.push_back(ring.get());
+        }
+        return list;
+    }
+
+    /**
+     * @brief 编码一条记录并放入当前线程的缓冲区，在桶的写锁下调用，序号的顺序与同一个键上的修改顺序一致
+     * 
+     * @param type 
+     * @param key 
+     * @param value kChangeErase 时为空
+     */
+    void append(uint8_t type, const K& key, const V* value) {
+        if (!accepting_.load(std::memory_order_acquire)) {
+            return;
+        }
+        Ring* ring = local_ring();
+        std::string& record = ring->scratch;
+        record.clear();
+        record.append(sizeof(uint32_t), '\0');
+        record.push_back(static_cast<char>(type));
+        uint64_t sequence = sequence_.fetch_add(1, std::memory_order_relaxed);
+        record.append(reinterpret_cast<const char*>(&sequence), sizeof(sequence));
+        append_map_file_field(key_serializer_, key, record);
+        if (value != nullptr) {
+            append_map_file_field(value_serializer_, *value, record);
+        }
+        uint32_t len = static_cast<uint32_t>(record.size() - sizeof(uint32_t));
+        memcpy(&record[0], &len, sizeof(len));
+        if (record.size() > ring_size_) {
+            push_oversized(record);
+            return;
+        }
+        push(ring, record.data(), record.size());
+    }
+
+    // 缓冲区满时让出 CPU 等待后台线程写出，此时调用者持有桶的写锁
+
+    void push(Ring* ring, const char* data, size_t len) {
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; ring_size_ - (head - tail) < len; tail = ring->tail.load(std::memory_order_acquire)) {
+            // 日志已经关闭，后台线程不会再腾出空间
+            if (!accepting_.load(std::memory_order_relaxed)) {
+                return;
+            }
+            stall_count_.fetch_add(1, std::memory_order_relaxed);
+            request_flush();
+            std::this_thread::yield();
+        }
+        size_t begin = static_cast<size_t>(head & (ring_size_ - 1));
+        size_t first = len < ring_size_ - begin ? len : ring_size_ - begin;
+        memcpy(ring->data.get() + begin, data, first);
+        memcpy(ring->data.get(), data + first, len - first);
+        ring->head.store(head + len, std::memory_order_release);
+        if (head + len - tail > ring_size_ / 2 && !flush_requested_.load(std::memory_order_relaxed)) {
+            request_flush();
+        }
+    }
+
+    /**
+     * @brief 放不进环形缓冲区的记录拷贝到共享的队列中，由后台线程写出
+     *        队列中的字节数不超过缓冲区的大小（队列为空时除外），超过时与缓冲区满时一样等待
+     * 
+     * @param record 
+     */
+    void push_oversized(const std::string& record) {
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> guard(oversized_mutex_);
+                if (oversized_.empty() || oversized_bytes_ + record.size() <= ring_size_) {
+                    oversized_.push_back(record);
+                    oversized_bytes_ += record.size();
+                    break;
+                }
+            }
+            if (!accepting_.load(std::memory_order_relaxed)) {
+                return;
+            }
+            stall_count_.fetch_add(1, std::memory_order_relaxed);
+            request_flush();
+            std::this_thread::yield();
+        }
+        request_flush();
+    }
+
+    // 提前唤醒后台线程，唤醒可能丢失，后台线程最迟在下一个间隔醒来
+    void request_flush() {
+        flush_requested_.store(true, std::memory_order_relaxed);
+        wake_cv_.notify_one();
+    }
+
+    void run_flusher() {
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        for (; !stopping_;) {
+            wake_cv_.wait_for(lock, std::chrono::milliseconds(CHANGE_LOG_FLUSH_INTERVAL_MS), [this]() {
+                return stopping_ || flush_requested_.load(std::memory_order_relaxed);
+            });
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+    }
+
+    /**
+     * @brief 扫描已有的日志文件，得到完整记录的结尾与下一个序号
+     * 
+     * @param path 
+     * @param valid_size 空文件时为 0
+     * @param next_sequence 
+     * @return true 
+     * @return false 文件不为空并且不是变更日志
+     */
+    static bool recover(const std::string& path, uint64_t& valid_size, uint64_t& next_sequence) {
+        MappedFile file;
+        if (!file.open(path)) {
+            valid_size = 0;
+            next_sequence = 0;
+            return true;
+        }
+        if (!check_change_log_header(file.data(), file.size())) {
+            return false;
+        }
+        file.advise_sequential();
+        const char* pos = file.data() + sizeof(ChangeLogHeader);
+        const char* end = file.data() + file.size();
+        ChangeRecord record;
+        next_sequence = 0;
+        for (; read_change_record(pos, end, record);) {
+            if (record.sequence >= next_sequence) {
+                next_sequence = record.sequence + 1;
+            }
+        }
+        valid_size = static_cast<uint64_t>(pos - file.data());
+        return true;
+    }
+
+    static bool write_all(int fd, const void* data, size_t len) {
+        const char* pos = static_cast<const char*>(data);
+        for (; len > 0;) {
+            ssize_t written = ::write(fd, pos, len);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            pos += written;
+            len -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+private:
+    KS key_serializer_;
+    VS value_serializer_;
+    // 日志的唯一编号，线程本地的缓冲区引用以此区分不同的日志，地址可能被复用，编号不会
+    uint64_t id_;
+    size_t ring_size_;
+    // 下一条记录的序号
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> sequence_{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> accepting_{false};
+    std::atomic<bool> flush_requested_{false};
+    std::atomic<uint64_t> stall_count_{0};
+    // 所有写线程的缓冲区，只增不减
+    std::mutex rings_mutex_;
+    std::vector<std::shared_ptr<Ring>> rings_;
+    // 消费缓冲区、写文件的互斥锁，后台线程与 flush 的调用者共用
+    std::mutex drain_mutex_;
+    std::string buffer_;
+    // 超过缓冲区容量的记录，写线程入队，持有 drain_mutex_ 的线程取出
+    std::mutex oversized_mutex_;
+    std::vector<std::string> oversized_;
+    size_t oversized_bytes_ = 0;
+    int fd_ = -1;
+    bool sync_ = false;
+    bool ok_ = true;
+    // 后台线程
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    bool stopping_ = false;
+    std::thread flusher_;
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
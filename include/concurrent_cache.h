@@ -0,0 +1,375 @@
+/**
+ * @file concurrent_cache.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "concurrent_hash_map.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 后台清理线程每次检查的桶数
+#define CACHE_SWEEP_BUCKET_STEP (64)
+// 超出容量时淘汰指针每次前进的桶数
+#define CACHE_EVICT_BUCKET_STEP (16)
+// 每次淘汰到容量的 1 / CACHE_EVICT_BATCH_RATIO 以下，之后的一批插入不再触发淘汰，分摊加锁与扫描的开销
+#define CACHE_EVICT_BATCH_RATIO (256)
+// 元素个数超过容量的 1 / CACHE_OVERFLOW_RATIO 以上时，put 等待正在进行的淘汰，而不是直接返回
+#define CACHE_OVERFLOW_RATIO (16)
+
+/**
+ * @brief 缓存的条目，与值一起存放在节点中的还有过期时间和 CLOCK 淘汰的访问标记
+ *        访问标记是原子变量，查找时在读锁下设置；拷贝和赋值读写的是某一时刻的标记
+ * 
+ * @tparam V 
+ */
+template <typename V>
+class CacheEntry {
+public:
+    CacheEntry(V value, int64_t expire_at) : value_(std::move(value)), expire_at_(expire_at), referenced_(false) {}
+    CacheEntry(const CacheEntry& other)
+        : value_(other.value_), expire_at_(other.expire_at_), referenced_(other.referenced_.load()) {}
+    CacheEntry(CacheEntry&& other)
+        : value_(std::move(other.value_)), expire_at_(other.expire_at_), referenced_(other.referenced_.load()) {}
+    CacheEntry& operator=(const CacheEntry& other) {
+        value_ = other.value_;
+        expire_at_ = other.expire_at_;
+        referenced_.store(other.referenced_.load(), std::memory_order_relaxed);
+        return *this;
+    }
+    CacheEntry& operator=(CacheEntry&& other) {
+        value_ = std::move(other.value_);
+        expire_at_ = other.expire_at_;
+        referenced_.store(other.referenced_.load(), std::memory_order_relaxed);
+        return *this;
+    }
+
+public:
+    /**
+     * @brief 获取值
+     * 
+     * @return const V& 
+     */
+    const V& get_value() const {
+        return value_;
+    }
+
+    /**
+     * @brief 过期时间，steady_clock 的纳秒数，0 表示永不过期
+     * 
+     * @return int64_t 
+     */
+    int64_t expire_at() const {
+        return expire_at_;
+    }
+
+    /**
+     * @brief 在 now 时刻是否已经过期
+     * 
+     * @param now 
+     * @return true 
+     * @return false 
+     */
+    bool expired(int64_t now) const {
+        return expire_at_ != 0 && now >= expire_at_;
+    }
+
+    /**
+     * @brief 设置访问标记，已经设置过时不再写，热点条目的查找不会反复写同一个缓存行
+     */
+    void touch() const {
+        if (!referenced_.load(std::memory_order_relaxed)) {
+            referenced_.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 清除访问标记
+     * 
+     * @return true 清除之前设置了访问标记
+     * @return false 
+     */
+    bool clear_referenced() {
+        return referenced_.exchange(false, std::memory_order_relaxed);
+    }
+
+private:
+    V value_;
+    int64_t expire_at_;
+    mutable std::atomic<bool> referenced_;
+};
+
+/**
+ * @brief 并发缓存，在 ConcurrentHashMap 上增加过期时间与容量上限
+ *        1. 过期：每个条目在节点中记录过期时间，find 时检查，过期的条目视为不存在并顺手删除；
+ *           过期但一直没有被访问的条目由 sweep 增量清理，可以由调用者定时调用，也可以用 start_sweeper 启动后台线程
+ *        2. 容量：put 插入新键后元素个数超过容量时，按 CLOCK 算法淘汰：淘汰指针按桶的下标循环前进，
+ *           过期的条目直接删除，带访问标记的条目清除标记后保留（第二次机会），其余条目删除，
+ *           直到比容量少 1 / CACHE_EVICT_BATCH_RATIO，淘汰是成批进行的
+ *           同一时刻只有一个线程在淘汰，其他线程的 put 通常不等待，元素个数可能短暂地略超过容量；
+ *           超出容量的 1 / CACHE_OVERFLOW_RATIO 以上时 put 等待淘汰，插入的速度不会持续超过淘汰的速度
+ * 
+ * @tparam K 
+ * @tparam V 
+ * @tparam F 
+ * @tparam E 
+ */
+template <typename K, typename V, typename F = std::hash<K>, typename E = std::equal_to<K>>
+class ConcurrentCache {
+public:
+    typedef ConcurrentHashMap<K, CacheEntry<V>, F, HashBucket<K, CacheEntry<V>>, E> map_type;
+
+    /**
+     * @brief 构造函数，预先扩容到能容纳 capacity 个元素，缓存满载时不会反复扩缩容
+     * 
+     * @param capacity 元素个数的上限，0 表示不限制
+     * @param default_ttl put 不指定过期时间时使用，0 表示永不过期
+     * @param lock_stripe_count 
+     */
+    explicit ConcurrentCache(size_t capacity, std::chrono::nanoseconds default_ttl = std::chrono::nanoseconds(0),
+                             size_t lock_stripe_count = DEFAULT_LOCK_STRIPE_COUNT)
+        : map_(DEFAULT_HASH_BUCKET_SIZE, DEFAULT_MAX_LOAD_FACTOR, lock_stripe_count),
+          capacity_(capacity), default_ttl_(default_ttl) {
+        if (capacity_ != 0) {
+            map_.reserve(capacity_);
+        }
+    }
+    ~ConcurrentCache() {
+        stop_sweeper();
+    }
+    ConcurrentCache(const ConcurrentCache&) = delete;
+    ConcurrentCache& operator=(const ConcurrentCache&) = delete;
+
+public:
+    /**
+     * @brief 插入或者更新，过期时间为构造时指定的 default_ttl
+     * 
+     * @param key 
+     * @param value 
+     */
+    void put(const K& key, V value) {
+        put(key, std::move(value), default_ttl_);
+    }
+
+    /**
+     * @brief 插入或者更新，同时重新设置过期时间
+     * 
+     * @param key 
+     * @param value 
+     * @param ttl 从现在起的存活时间，0 表示永不过期
+     */
+    void put(const K& key, V value, std::chrono::nanoseconds ttl) {
+        int64_t expire_at = ttl.count() > 0 ? now() + ttl.count() : 0;
+        if (map_.insert_or_assign(key, CacheEntry<V>(std::move(value), expire_at))
+            && capacity_ != 0 && map_.size() > capacity_) {
+            evict();
+        }
+    }
+
+    /**
+     * @brief 查找，已经过期的条目视为不存在，并在写锁下确认仍然过期后删除
+     * 
+     * @param key 
+     * @param value 
+     * @return true 
+     * @return false 键不存在或者已经过期
+     */
+    bool find(const K& key, V& value) {
+        int64_t now_ns = now();
+        bool is_expired = false;
+        bool is_found = map_.visit(key, [&](const CacheEntry<V>& entry) {
+            if (entry.expired(now_ns)) {
+                is_expired = true;
+                return;
+            }
+            entry.touch();
+            value = entry.get_value();
+        });
+        if (is_expired) {
+            map_.erase_if(key, [now_ns](const CacheEntry<V>& entry) { return entry.expired(now_ns); });
+        }
+        return is_found && !is_expired;
+    }
+
+    /**
+     * @brief 删除某个键
+     * 
+     * @param key 
+     */
+    void erase(const K& key) {
+        map_.erase(key);
+    }
+
+    /**
+     * @brief 清空缓存
+     */
+    void clear() {
+        map_.clear();
+    }
+
+    /**
+     * @brief 元素个数，包括已经过期还没有被清理的条目
+     * 
+     * @return size_t 
+     */
+    size_t size() const {
+        return map_.size();
+    }
+
+    /**
+     * @brief 容量上限，0 表示不限制
+     * 
+     * @return size_t 
+     */
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    /**
+     * @brief 从上次清理结束的位置起检查 bucket_step 个桶，删除其中过期的条目，到达最后一个桶后从头开始
+     *        多个线程同时调用时只有一个线程执行，其他线程直接返回 0
+     * 
+     * @param bucket_step 
+     * @return size_t 删除的条目个数
+     */
+    size_t sweep(size_t bucket_step = CACHE_SWEEP_BUCKET_STEP) {
+        std::unique_lock<std::mutex> sweep_guard(sweep_mutex_, std::try_to_lock);
+        if (!sweep_guard.owns_lock()) {
+            return 0;
+        }
+        int64_t now_ns = now();
+        size_t begin = next_range(&sweep_cursor_, bucket_step);
+        return map_.erase_buckets_if([now_ns](const K&, CacheEntry<V>& entry) { return entry.expired(now_ns); },
+            begin, begin + bucket_step);
+    }
+
+    /**
+     * @brief 启动后台清理线程，每隔 interval 调用一次 sweep(bucket_step)，已经启动时不做任何事
+     * 
+     * @param interval 
+     * @param bucket_step 
+     */
+    void start_sweeper(std::chrono::milliseconds interval, size_t bucket_step = CACHE_SWEEP_BUCKET_STEP) {
+        std::lock_guard<std::mutex> guard(sweeper_mutex_);
+        if (sweeper_.joinable()) {
+            return;
+        }
+        sweeper_stop_ = false;
+        sweeper_ = std::thread([this, interval, bucket_step]() {
+            std::unique_lock<std::mutex> lock(sweeper_mutex_);
+            for (; !sweeper_cv_.wait_for(lock, interval, [this]() { return sweeper_stop_; });) {
+                lock.unlock();
+                sweep(bucket_step);
+                lock.lock();
+            }
+        });
+    }
+
+    /**
+     * @brief 停止后台清理线程，等待正在进行的清理结束
+     */
+    void stop_sweeper() {
+        std::thread sweeper;
+        {
+            std::lock_guard<std::mutex> guard(sweeper_mutex_);
+            sweeper_stop_ = true;
+            sweeper.swap(sweeper_);
+        }
+        sweeper_cv_.notify_all();
+        if (sweeper.joinable()) {
+            sweeper.join();
+        }
+    }
+
+    /**
+     * @brief 底层的哈希表，用于遍历等其他操作，迭代器读到的值是 CacheEntry<V>
+     * 
+     * @return map_type& 
+     */
+    map_type& map() {
+        return map_;
+    }
+
+private:
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 从 *cursor 开始领取 step 个桶，返回起始下标；超出桶数时从第 0 个桶开始
+    size_t next_range(size_t* cursor, size_t step) const {
+        size_t begin = *cursor;
+        if (begin >= map_.bucket_count()) {
+            begin = 0;
+        }
+        *cursor = begin + step;
+        return begin;
+    }
+
+    // CLOCK 淘汰，最多转两圈：第一圈清除访问标记，第二圈一定能找到可以淘汰的条目
+    void evict() {
+        std::unique_lock<std::mutex> evict_guard(evict_mutex_, std::try_to_lock);
+        if (!evict_guard.owns_lock()) {
+            if (map_.size() <= capacity_ + capacity_ / CACHE_OVERFLOW_RATIO) {
+                return;
+            }
+            evict_guard.lock();
+        }
+        int64_t now_ns = now();
+        size_t target = capacity_ - capacity_ / CACHE_EVICT_BATCH_RATIO;
+        size_t max_steps = 2 * (map_.bucket_count() / CACHE_EVICT_BUCKET_STEP + 1);
+        for (size_t step = 0; step < max_steps; ++step) {
+            size_t size = map_.size();
+            if (size <= target) {
+                break;
+            }
+            size_t over = size - target;
+            size_t begin = next_range(&clock_hand_, CACHE_EVICT_BUCKET_STEP);
+            map_.erase_buckets_if([now_ns, &over](const K&, CacheEntry<V>& entry) {
+                if (entry.expired(now_ns)) {
+                    return true;
+                }
+                if (entry.clear_referenced() || over == 0) {
+                    return false;
+                }
+                --over;
+                return true;
+            }, begin, begin + CACHE_EVICT_BUCKET_STEP);
+        }
+    }
+
+private:
+    map_type map_;
+    const size_t capacity_;
+    const std::chrono::nanoseconds default_ttl_;
+    // 淘汰指针，持有 evict_mutex_ 时访问
+    std::mutex evict_mutex_;
+    size_t clock_hand_ = 0;
+    // 清理指针，持有 sweep_mutex_ 时访问
+    std::mutex sweep_mutex_;
+    size_t sweep_cursor_ = 0;
+    // 后台清理线程
+    std::mutex sweeper_mutex_;
+    std::condition_variable sweeper_cv_;
+    std::thread sweeper_;
+    bool sweeper_stop_ = false;
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
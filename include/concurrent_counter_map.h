@@ -0,0 +1,184 @@
+/**
+ * @file concurrent_counter_map.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include "concurrent_hash_map.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+/**
+ * @brief 原子计数值，所有的读写都是原子操作，可以在不加锁或者只加读锁时并发修改
+ *        拷贝和赋值读写的是某一时刻的值，因此可以作为 ConcurrentHashMap 的 V
+ * 
+ * @tparam V 算术类型
+ */
+template <typename V>
+class AtomicCounter {
+public:
+    static_assert(std::is_arithmetic<V>::value, "counter value must be arithmetic");
+
+    AtomicCounter(V value = V()) : value_(value) {}
+    AtomicCounter(const AtomicCounter& other) : value_(other.load()) {}
+    AtomicCounter& operator=(const AtomicCounter& other) {
+        value_.store(other.load(), std::memory_order_relaxed);
+        return *this;
+    }
+
+public:
+    /**
+     * @brief 读取当前值
+     * 
+     * @return V 
+     */
+    V load() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 原子地增加 delta
+     * 
+     * @param delta 
+     * @return V 增加之前的值
+     */
+    V fetch_add(V delta) {
+        return fetch_add(delta, std::is_integral<V>());
+    }
+
+    AtomicCounter& operator+=(const AtomicCounter& other) {
+        fetch_add(other.load());
+        return *this;
+    }
+
+private:
+    V fetch_add(V delta, std::true_type) {
+        return value_.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    // C++11 的 std::atomic 不支持浮点数的 fetch_add，使用 CAS 循环
+    V fetch_add(V delta, std::false_type) {
+        V old_value = value_.load(std::memory_order_relaxed);
+        for (; !value_.compare_exchange_weak(old_value, old_value + delta, std::memory_order_relaxed);) {}
+        return old_value;
+    }
+
+private:
+    std::atomic<V> value_;
+};
+
+/**
+ * @brief 并发计数器，值以 AtomicCounter 的形式存放在 ConcurrentHashMap 的节点中
+ *        已存在的键的计数和读取不加锁：在 epoch 临界区内找到节点，再对值做原子操作；
+ *        只有插入新键、删除键时才加桶的写锁，热点键的计数不会在同一把写锁上排队
+ *        节点删除后延迟释放，与删除并发的计数可能落在已经删除的节点上，相当于计数发生在删除之前
+ * 
+ * @tparam K 
+ * @tparam V 计数值的类型，算术类型
+ * @tparam F 
+ * @tparam E 
+ */
+template <typename K, typename V, typename F = std::hash<K>, typename E = std::equal_to<K>>
+class ConcurrentCounterMap {
+public:
+    typedef ConcurrentHashMap<K, AtomicCounter<V>, F, HashBucket<K, AtomicCounter<V>>, E> map_type;
+
+    /**
+     * @brief 构造函数，参数同 ConcurrentHashMap
+     * 
+     * @param hash_bucket_size 
+     * @param max_load_factor 
+     * @param lock_stripe_count 
+     */
+    explicit ConcurrentCounterMap(size_t hash_bucket_size = DEFAULT_HASH_BUCKET_SIZE,
+                                  float max_load_factor = DEFAULT_MAX_LOAD_FACTOR,
+                                  size_t lock_stripe_count = DEFAULT_LOCK_STRIPE_COUNT)
+        : map_(hash_bucket_size, max_load_factor, lock_stripe_count) {}
+    ConcurrentCounterMap(const ConcurrentCounterMap&) = delete;
+    ConcurrentCounterMap& operator=(const ConcurrentCounterMap&) = delete;
+
+public:
+    /**
+     * @brief 给 key 的计数增加 delta，键不存在时以 delta 为初始值插入
+     * 
+     * @param key 
+     * @param delta 
+     * @return V 增加之后的值
+     */
+    V insert_and_inc(const K& key, V delta = 1) {
+        V result = delta;
+        auto add = [delta, &result](AtomicCounter<V>& counter) {
+            result = counter.fetch_add(delta) + delta;
+        };
+        if (map_.visit_concurrent(key, add)) {
+            return result;
+        }
+        map_.upsert(key, delta, add);
+        return result;
+    }
+
+    /**
+     * @brief 读取 key 的计数，不加锁
+     * 
+     * @param key 
+     * @param value 
+     * @return true 
+     * @return false key 不存在
+     */
+    bool find(const K& key, V& value) const {
+        return map_.visit_concurrent(key, [&value](const AtomicCounter<V>& counter) {
+            value = counter.load();
+        });
+    }
+
+    /**
+     * @brief 删除某个键
+     * 
+     * @param key 
+     */
+    void erase(const K& key) {
+        map_.erase(key);
+    }
+
+    /**
+     * @brief 清空所有的计数
+     */
+    void clear() {
+        map_.clear();
+    }
+
+    /**
+     * @brief 键的个数
+     * 
+     * @return size_t 
+     */
+    size_t size() const {
+        return map_.size();
+    }
+
+    /**
+     * @brief 底层的哈希表，用于遍历等其他操作，迭代器读到的值是 AtomicCounter<V>
+     * 
+     * @return map_type& 
+     */
+    map_type& map() {
+        return map_;
+    }
+
+private:
+    map_type map_;
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
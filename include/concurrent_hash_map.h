@@ -11,40 +11,509 @@
 
 #pragma once
 
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
 #include <functional>
+#include <type_traits>
 #include <atomic>
 #include <thread>
 #include <utility>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <exception>
+#include <chrono>
+#include "cache_aligned.h"
+#include "epoch_reclaimer.h"
+#include "node_pool.h"
+#include "numa_alloc.h"
+#include "map_file.h"
+#include "change_log.h"
 
 namespace noahyzhang {
 namespace concurrent {
 
 // 默认的哈希桶的数量，注意取一个质数可以使哈希表有更好的性能
+// 取 2 的幂时以移位和掩码代替除法，哈希值会先经过一次混合，见 ConcurrentHashMap 的构造函数
 #define DEFAULT_HASH_BUCKET_SIZE (1031)
+// 默认的最大负载因子，平均每个桶中的节点数超过此值时开始扩容
+#define DEFAULT_MAX_LOAD_FACTOR (1.0f)
+// 单次扩缩容最多迁移的桶数，迁移被分摊到多次写操作中，不会出现全表停顿
+#define MIGRATE_BUCKET_STEP (256)
+// 计数分片每变化多少次检查一次负载因子
+#define RESIZE_CHECK_INTERVAL (32)
+// 元素个数计数器的分片数
+#define SIZE_COUNTER_STRIPES (16)
+// 桶段的最大个数，第 0 段为初始桶数，之后每段的桶数等于前面所有段之和
+#define MAX_BUCKET_SEGMENT_COUNT (64)
+// 不加锁的乐观读最多尝试的次数，超过后退化为加读锁查找，避免写操作频繁时读者一直重试
+#define OPTIMISTIC_READ_RETRY (4)
+// 默认的锁分片数，必须是 2 的幂，与桶的数量无关，桶按下标映射到分片
+#define DEFAULT_LOCK_STRIPE_COUNT (256)
+// 锁分片的对齐，取两个缓存行，避免相邻缓存行预取带来的伪共享
+#define LOCK_STRIPE_ALIGN (2 * CACHE_LINE_SIZE)
+// 批量操作每次处理的键数，哈希、预取、按锁分片分组都在这个大小的栈上数组中进行
+#define BATCH_CHUNK_SIZE (64)
+// 并行遍历时每个线程一次领取的桶数
+#define PARALLEL_SCAN_CHUNK_SIZE (1024)
+// stats() 中链长直方图的项数，最后一项统计链长不小于此值减一的桶
+#define STATS_CHAIN_HISTOGRAM_SIZE (16)
+// 定义 CONCURRENT_HASH_MAP_STATS 后统计操作次数、锁的争用与等待时间，见 MapStats；
+// 未定义时不统计，相关的计数器与代码都不会编译进来
 
+class PthreadRWLock;
 template <typename K, typename V> class HashNode;
-template <typename K, typename V> class HashBucket;
-template <typename K, typename V> class ConstIterator;
+template <typename K, typename V, typename R = EpochReclaimer, typename A = NodePoolAllocator<HashNode<K, V>>>
+class HashBucket;
+template <typename K, typename V, typename F = std::hash<K>, typename B = HashBucket<K, V>,
+          typename E = std::equal_to<K>, typename L = PthreadRWLock>
+class ConcurrentHashMap;
+template <typename K, typename V, typename F, typename B, typename E, typename L> class ConstIterator;
+template <typename K, typename V, typename F, typename B, typename E, typename L> class SnapshotIterator;
+
+/**
+ * @brief 哈希值的混合（MurmurHash3 的 fmix64），每一位输入都会影响所有的输出位
+ *        桶数是 2 的幂时只用到哈希值的部分位，混合后 std::hash 对整数的恒等映射也能均匀分布
+ * 
+ * @param hash_val 
+ * @return size_t 
+ */
+inline size_t mix_hash(size_t hash_val) {
+    uint64_t h = hash_val;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
+/**
+ * @brief 判断函数对象是否声明了 is_transparent
+ * 
+ * @tparam T 
+ */
+template <typename T, typename = void>
+struct IsTransparent : std::false_type {};
+template <typename T>
+struct IsTransparent<T, typename std::conditional<true, void, typename T::is_transparent>::type>
+    : std::true_type {};
+
+/**
+ * @brief pthread 读写锁，ConcurrentHashMap 默认的锁策略
+ *        锁策略需要提供 rdlock、try_rdlock、wrlock、try_wrlock 和 unlock，unlock 同时用于释放读锁和写锁；
+ *        spin_lock.h 中的 RWSpinLock、WriterPreferringRWSpinLock 是另外两种锁策略
+ */
+class PthreadRWLock {
+public:
+    PthreadRWLock() {
+        pthread_rwlock_init(&rw_lock_, nullptr);
+    }
+    ~PthreadRWLock() {
+        pthread_rwlock_destroy(&rw_lock_);
+    }
+    PthreadRWLock(const PthreadRWLock&) = delete;
+    PthreadRWLock& operator=(const PthreadRWLock&) = delete;
+
+public:
+    void rdlock() {
+        pthread_rwlock_rdlock(&rw_lock_);
+    }
+
+    bool try_rdlock() {
+        return pthread_rwlock_tryrdlock(&rw_lock_) == 0;
+    }
+
+    void wrlock() {
+        pthread_rwlock_wrlock(&rw_lock_);
+    }
+
+    bool try_wrlock() {
+        return pthread_rwlock_trywrlock(&rw_lock_) == 0;
+    }
+
+    void unlock() {
+        pthread_rwlock_unlock(&rw_lock_);
+    }
+
+private:
+    pthread_rwlock_t rw_lock_;
+};
+
+/**
+ * @brief 锁分片，独占 LOCK_STRIPE_ALIGN 字节，一个分片保护多个桶
+ * 
+ * @tparam L 锁策略，见 PthreadRWLock
+ */
+template <typename L>
+class alignas(LOCK_STRIPE_ALIGN) LockStripe {
+public:
+    LockStripe() = default;
+    LockStripe(const LockStripe&) = delete;
+    LockStripe& operator=(const LockStripe&) = delete;
+
+public:
+    // 加读锁
+    void rdlock() {
+#ifdef CONCURRENT_HASH_MAP_STATS
+        if (!rw_lock_.try_rdlock()) {
+            auto start_tm = std::chrono::steady_clock::now();
+            rw_lock_.rdlock();
+            on_contended(start_tm);
+        }
+        read_count_.fetch_add(1, std::memory_order_relaxed);
+#else
+        rw_lock_.rdlock();
+#endif
+    }
+
+    // 加写锁
+    void wrlock() {
+#ifdef CONCURRENT_HASH_MAP_STATS
+        if (!rw_lock_.try_wrlock()) {
+            auto start_tm = std::chrono::steady_clock::now();
+            rw_lock_.wrlock();
+            on_contended(start_tm);
+        }
+        write_count_.fetch_add(1, std::memory_order_relaxed);
+#else
+        rw_lock_.wrlock();
+#endif
+    }
+
+    // 解锁
+    void unlock() {
+        rw_lock_.unlock();
+    }
+
+#ifdef CONCURRENT_HASH_MAP_STATS
+    /**
+     * @brief 锁分片的统计
+     */
+    struct Stats {
+        // 加读锁、写锁的次数
+        uint64_t read_count;
+        uint64_t write_count;
+        // 尝试加锁失败、需要等待的次数，以及等待的总时间
+        uint64_t contended_count;
+        uint64_t wait_ns;
+    };
+
+    Stats stats() const {
+        return Stats{read_count_.load(std::memory_order_relaxed), write_count_.load(std::memory_order_relaxed),
+                     contended_count_.load(std::memory_order_relaxed), wait_ns_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    void on_contended(std::chrono::steady_clock::time_point start_tm) {
+        contended_count_.fetch_add(1, std::memory_order_relaxed);
+        wait_ns_.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start_tm).count()), std::memory_order_relaxed);
+    }
+#endif
+
+private:
+    // 读写锁
+    L rw_lock_;
+#ifdef CONCURRENT_HASH_MAP_STATS
+    // 统计与锁在同一个缓存行上，加锁时这个缓存行本来就要写，计数不会带来额外的缓存行争用
+    std::atomic<uint64_t> read_count_{0};
+    std::atomic<uint64_t> write_count_{0};
+    std::atomic<uint64_t> contended_count_{0};
+    std::atomic<uint64_t> wait_ns_{0};
+#endif
+};
+
+/**
+ * @brief find_ptr 返回的值句柄，持有值所在锁分片的读锁，析构或者 reset 时释放
+ *        句柄存活期间可以不拷贝地读取值，同一分片的写操作会被阻塞，
+ *        因此持有句柄的线程不能再修改此哈希表，句柄也不宜长时间持有
+ * 
+ * @tparam V 
+ * @tparam L 锁策略
+ */
+template <typename V, typename L = PthreadRWLock>
+class ValueHandle {
+public:
+    ValueHandle() = default;
+    ValueHandle(LockStripe<L>* stripe, const V* value) : stripe_(stripe), value_(value) {}
+    ~ValueHandle() {
+        reset();
+    }
+    ValueHandle(const ValueHandle&) = delete;
+    ValueHandle& operator=(const ValueHandle&) = delete;
+    ValueHandle(ValueHandle&& other) : stripe_(other.stripe_), value_(other.value_) {
+        other.stripe_ = nullptr;
+        other.value_ = nullptr;
+    }
+    ValueHandle& operator=(ValueHandle&& other) {
+        if (this != &other) {
+            reset();
+            stripe_ = other.stripe_;
+            value_ = other.value_;
+            other.stripe_ = nullptr;
+            other.value_ = nullptr;
+        }
+        return *this;
+    }
+
+public:
+    /**
+     * @brief 是否找到了值
+     * 
+     * @return true 
+     * @return false 
+     */
+    explicit operator bool() const {
+        return value_ != nullptr;
+    }
+
+    const V& operator*() const {
+        return *value_;
+    }
+
+    const V* operator->() const {
+        return value_;
+    }
+
+    const V* get() const {
+        return value_;
+    }
+
+    /**
+     * @brief 释放读锁，之后句柄为空
+     */
+    void reset() {
+        if (stripe_ != nullptr) {
+            stripe_->unlock();
+        }
+        stripe_ = nullptr;
+        value_ = nullptr;
+    }
+
+private:
+    // 持有读锁的分片
+    LockStripe<L>* stripe_ = nullptr;
+    // 值的地址
+    const V* value_ = nullptr;
+};
+
+/**
+ * @brief 分片计数器
+ *        每个线程固定落在某个分片上，避免所有写操作争抢同一个缓存行
+ *        读取总数时需要累加所有分片，因此只适合写多读少的场景
+ */
+class StripedCounter {
+public:
+    StripedCounter() : stripes_(cache_aligned_new<Stripe>(SIZE_COUNTER_STRIPES)) {}
+    ~StripedCounter() {
+        cache_aligned_delete(stripes_, SIZE_COUNTER_STRIPES);
+    }
+    StripedCounter(const StripedCounter&) = delete;
+    StripedCounter& operator=(const StripedCounter&) = delete;
+
+public:
+    /**
+     * @brief 给当前线程所在的分片加上 delta
+     * 
+     * @param delta 
+     * @return int64_t 返回此分片变化后的值
+     */
+    int64_t add(int64_t delta) {
+        return stripes_[thread_stripe()].value.fetch_add(delta, std::memory_order_relaxed) + delta;
+    }
+
+    /**
+     * @brief 累加所有分片，并发修改时是一个近似值
+     * 
+     * @return size_t 
+     */
+    size_t sum() const {
+        int64_t total = 0;
+        for (size_t i = 0; i < SIZE_COUNTER_STRIPES; ++i) {
+            total += stripes_[i].value.load(std::memory_order_relaxed);
+        }
+        return total < 0 ? 0 : static_cast<size_t>(total);
+    }
+
+public:
+    // 当前线程所在的分片
+    static size_t thread_stripe() {
+        static std::atomic<size_t> next_stripe(0);
+        static thread_local size_t stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % SIZE_COUNTER_STRIPES;
+        return stripe;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Stripe {
+        std::atomic<int64_t> value{0};
+    };
+    // 分片数组按缓存行对齐分配，ConcurrentHashMap 本身可以被普通的 new 分配
+    Stripe* stripes_;
+};
+
+/**
+ * @brief 哈希表的统计项
+ */
+enum MapStatsItem {
+    // 查找类操作：find、contains、visit、visit_mut、visit_concurrent、find_ptr，批量查找按键数计
+    kStatsFind,
+    // 插入或更新类操作，批量插入按键数计
+    kStatsUpsert,
+    // 按键删除的操作，批量删除按键数计
+    kStatsErase,
+    // 乐观读校验失败后的重试
+    kStatsOptimisticRetry,
+    // 新建的元素（HashBucket 中每个元素是一次节点分配）
+    kStatsNodeAlloc,
+    // 删除的元素（HashBucket 中每个元素是一次节点释放）
+    kStatsNodeFree,
+    kStatsItemCount,
+};
+
+#ifdef CONCURRENT_HASH_MAP_STATS
+/**
+ * @brief 统计计数器，与 StripedCounter 一样按线程分片，每个线程只写自己所在分片的缓存行
+ */
+class StatsCounters {
+public:
+    StatsCounters() : stripes_(cache_aligned_new<Stripe>(SIZE_COUNTER_STRIPES)) {}
+    ~StatsCounters() {
+        cache_aligned_delete(stripes_, SIZE_COUNTER_STRIPES);
+    }
+    StatsCounters(const StatsCounters&) = delete;
+    StatsCounters& operator=(const StatsCounters&) = delete;
+
+public:
+    void add(MapStatsItem item, uint64_t delta) {
+        stripes_[StripedCounter::thread_stripe()].values[item].fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    uint64_t sum(MapStatsItem item) const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < SIZE_COUNTER_STRIPES; ++i) {
+            total += stripes_[i].values[item].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Stripe {
+        std::atomic<uint64_t> values[kStatsItemCount] = {};
+    };
+    Stripe* stripes_;
+};
+#endif
+
+/**
+ * @brief stats() 返回的统计快照，各项分别读取，并发修改时彼此之间不保证一致
+ *        元素个数、桶数、链长直方图总是可用；操作次数与锁的统计只在定义了 CONCURRENT_HASH_MAP_STATS 时记录，否则为 0
+ */
+struct MapStats {
+    size_t size = 0;
+    size_t bucket_count = 0;
+    float load_factor = 0;
+    // chain_length_histogram[i] 为恰有 i 个元素的桶数，最后一项为不少于 STATS_CHAIN_HISTOGRAM_SIZE - 1 个元素的桶数
+    std::vector<size_t> chain_length_histogram;
+    size_t max_chain_length = 0;
+    // 按 MapStatsItem 索引的操作次数
+    uint64_t counts[kStatsItemCount] = {};
+    // 所有锁分片合计的加锁次数、争用次数与等待时间
+    uint64_t lock_read_count = 0;
+    uint64_t lock_write_count = 0;
+    uint64_t lock_contended_count = 0;
+    uint64_t lock_wait_ns = 0;
+    // 每个锁分片的加锁次数（读锁与写锁之和）与争用次数，用于发现热点分片
+    std::vector<uint64_t> stripe_lock_counts;
+    std::vector<uint64_t> stripe_contended_counts;
+};
 
 /**
  * @brief 线程安全的哈希表
  *        以哈希桶作为实现，每个桶是一个单链表
  *        我们加锁的临界区为桶，所以多个线程可以并发写入哈希表中的不同桶
  * 
+ *        桶的数量随负载因子在线增长（线性哈希）：
+ *        1. 桶数组按段分配，第 0 段为初始桶数 B，第 k 段有 B * 2^(k-1) 个桶，已分配的段不会移动
+ *        2. 扩容时每次只分裂一个桶：把 split 指向的桶中一半的节点迁移到新桶，只锁这两个桶
+ *        3. 缩容是分裂的逆过程，把最后一个桶合并回它的来源桶
+ *        迁移被分摊到写操作中，每次最多迁移 MIGRATE_BUCKET_STEP 个桶，读写操作在迁移期间照常进行
+ * 
+ *        锁与桶分离：桶中不含锁，只有头指针、分裂层级和版本号，
+ *        读写锁放在数量固定、各自独占 LOCK_STRIPE_ALIGN 字节的锁分片中，下标为 i 的桶由第 i % 分片数 个分片保护，
+ *        写一个桶不会让相邻桶的读者所在的缓存行失效
+ * 
  * @tparam K 哈希表的键
  * @tparam V 哈希表的值
  * @tparam F 哈希函数，默认使用 stl 提供的哈希函数
+ * @tparam B 桶的存储引擎，默认为单链表实现的 HashBucket，
+ *           也可以选择 flat_hash_bucket.h 中以连续数组存储的 FlatHashBucket，
+ *           或 inline_hash_bucket.h 中把小键值直接内嵌在桶中的 InlineHashBucket
+ * @tparam E 键的相等比较，默认使用 std::equal_to<K>
+ *           F 和 E 都声明了 is_transparent 时，find、erase、contains 可以直接使用与 K 可比较的其他类型，
+ *           例如以 const char* 查找 std::string 的键，不需要构造临时的键
+ * @tparam L 锁分片使用的读写锁，默认为 PthreadRWLock，
+ *           也可以选择 spin_lock.h 中 4 字节的 RWSpinLock，或者写者不会被读者饿死的 WriterPreferringRWSpinLock；
+ *           使用写者优先的锁时，持有 ValueHandle 或者在 visit 等回调中也不能再读取此哈希表，嵌套的读锁可能与等待中的写者死锁
  */
-template <typename K, typename V, typename F = std::hash<K>>
+template <typename K, typename V, typename F, typename B, typename E, typename L>
 class ConcurrentHashMap {
+    // F 和 E 都是透明的时候才启用异构查找的重载
+    template <typename Q>
+    using EnableIfTransparent =
+        typename std::enable_if<IsTransparent<F>::value && IsTransparent<E>::value, Q>::type;
+
 public:
-    explicit ConcurrentHashMap(size_t hash_bucket_size = DEFAULT_HASH_BUCKET_SIZE)
-        : hash_bucket_size_(hash_bucket_size) {
-        hash_table_ = new HashBucket<K, V>[hash_bucket_size];
+    /**
+     * @brief 构造函数
+     *        初始桶数是 2 的幂时，定位桶用移位和掩码代替除法和取模，哈希值先经过 mix_hash 混合；
+     *        否则直接对哈希值取模，适合取质数
+     * 
+     * @param hash_bucket_size 初始桶数
+     * @param max_load_factor 最大负载因子
+     * @param lock_stripe_count 锁分片数，向上取整到 2 的幂
+     * @param numa_node 桶和锁分片放在哪个 NUMA 节点上，-1 表示不指定，由第一次访问的线程决定；
+     *        节点的位置由 B 的分配器决定，见 NumaNodeAllocator
+     */
+    explicit ConcurrentHashMap(size_t hash_bucket_size = DEFAULT_HASH_BUCKET_SIZE,
+                               float max_load_factor = B::default_max_load_factor(),
+                               size_t lock_stripe_count = DEFAULT_LOCK_STRIPE_COUNT,
+                               int numa_node = -1)
+        : base_bucket_size_(hash_bucket_size == 0 ? 1 : hash_bucket_size),
+          numa_node_(numa_node), max_load_factor_(max_load_factor) {
+        base_pow2_ = (base_bucket_size_ & (base_bucket_size_ - 1)) == 0;
+        base_shift_ = static_cast<size_t>(__builtin_ctzll(base_bucket_size_));
+        stripe_count_ = 1;
+        for (; stripe_count_ < lock_stripe_count;) {
+            stripe_count_ <<= 1;
+        }
+        stripes_ = numa_node_ < 0 ? cache_aligned_new<LockStripe<L>>(stripe_count_)
+            : numa_new<LockStripe<L>>(stripe_count_, numa_node_);
+        for (auto& segment : segments_) {
+            segment.store(nullptr, std::memory_order_relaxed);
+        }
+        B* first_segment = new_segment(base_bucket_size_);
+        for (size_t i = 0; i < base_bucket_size_; ++i) {
+            new (first_segment + i) B();
+            first_segment[i].live_ = true;
+        }
+        constructed_bucket_size_ = base_bucket_size_;
+        segments_[0].store(first_segment, std::memory_order_release);
+        layout_.store(pack_layout(0, 0), std::memory_order_release);
     }
     ~ConcurrentHashMap() {
-        delete[] hash_table_;
+        for (size_t i = 0; i < MAX_BUCKET_SEGMENT_COUNT; ++i) {
+            delete_segment(segments_[i].load(std::memory_order_relaxed), i == 0 ? 0 : base_bucket_size_ << (i - 1),
+                i == 0 ? base_bucket_size_ : base_bucket_size_ << (i - 1));
+        }
+        if (numa_node_ < 0) {
+            cache_aligned_delete(stripes_, stripe_count_);
+        } else {
+            numa_delete(stripes_, stripe_count_);
+        }
     }
     ConcurrentHashMap(const ConcurrentHashMap&) = delete;
     ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
@@ -61,233 +530,2325 @@ public:
      * @return false 
      */
     bool find(const K& key, V& value) const {
-        size_t hash_val = hash_fn_(key) % hash_bucket_size_;
-        return hash_table_[hash_val].find(key, value);
+        record(kStatsFind, 1);
+        size_t hash_val = hash_of(key);
+        return find(hash_val, key, value, std::integral_constant<bool, B::kOptimisticRead>());
+    }
+
+    /**
+     * @brief 异构查找，F 和 E 都声明了 is_transparent 时可用
+     * 
+     * @tparam Q 与 K 可比较的类型，F(Q) 需要与相等的 K 得到同样的哈希值
+     * @param key 
+     * @param value 
+     * @return true 
+     * @return false 
+     */
+    template <typename Q, typename = EnableIfTransparent<Q>>
+    bool find(const Q& key, V& value) const {
+        record(kStatsFind, 1);
+        size_t hash_val = hash_of(key);
+        return find(hash_val, key, value, std::integral_constant<bool, B::kOptimisticRead>());
+    }
+
+    /**
+     * @brief 在读锁保护下对 key 对应的值调用 fn(const V&)，不拷贝值
+     *        fn 中不能修改此哈希表
+     * 
+     * @param key 
+     * @param fn 
+     * @return true 找到了 key 并调用了 fn
+     * @return false 
+     */
+    template <typename Fn>
+    bool visit(const K& key, Fn&& fn) const {
+        record(kStatsFind, 1);
+        size_t hash_val = hash_of(key);
+        LockStripe<L>* stripe = nullptr;
+        B* bucket = lock_bucket(hash_val, false, &stripe);
+        typename B::node_type* node = bucket->find_node(hash_val, key, key_eq_);
+        if (node != nullptr) {
+            const V& value = node->get_value();
+            fn(value);
+        }
+        unlock_bucket(bucket, stripe, false);
+        return node != nullptr;
+    }
+
+    /**
+     * @brief 在写锁保护下对 key 对应的值调用 fn(V&)，原地修改值
+     *        fn 中不能修改此哈希表
+     * 
+     * @param key 
+     * @param fn 
+     * @return true 找到了 key 并调用了 fn
+     * @return false 
+     */
+    template <typename Fn>
+    bool visit_mut(const K& key, Fn&& fn) {
+        record(kStatsFind, 1);
+        size_t hash_val = hash_of(key);
+        LockStripe<L>* stripe = nullptr;
+        B* bucket = lock_bucket(hash_val, true, &stripe);
+        typename B::node_type* node = bucket->find_node(hash_val, key, key_eq_);
+        if (node != nullptr) {
+            fn(node->get_value());
+            ChangeFeed<K, V>* feed = change_feed_.load(std::memory_order_relaxed);
+            if (feed != nullptr) {
+                feed->on_assign(node->get_key(), node->get_value());
+            }
+        }
+        unlock_bucket(bucket, stripe, true);
+        return node != nullptr;
+    }
+
+    /**
+     * @brief 对 key 对应的值调用 fn(V&)，fn 与其他读写操作并发执行，只能以原子操作访问值
+     *        节点延迟回收时不加锁，沿链表查找并校验版本号，多次校验失败后退化为加读锁
+     *        值的类型需要保证所有的读写都是原子的，例如 ConcurrentCounterMap 使用的 AtomicCounter
+     * 
+     * @param key 
+     * @param fn 
+     * @return true 找到了 key 并调用了 fn
+     * @return false 
+     */
+    template <typename Fn>
+    bool visit_concurrent(const K& key, Fn&& fn) {
+        record(kStatsFind, 1);
+        size_t hash_val = hash_of(key);
+        return visit_concurrent(hash_val, key, fn,
+            std::integral_constant<bool, B::reclaimer_type::kDeferred>());
+    }
+
+    /**
+     * @brief 只读版本的 visit_concurrent，以 const V& 调用 fn
+     * 
+     * @param key 
+     * @param fn 
+     * @return true 找到了 key 并调用了 fn
+     * @return false 
+     */
+    template <typename Fn>
+    bool visit_concurrent(const K& key, Fn&& fn) const {
+        record(kStatsFind, 1);
+        size_t hash_val = hash_of(key);
+        auto const_fn = [&fn](const V& value) { fn(value); };
+        return visit_concurrent(hash_val, key, const_fn,
+            std::integral_constant<bool, B::reclaimer_type::kDeferred>());
     }
 
     /**
-     * @brief 插入一对键值
+     * @brief 查找 key，返回持有读锁的值句柄，没有找到时句柄为空
+     *        句柄存活期间不能在同一线程修改此哈希表
+     * 
+     * @param key 
+     * @return ValueHandle<V, L> 
+     */
+    ValueHandle<V, L> find_ptr(const K& key) const {
+        record(kStatsFind, 1);
+        size_t hash_val = hash_of(key);
+        LockStripe<L>* stripe = nullptr;
+        B* bucket = lock_bucket(hash_val, false, &stripe);
+        typename B::node_type* node = bucket->find_node(hash_val, key, key_eq_);
+        if (node == nullptr) {
+            unlock_bucket(bucket, stripe, false);
+            return ValueHandle<V, L>();
+        }
+        return ValueHandle<V, L>(stripe, &node->get_value());
+    }
+
+    /**
+     * @brief 判断哈希表中是否有 key
+     * 
+     * @param key 
+     * @return true 
+     * @return false 
+     */
+    bool contains(const K& key) const {
+        return contains_key(key);
+    }
+
+    /**
+     * @brief 异构版本的 contains，F 和 E 都声明了 is_transparent 时可用
+     * 
+     * @tparam Q 
+     * @param key 
+     * @return true 
+     * @return false 
+     */
+    template <typename Q, typename = EnableIfTransparent<Q>>
+    bool contains(const Q& key) const {
+        return contains_key(key);
+    }
+
+    /**
+     * @brief 插入一对键值，如果键存在，则覆盖值
      * 
      * @param key 
      * @param value 
      */
     void insert(const K& key, const V& value) {
-        size_t hash_val = hash_fn_(key) % hash_bucket_size_;
-        hash_table_[hash_val].insert(key, value);
+        insert_or_assign(key, value);
     }
 
     /**
-     * @brief 插入一对键值，如果键存在，则增加值
+     * @brief 插入一对键值，键和值都移动进节点
      * 
      * @param key 
      * @param value 
      */
-    void insert_and_inc(const K& key, const V& value) {
-        size_t hash_val = hash_fn_(key) % hash_bucket_size_;
-        hash_table_[hash_val].insert_and_inc(key, value);
+    void insert(K&& key, V&& value) {
+        insert_or_assign(std::move(key), std::move(value));
+    }
+
+    /**
+     * @brief 插入一对键值，如果键存在，则覆盖值
+     *        键存在时 obj 赋值给已有的值，否则用 obj 构造新节点的值，key 只在新建节点时拷贝
+     * 
+     * @tparam M 
+     * @param key 
+     * @param obj 
+     * @return true 新插入了键
+     * @return false 键已存在，覆盖了值
+     */
+    template <typename M>
+    bool insert_or_assign(const K& key, M&& obj) {
+        return upsert_key(key, [&obj](V& value) { value = std::forward<M>(obj); }, std::forward<M>(obj));
+    }
+
+    /**
+     * @brief 同上，key 只在新建节点时移动
+     * 
+     * @tparam M 
+     * @param key 
+     * @param obj 
+     * @return true 
+     * @return false 
+     */
+    template <typename M>
+    bool insert_or_assign(K&& key, M&& obj) {
+        return upsert_key(std::move(key), [&obj](V& value) { value = std::forward<M>(obj); },
+            std::forward<M>(obj));
+    }
+
+    /**
+     * @brief 键不存在时，用 args 在新节点中原地构造值，键存在时什么都不做，args 不会被移动
+     * 
+     * @tparam Args 
+     * @param key 
+     * @param args 
+     * @return true 新插入了键
+     * @return false 键已存在
+     */
+    template <typename... Args>
+    bool try_emplace(const K& key, Args&&... args) {
+        return upsert_key(key, [](V&) {}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief 同上，key 只在新建节点时移动
+     * 
+     * @tparam Args 
+     * @param key 
+     * @param args 
+     * @return true 
+     * @return false 
+     */
+    template <typename... Args>
+    bool try_emplace(K&& key, Args&&... args) {
+        return upsert_key(std::move(key), [](V&) {}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief 用 args 构造 std::pair<K, V>，键不存在时把键和值移动进新节点，键存在时什么都不做
+     *        支持 std::piecewise_construct 分段构造，必须先构造出键才能计算哈希值，
+     *        所以键已存在时仍然构造了一次键值对，已知键时优先使用 try_emplace
+     * 
+     * @tparam Args 
+     * @param args 
+     * @return true 新插入了键
+     * @return false 键已存在
+     */
+    template <typename... Args>
+    bool emplace(Args&&... args) {
+        std::pair<K, V> kv(std::forward<Args>(args)...);
+        return upsert_key(std::move(kv.first), [](V&) {}, std::move(kv.second));
+    }
+
+    /**
+     * @brief 键不存在时，用 init 构造新节点的值，键存在时在桶锁内对已有的值调用 updater(V&)，原地修改
+     *        updater 持有写锁执行，不应该再访问本 map
+     * 
+     * @tparam Init 
+     * @tparam Updater 
+     * @param key 
+     * @param init 
+     * @param updater 
+     * @return true 新插入了键
+     * @return false 键已存在，调用了 updater
+     */
+    template <typename Init, typename Updater>
+    bool upsert(const K& key, Init&& init, Updater&& updater) {
+        return upsert_key(key, updater, std::forward<Init>(init));
+    }
+
+    /**
+     * @brief 插入一对键值，如果键存在，则增加值，即 upsert 以 value 初始化、以 += value 修改
+     * 
+     * @param key 
+     * @param value 
+     */
+    void insert_and_inc(const K& key, const V& value) {
+        upsert(key, value, [&value](V& old_value) { old_value += value; });
+    }
+
+    /**
+     * @brief 删除某个键
+     * 
+     * @param key 
+     */
+    void erase(const K& key) {
+        erase_key(key);
+    }
+
+    /**
+     * @brief 异构版本的 erase，F 和 E 都声明了 is_transparent 时可用
+     * 
+     * @tparam Q 
+     * @param key 
+     */
+    template <typename Q, typename = EnableIfTransparent<Q>>
+    void erase(const Q& key) {
+        erase_key(key);
+    }
+
+    /**
+     * @brief 在写锁下检查某个键的值，pred(V&) 返回 true 时删除此键，用于按值的条件删除
+     * 
+     * @param key 
+     * @param pred 
+     * @return true 删除了此键
+     * @return false 键不存在或者 pred 返回 false
+     */
+    template <typename Pred>
+    bool erase_if(const K& key, Pred&& pred) {
+        record(kStatsErase, 1);
+        size_t hash_val = hash_of(key);
+        LockStripe<L>* stripe = nullptr;
+        B* bucket = lock_bucket(hash_val, true, &stripe);
+        bool is_erased;
+        try {
+            typename B::node_type* node = bucket->find_node(hash_val, key, key_eq_);
+            is_erased = node != nullptr && pred(node->get_value());
+            if (is_erased) {
+                notify_erase(bucket, hash_val, key);
+                is_erased = bucket->erase(hash_val, key, key_eq_);
+            }
+        } catch (...) {
+            unlock_bucket(bucket, stripe, true);
+            throw;
+        }
+        unlock_bucket(bucket, stripe, true);
+        if (is_erased) {
+            on_size_changed(-1);
+        }
+        return is_erased;
+    }
+
+    /**
+     * @brief 删除 [bucket_begin, bucket_end) 的桶中满足 pred(const K&, V&) 的元素，用于分多次增量地清理整个哈希表
+     *        每次给一个桶加写锁，期间暂停扩缩容；bucket_end 超过 bucket_count() 时只处理到最后一个桶
+     *        两次调用之间桶数可能发生变化，按下标分段清理时个别元素可能被跳过或者检查两次
+     * 
+     * @param pred 
+     * @param bucket_begin 
+     * @param bucket_end 
+     * @return size_t 删除的元素个数
+     */
+    template <typename Pred>
+    size_t erase_buckets_if(Pred&& pred, size_t bucket_begin = 0, size_t bucket_end = SIZE_MAX) {
+        size_t removed = 0;
+        {
+            ScanGuard scan_guard(this);
+            size_t bucket_size = bucket_count();
+            if (bucket_end > bucket_size) {
+                bucket_end = bucket_size;
+            }
+            if (bucket_begin < bucket_end) {
+                removed = erase_if_in_buckets(bucket_begin, bucket_end, pred);
+            }
+        }
+        on_size_changed(-static_cast<int64_t>(removed));
+        return removed;
+    }
+
+    /**
+     * @brief 批量查找 [first, last) 中的键，第 i 个键的结果写入 values[i] 和 found[i]
+     *        先计算所有键的哈希值并预取桶，再按锁分片分组，每组只加一次锁，内存访问的延迟在整批中重叠
+     *        支持乐观读的存储引擎不加锁，只做哈希和预取的流水
+     *        不分配内存，values 和 found 由调用者提供，需要支持下标访问，未找到的键对应的 values[i] 不修改
+     * 
+     * @tparam KeyIt 随机访问迭代器或者指针
+     * @tparam ValueIt 随机访问迭代器或者指针
+     * @tparam FoundIt 随机访问迭代器或者指针，元素可以赋值为 bool
+     * @param first 
+     * @param last 
+     * @param values 
+     * @param found 
+     * @return size_t 找到的键的个数
+     */
+    template <typename KeyIt, typename ValueIt, typename FoundIt>
+    size_t find_many(KeyIt first, KeyIt last, ValueIt values, FoundIt found) const {
+        record(kStatsFind, static_cast<uint64_t>(last - first));
+        return find_many(first, static_cast<size_t>(last - first), values, found,
+            std::integral_constant<bool, B::kOptimisticRead>());
+    }
+
+    /**
+     * @brief 批量插入，第 i 个键对应的值为 values[i]，分组方式同 find_many
+     * 
+     * @tparam KeyIt 
+     * @tparam ValueIt 
+     * @param first 
+     * @param last 
+     * @param values 
+     * @return size_t 新插入的键的个数
+     */
+    template <typename KeyIt, typename ValueIt>
+    size_t insert_many(KeyIt first, KeyIt last, ValueIt values) {
+        size_t inserted = 0;
+        size_t count = static_cast<size_t>(last - first);
+        record(kStatsUpsert, count);
+        try {
+            batch_apply(first, count, true, [&](size_t pos, size_t hash_val, B* bucket) {
+                inserted += bucket->upsert(hash_val, first[pos], key_eq_, [&](V& value) { value = values[pos]; },
+                    values[pos]);
+                notify_assign(bucket, hash_val, first[pos]);
+            });
+        } catch (...) {
+            // 异常之前已经插入的元素保留在哈希表中，计入元素个数
+            on_size_changed(static_cast<int64_t>(inserted));
+            throw;
+        }
+        on_size_changed(static_cast<int64_t>(inserted));
+        return inserted;
+    }
+
+    /**
+     * @brief 批量删除，分组方式同 find_many
+     * 
+     * @tparam KeyIt 
+     * @param first 
+     * @param last 
+     * @return size_t 删除的键的个数
+     */
+    template <typename KeyIt>
+    size_t erase_many(KeyIt first, KeyIt last) {
+        size_t erased = 0;
+        size_t count = static_cast<size_t>(last - first);
+        record(kStatsErase, count);
+        try {
+            batch_apply(first, count, true, [&](size_t pos, size_t hash_val, B* bucket) {
+                notify_erase(bucket, hash_val, first[pos]);
+                erased += bucket->erase(hash_val, first[pos], key_eq_);
+            });
+        } catch (...) {
+            on_size_changed(-static_cast<int64_t>(erased));
+            throw;
+        }
+        on_size_changed(-static_cast<int64_t>(erased));
+        return erased;
+    }
+
+    /**
+     * @brief 清空哈希表
+     *        清空期间不会有扩缩容，桶的数量保持不变，需要时可以再调用 shrink_to_fit
+     */
+    void clear() {
+        std::lock_guard<std::mutex> resize_guard(resize_mutex_);
+        size_t removed = clear_buckets(0, bucket_count());
+        size_counter_.add(-static_cast<int64_t>(removed));
+        record(kStatsNodeFree, removed);
+    }
+
+    /**
+     * @brief 并行清空哈希表，桶被分段由多个线程（包括调用线程）领取，用于元素很多时
+     *        其他语义同 clear，删除的节点由各个线程交给回收策略
+     * 
+     * @param thread_count 0 表示使用 CPU 核数
+     */
+    void parallel_clear(size_t thread_count = 0) {
+        std::lock_guard<std::mutex> resize_guard(resize_mutex_);
+        std::atomic<size_t> removed{0};
+        parallel_chunks(bucket_count(), PARALLEL_SCAN_CHUNK_SIZE, thread_count,
+            [this, &removed](size_t, size_t begin, size_t end) {
+                removed.fetch_add(clear_buckets(begin, end), std::memory_order_relaxed);
+            });
+        size_counter_.add(-static_cast<int64_t>(removed.load()));
+        record(kStatsNodeFree, removed.load());
+    }
+
+    /**
+     * @brief 并行批量插入，第 i 个键对应的值为 values[i]，用于初始化或者重建很大的哈希表
+     *        先一次扩容到能容纳所有元素，再把输入分段由多个线程（包括调用线程）按 insert_many 的方式插入
+     *        unique_keys 为 true 时调用者保证输入中的键互不相同、并且都不在哈希表中，插入时不再查找重复的键；
+     *        否则键已存在时覆盖值，同一个键在输入中出现多次时，保留哪一个值是不确定的
+     * 
+     * @tparam KeyIt 随机访问迭代器
+     * @tparam ValueIt 
+     * @param first 
+     * @param last 
+     * @param values 
+     * @param unique_keys 
+     * @param thread_count 0 表示使用 CPU 核数
+     * @return size_t 新插入的键的个数
+     */
+    template <typename KeyIt, typename ValueIt>
+    size_t bulk_load(KeyIt first, KeyIt last, ValueIt values, bool unique_keys = false, size_t thread_count = 0) {
+        size_t count = static_cast<size_t>(last - first);
+        record(kStatsUpsert, count);
+        reserve(size() + count);
+        std::atomic<size_t> inserted{0};
+        try {
+            parallel_chunks(count, PARALLEL_SCAN_CHUNK_SIZE, thread_count,
+                [&](size_t, size_t begin, size_t end) {
+                    size_t local = 0;
+                    KeyIt keys = first + begin;
+                    ValueIt chunk_values = values + begin;
+                    try {
+                        if (unique_keys) {
+                            batch_apply(keys, end - begin, true, [&](size_t pos, size_t hash_val, B* bucket) {
+                                bucket->insert_unique(hash_val, keys[pos], chunk_values[pos]);
+                                notify_assign(bucket, hash_val, keys[pos]);
+                                ++local;
+                            });
+                        } else {
+                            batch_apply(keys, end - begin, true, [&](size_t pos, size_t hash_val, B* bucket) {
+                                local += bucket->upsert(hash_val, keys[pos], key_eq_,
+                                    [&](V& value) { value = chunk_values[pos]; }, chunk_values[pos]);
+                                notify_assign(bucket, hash_val, keys[pos]);
+                            });
+                        }
+                    } catch (...) {
+                        inserted.fetch_add(local, std::memory_order_relaxed);
+                        throw;
+                    }
+                    inserted.fetch_add(local, std::memory_order_relaxed);
+                });
+        } catch (...) {
+            // 异常之前已经插入的元素保留在哈希表中，计入元素个数
+            on_size_changed(static_cast<int64_t>(inserted.load()));
+            throw;
+        }
+        on_size_changed(static_cast<int64_t>(inserted.load()));
+        return inserted.load();
+    }
+
+    /**
+     * @brief 获取元素个数，并发修改时是一个近似值
+     * 
+     * @return size_t 
+     */
+    size_t size() const {
+        return size_counter_.sum();
+    }
+
+    /**
+     * @brief 获取当前桶的数量
+     * 
+     * @return size_t 
+     */
+    size_t bucket_count() const {
+        uint64_t layout = layout_.load(std::memory_order_acquire);
+        return (base_bucket_size_ << layout_level(layout)) + layout_split(layout);
+    }
+
+    /**
+     * @brief 桶和锁分片所在的 NUMA 节点，-1 表示没有指定
+     * 
+     * @return int 
+     */
+    int numa_node() const {
+        return numa_node_;
+    }
+
+    /**
+     * @brief 获取当前的负载因子，即平均每个桶中的元素个数
+     * 
+     * @return float 
+     */
+    float load_factor() const {
+        return static_cast<float>(size()) / static_cast<float>(bucket_count());
+    }
+
+    /**
+     * @brief 获取最大负载因子
+     * 
+     * @return float 
+     */
+    float max_load_factor() const {
+        return max_load_factor_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置最大负载因子，负载因子超过此值时扩容，低于此值的四分之一时缩容
+     * 
+     * @param max_load_factor 
+     */
+    void set_max_load_factor(float max_load_factor) {
+        if (max_load_factor > 0) {
+            max_load_factor_.store(max_load_factor, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 预先扩容到能容纳 element_count 个元素而不超过最大负载因子，在调用线程中一次完成
+     *        之后插入这些元素不再触发分裂，元素较少时也不会自动缩容到此桶数以下，直到调用 shrink_to_fit
+     *        遍历期间不扩容
+     * 
+     * @param element_count 
+     */
+    void reserve(size_t element_count) {
+        std::lock_guard<std::mutex> resize_guard(resize_mutex_);
+        float max_load_factor = max_load_factor_.load(std::memory_order_relaxed);
+        for (; scan_count_.load(std::memory_order_relaxed) == 0
+            && static_cast<double>(element_count) > static_cast<double>(bucket_count()) * max_load_factor;) {
+            if (!split_one_bucket()) break;
+        }
+        if (bucket_count() > reserved_bucket_size_) {
+            reserved_bucket_size_ = bucket_count();
+        }
+    }
+
+    /**
+     * @brief 缩容，合并空闲的桶，直到负载因子接近最大负载因子或者回到初始桶数
+     *        用于大量删除之后，合并过程逐个桶进行，不会阻塞其他读写操作，同时取消 reserve 预留的桶数
+     */
+    void shrink_to_fit() {
+        std::lock_guard<std::mutex> resize_guard(resize_mutex_);
+        reserved_bucket_size_ = 0;
+        float max_load_factor = max_load_factor_.load(std::memory_order_relaxed);
+        for (;;) {
+            size_t bucket_size = bucket_count();
+            if (bucket_size <= base_bucket_size_ || scan_count_.load(std::memory_order_relaxed) != 0
+                || static_cast<float>(size()) > static_cast<float>(bucket_size - 1) * max_load_factor) {
+                break;
+            }
+            merge_one_bucket();
+        }
+    }
+
+    /**
+     * @brief 获取迭代器
+     * 
+     * @return ConstIterator 
+     */
+    ConstIterator<K, V, F, B, E, L> get_iterator() {
+        return ConstIterator<K, V, F, B, E, L>(this);
+    }
+
+    /**
+     * @brief 获取弱一致的迭代器，遍历期间其他线程可以并发读写
+     *        迭代器存活期间暂停扩缩容，遍历开始前就存在、期间没有被删除的元素恰好访问一次，
+     *        期间插入、删除的元素可能访问到也可能访问不到
+     *        迭代器每次给一个桶加读锁，把桶中的键值拷贝出来后立即解锁，因此持有迭代器时也可以修改此哈希表
+     * 
+     * @return SnapshotIterator<K, V, F, B, E, L> 
+     */
+    SnapshotIterator<K, V, F, B, E, L> get_snapshot_iterator() {
+        return SnapshotIterator<K, V, F, B, E, L>(this);
+    }
+
+    /**
+     * @brief 并行遍历所有元素，对每个元素调用 fn(const K&, const V&)，其他线程可以并发读写
+     *        一致性同 get_snapshot_iterator，遍历期间暂停扩缩容
+     *        桶被分成若干段由 thread_count 个线程（包括调用线程）领取，fn 在桶的读锁下并发调用，
+     *        需要是线程安全的，并且不能修改此哈希表；fn 抛出的第一个异常在所有线程结束后重新抛出
+     * 
+     * @param fn 
+     * @param thread_count 线程数，0 表示使用 CPU 核数
+     */
+    template <typename Fn>
+    void for_each(Fn&& fn, size_t thread_count = 0) {
+        ScanGuard scan_guard(this);
+        parallel_chunks(bucket_count(), PARALLEL_SCAN_CHUNK_SIZE, thread_count,
+            [this, &fn](size_t, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    visit_bucket(i, fn);
+                }
+            });
+    }
+
+    /**
+     * @brief 并行地对所有元素求 reduce_fn(..., transform(key, value))，一致性同 for_each
+     *        每个线程先在本地归约，最后与 init 依次合并，reduce_fn 需要满足结合律和交换律
+     *        transform 与 reduce_fn 在多个线程中并发调用，transform 在桶的读锁下调用，不能修改此哈希表
+     * 
+     * @tparam T 
+     * @tparam Transform 
+     * @tparam Reduce 
+     * @param init 
+     * @param transform 以 transform(const K&, const V&) 调用，返回 T
+     * @param reduce_fn 以 reduce_fn(T, T) 调用，返回 T
+     * @param thread_count 0 表示使用 CPU 核数
+     * @return T 
+     */
+    template <typename T, typename Transform, typename Reduce>
+    T transform_reduce(T init, Transform&& transform, Reduce&& reduce_fn, size_t thread_count = 0) {
+        ScanGuard scan_guard(this);
+        // 每个线程的部分结果，第一个元素直接作为初值，不要求 T 有单位元
+        std::vector<std::unique_ptr<T>> partials(resolve_thread_count(thread_count));
+        parallel_chunks(bucket_count(), PARALLEL_SCAN_CHUNK_SIZE, thread_count,
+            [&](size_t worker, size_t begin, size_t end) {
+                std::unique_ptr<T>& partial = partials[worker];
+                auto accumulate = [&](const K& key, const V& value) {
+                    if (partial) {
+                        *partial = reduce_fn(std::move(*partial), transform(key, value));
+                    } else {
+                        partial.reset(new T(transform(key, value)));
+                    }
+                };
+                for (size_t i = begin; i < end; ++i) {
+                    visit_bucket(i, accumulate);
+                }
+            });
+        for (auto& partial : partials) {
+            if (partial) {
+                init = reduce_fn(std::move(init), std::move(*partial));
+            }
+        }
+        return init;
+    }
+
+    /**
+     * @brief 并行地对所有值求 reduce_fn(..., value)，即 transform 为取值的 transform_reduce
+     * 
+     * @tparam Reduce 
+     * @param init 
+     * @param reduce_fn 以 reduce_fn(V, V) 调用，返回 V
+     * @param thread_count 0 表示使用 CPU 核数
+     * @return V 
+     */
+    template <typename Reduce>
+    V reduce(V init, Reduce&& reduce_fn, size_t thread_count = 0) {
+        return transform_reduce(std::move(init), [](const K&, const V& value) { return value; },
+            std::forward<Reduce>(reduce_fn), thread_count);
+    }
+
+    /**
+     * @brief 获取统计快照，用于定位延迟的来源：链过长的桶、锁的争用或者乐观读的重试
+     *        链长直方图在调用时逐个桶加读锁统计，期间暂停扩缩容；其余各项是累计值，两次快照相减得到区间内的变化
+     *        操作次数与锁的统计需要定义 CONCURRENT_HASH_MAP_STATS，见 MapStats
+     * 
+     * @return MapStats 
+     */
+    MapStats stats() {
+        MapStats result;
+        result.chain_length_histogram.assign(STATS_CHAIN_HISTOGRAM_SIZE, 0);
+        {
+            ScanGuard scan_guard(this);
+            result.bucket_count = bucket_count();
+            for (size_t i = 0; i < result.bucket_count; ++i) {
+                size_t chain_length = 0;
+                auto count_node = [&chain_length](const K&, const V&) { ++chain_length; };
+                visit_bucket(i, count_node);
+                ++result.chain_length_histogram[chain_length < STATS_CHAIN_HISTOGRAM_SIZE
+                    ? chain_length : STATS_CHAIN_HISTOGRAM_SIZE - 1];
+                if (chain_length > result.max_chain_length) {
+                    result.max_chain_length = chain_length;
+                }
+            }
+        }
+        result.size = size();
+        result.load_factor = static_cast<float>(result.size) / static_cast<float>(result.bucket_count);
+#ifdef CONCURRENT_HASH_MAP_STATS
+        for (size_t item = 0; item < kStatsItemCount; ++item) {
+            result.counts[item] = stats_counters_.sum(static_cast<MapStatsItem>(item));
+        }
+        result.stripe_lock_counts.resize(stripe_count_);
+        result.stripe_contended_counts.resize(stripe_count_);
+        for (size_t i = 0; i < stripe_count_; ++i) {
+            typename LockStripe<L>::Stats stripe_stats = stripes_[i].stats();
+            result.lock_read_count += stripe_stats.read_count;
+            result.lock_write_count += stripe_stats.write_count;
+            result.lock_contended_count += stripe_stats.contended_count;
+            result.lock_wait_ns += stripe_stats.wait_ns;
+            result.stripe_lock_counts[i] = stripe_stats.read_count + stripe_stats.write_count;
+            result.stripe_contended_counts[i] = stripe_stats.contended_count;
+        }
+#endif
+        return result;
+    }
+
+    /**
+     * @brief 把所有元素保存到文件（kMapFilePod 格式），K、V 需要是平凡可拷贝的类型，一致性同 get_snapshot_iterator
+     *        文件中带有按 F 计算的哈希索引，可以由 load 加载，也可以由 MappedHashTable 映射后直接只读查找
+     *        先写入 path.tmp 再重命名，失败时不会破坏已有的文件
+     * 
+     * @param path 
+     * @return true 
+     * @return false 写入失败
+     */
+    bool save(const std::string& path) {
+        std::vector<K> keys;
+        std::vector<V> values;
+        keys.reserve(size());
+        values.reserve(size());
+        for_each([&keys, &values](const K& key, const V& value) {
+            keys.push_back(key);
+            values.push_back(value);
+        }, 1);
+        return write_pod_map_file(path, keys.data(), values.data(), keys.size(), hash_fn_);
+    }
+
+    /**
+     * @brief 使用序列化器把所有元素保存到文件（kMapFileStream 格式），一致性同 get_snapshot_iterator
+     *        序列化器的要求见 PodSerializer
+     * 
+     * @tparam KS 
+     * @tparam VS 
+     * @param path 
+     * @param key_serializer 
+     * @param value_serializer 
+     * @return true 
+     * @return false 写入失败
+     */
+    template <typename KS, typename VS>
+    bool save(const std::string& path, const KS& key_serializer, const VS& value_serializer) {
+        MapFileWriter writer;
+        if (!writer.open(path)) {
+            return false;
+        }
+        MapFileHeader header;
+        memset(&header, 0, sizeof(header));
+        header.format = kMapFileStream;
+        header.keys_offset = writer.offset();
+        std::string buffer;
+        bool ok = true;
+        for_each([&](const K& key, const V& value) {
+            append_map_file_field(key_serializer, key, buffer);
+            append_map_file_field(value_serializer, value, buffer);
+            ++header.element_count;
+            if (buffer.size() >= MAP_FILE_WRITE_BUFFER_SIZE) {
+                ok = ok && writer.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }, 1);
+        return ok && writer.write(buffer.data(), buffer.size()) && writer.commit(header);
+    }
+
+    /**
+     * @brief 从 save(path) 保存的文件加载元素，键已存在时覆盖值
+     *        文件被映射到内存后直接作为 bulk_load 的输入，元素不经过中间的拷贝，节点从节点池成批分配
+     *        F 需要与保存时使用的哈希函数在不同进程中对同一个键得到相同的哈希值，否则 MappedHashTable 无法查找，
+     *        但是 load 本身不依赖保存时的哈希值
+     * 
+     * @param path 
+     * @param thread_count 插入使用的线程数，0 表示使用 CPU 核数
+     * @return true 
+     * @return false 文件不存在、格式或者键值大小不匹配
+     */
+    bool load(const std::string& path, size_t thread_count = 0) {
+        MappedHashTable<K, V, F, E> table(hash_fn_, key_eq_);
+        if (!table.open(path)) {
+            return false;
+        }
+        bulk_load(table.keys(), table.keys() + table.size(), table.values(), false, thread_count);
+        return true;
+    }
+
+    /**
+     * @brief 使用序列化器从 save(path, key_serializer, value_serializer) 保存的文件加载元素，键已存在时覆盖值
+     *        每次解码 MAP_FILE_LOAD_CHUNK_SIZE 个元素后批量插入，K、V 需要可以默认构造
+     *        文件内容损坏时返回 false，损坏位置之前的元素已经插入
+     * 
+     * @tparam KS 
+     * @tparam VS 
+     * @param path 
+     * @param key_serializer 
+     * @param value_serializer 
+     * @param thread_count 插入使用的线程数，0 表示使用 CPU 核数
+     * @return true 
+     * @return false 文件不存在、格式不匹配或者内容损坏
+     */
+    template <typename KS, typename VS>
+    bool load(const std::string& path, const KS& key_serializer, const VS& value_serializer,
+              size_t thread_count = 0) {
+        MappedFile file;
+        MapFileHeader header;
+        if (!file.open(path) || !read_map_file_header(file, kMapFileStream, 0, 0, header)) {
+            return false;
+        }
+        file.advise_sequential();
+        reserve(size() + header.element_count);
+        const char* pos = file.data() + header.keys_offset;
+        const char* end = file.data() + file.size();
+        std::vector<K> keys;
+        std::vector<V> values;
+        for (uint64_t i = 0; i < header.element_count;) {
+            keys.clear();
+            values.clear();
+            bool ok = true;
+            for (; ok && i < header.element_count && keys.size() < MAP_FILE_LOAD_CHUNK_SIZE; ++i) {
+                keys.emplace_back();
+                values.emplace_back();
+                ok = read_map_file_field(key_serializer, pos, end, keys.back())
+                    && read_map_file_field(value_serializer, pos, end, values.back());
+            }
+            if (!ok) {
+                keys.pop_back();
+                values.pop_back();
+            }
+            bulk_load(keys.begin(), keys.end(), values.begin(), false, thread_count);
+            if (!ok) {
+                return false;
+            }
+        }
+        return pos == end;
+    }
+
+    /**
+     * @brief 设置变更的订阅者，nullptr 表示取消订阅，订阅者的生命周期由调用者管理
+     *        之后的每次修改都在桶的写锁下回调 feed：插入、覆盖、upsert、insert_and_inc、visit_mut、
+     *        批量与并行插入通知修改之后的值，各种删除与清空逐个通知被删除的键；
+     *        visit_concurrent 不加写锁原地修改值，不会通知
+     *        返回前依次获取每个锁分片的写锁：之后开始的修改都会通知新的订阅者，
+     *        仍在使用旧订阅者的修改都已经结束，返回后可以安全地销毁旧的订阅者
+     * 
+     * @param feed 
+     */
+    void set_change_feed(ChangeFeed<K, V>* feed) {
+        change_feed_.store(feed, std::memory_order_relaxed);
+        for (size_t i = 0; i < stripe_count_; ++i) {
+            stripes_[i].wrlock();
+            stripes_[i].unlock();
+        }
+    }
+
+    ChangeFeed<K, V>* change_feed() const {
+        return change_feed_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 重放 ChangeLog 写出的日志，用于在备机上重建哈希表，或者在 load 快照之后补上快照开始以后的修改
+     *        先顺序解码所有序号不小于 from_sequence 的记录，再按键的哈希值分给多个线程（包括调用线程），
+     *        每个线程把分到的记录按序号排序后依次应用，同一个键上的修改保持原来的顺序，不同的键互不影响
+     *        记录是修改之后的值，从快照开始之前的任意序号重放都得到相同的结果；
+     *        日志末尾不完整的记录（写入过程中崩溃）被忽略，K、V 需要可以默认构造
+     * 
+     * @tparam KS 
+     * @tparam VS 
+     * @param path 
+     * @param key_serializer 
+     * @param value_serializer 
+     * @param from_sequence 从哪个序号开始重放，通常是取快照之前读取的 ChangeLog::sequence()
+     * @param thread_count 重放使用的线程数，0 表示使用 CPU 核数
+     * @return true 
+     * @return false 文件不存在、不是变更日志或者记录无法解码，此时哈希表没有被修改
+     */
+    template <typename KS, typename VS, typename = typename std::enable_if<!std::is_arithmetic<KS>::value>::type>
+    bool replay(const std::string& path, const KS& key_serializer, const VS& value_serializer,
+                uint64_t from_sequence = 0, size_t thread_count = 0) {
+        MappedFile file;
+        if (!file.open(path) || !check_change_log_header(file.data(), file.size())) {
+            return false;
+        }
+        file.advise_sequential();
+        struct Change {
+            uint64_t sequence;
+            bool erase;
+            K key;
+            V value;
+        };
+        std::vector<Change> changes;
+        size_t group_count = resolve_thread_count(thread_count);
+        std::vector<std::vector<size_t>> groups(group_count);
+        const char* pos = file.data() + sizeof(ChangeLogHeader);
+        const char* end = file.data() + file.size();
+        for (ChangeRecord record; read_change_record(pos, end, record);) {
+            if (record.sequence < from_sequence) {
+                continue;
+            }
+            changes.emplace_back();
+            Change& change = changes.back();
+            change.sequence = record.sequence;
+            change.erase = record.type == kChangeErase;
+            const char* field = record.fields;
+            if (!read_map_file_field(key_serializer, field, record.fields_end, change.key)
+                || (!change.erase && !read_map_file_field(value_serializer, field, record.fields_end, change.value))
+                || field != record.fields_end) {
+                return false;
+            }
+            groups[hash_of(change.key) % group_count].push_back(changes.size() - 1);
+        }
+        parallel_chunks(group_count, 1, group_count, [&](size_t, size_t group_begin, size_t group_end) {
+            for (size_t g = group_begin; g < group_end; ++g) {
+                std::sort(groups[g].begin(), groups[g].end(), [&changes](size_t a, size_t b) {
+                    return changes[a].sequence < changes[b].sequence;
+                });
+                for (size_t i : groups[g]) {
+                    if (changes[i].erase) {
+                        erase_key(changes[i].key);
+                    } else {
+                        insert_or_assign(std::move(changes[i].key), std::move(changes[i].value));
+                    }
+                }
+            }
+        });
+        return true;
+    }
+
+    /**
+     * @brief 重放以 PodSerializer 编码的日志，即 ChangeLog<K, V> 写出的日志，其他同上
+     * 
+     * @param path 
+     * @param from_sequence 
+     * @param thread_count 
+     * @return true 
+     * @return false 
+     */
+    bool replay(const std::string& path, uint64_t from_sequence = 0, size_t thread_count = 0) {
+        return replay(path, PodSerializer<K>(), PodSerializer<V>(), from_sequence, thread_count);
+    }
+
+private:
+    /**
+     * @brief 加读锁查找
+     * 
+     * @param hash_val 
+     * @param key 
+     * @param value 
+     * @return true 
+     * @return false 
+     */
+    template <typename Q>
+    bool find(size_t hash_val, const Q& key, V& value, std::false_type) const {
+        LockStripe<L>* stripe = nullptr;
+        B* bucket = lock_bucket(hash_val, false, &stripe);
+        typename B::node_type* node = bucket->find_node(hash_val, key, key_eq_);
+        if (node != nullptr) {
+            value = node->get_value();
+        }
+        unlock_bucket(bucket, stripe, false);
+        return node != nullptr;
+    }
+
+    /**
+     * @brief 不加锁的乐观读，读者不写任何共享的缓存行，多个读者之间不会互相干扰
+     *        定位桶、校验分裂层级、遍历链表都不加锁，最后用桶的版本号校验读到的结果
+     *        连续失败 OPTIMISTIC_READ_RETRY 次后退化为加读锁查找
+     * 
+     * @param hash_val 
+     * @param key 
+     * @param value 
+     * @return true 
+     * @return false 
+     */
+    template <typename Q>
+    bool find(size_t hash_val, const Q& key, V& value, std::true_type) const {
+        size_t hi = div_base(hash_val);
+        size_t lo = mod_base(hash_val);
+        // 进入临界区后访问到的节点即使被删除也不会释放
+        typename B::reclaimer_type::Guard guard;
+        for (size_t retry = 0; retry < OPTIMISTIC_READ_RETRY; ++retry) {
+            if (retry != 0) {
+                record(kStatsOptimisticRetry, 1);
+            }
+            uint64_t layout = layout_.load(std::memory_order_acquire);
+            size_t level = layout_level(layout);
+            size_t slot_hi = hi & level_mask(level);
+            if (base_bucket_size_ * slot_hi + lo < layout_split(layout)) {
+                slot_hi = hi & level_mask(level + 1);
+            }
+            B* bucket = bucket_at(slot_hi, lo);
+            uint32_t version = bucket->read_version();
+            if ((version & 1) != 0 || !bucket->live_.load(std::memory_order_relaxed)
+                || (hi & level_mask(bucket->level_.load(std::memory_order_relaxed))) != slot_hi) {
+                continue;
+            }
+            // 先读到临时变量中，校验失败时不会修改调用者的 value
+            V tmp_value;
+            bool is_exist = false;
+            if (bucket->try_find(version, hash_val, key, key_eq_, tmp_value, is_exist)) {
+                if (is_exist) {
+                    value = tmp_value;
+                }
+                return is_exist;
+            }
+        }
+        return find(hash_val, key, value, std::false_type());
+    }
+
+    /**
+     * @brief 不加锁的 visit_concurrent，定位桶的方式同乐观读
+     *        找到节点后不再需要校验版本号：节点在临界区内不会被释放，对值的访问都是原子的
+     * 
+     * @tparam Fn 
+     * @param hash_val 
+     * @param key 
+     * @param fn 
+     * @return true 
+     * @return false 
+     */
+    template <typename Fn>
+    bool visit_concurrent(size_t hash_val, const K& key, Fn& fn, std::true_type) const {
+        size_t hi = div_base(hash_val);
+        typename B::reclaimer_type::Guard guard;
+        for (size_t retry = 0; retry < OPTIMISTIC_READ_RETRY; ++retry) {
+            if (retry != 0) {
+                record(kStatsOptimisticRetry, 1);
+            }
+            uint64_t layout = layout_.load(std::memory_order_acquire);
+            size_t index = bucket_index_of(hash_val, layout);
+            size_t slot_hi = div_base(index);
+            B* bucket = bucket_at_index(index);
+            uint32_t version = bucket->read_version();
+            if ((version & 1) != 0 || !bucket->live_.load(std::memory_order_relaxed)
+                || (hi & level_mask(bucket->level_.load(std::memory_order_relaxed))) != slot_hi) {
+                continue;
+            }
+            typename B::node_type* node = nullptr;
+            if (bucket->try_find_node(version, hash_val, key, key_eq_, node)) {
+                if (node != nullptr) {
+                    fn(node->get_value());
+                }
+                return node != nullptr;
+            }
+        }
+        return visit_concurrent(hash_val, key, fn, std::false_type());
+    }
+
+    // 节点立即释放时需要加读锁，值的访问仍然是原子的，读锁下也可以修改
+    template <typename Fn>
+    bool visit_concurrent(size_t hash_val, const K& key, Fn& fn, std::false_type) const {
+        LockStripe<L>* stripe = nullptr;
+        B* bucket = lock_bucket(hash_val, false, &stripe);
+        typename B::node_type* node = bucket->find_node(hash_val, key, key_eq_);
+        if (node != nullptr) {
+            fn(node->get_value());
+        }
+        unlock_bucket(bucket, stripe, false);
+        return node != nullptr;
+    }
+
+    /**
+     * @brief 遍历期间暂停扩缩容，桶的数量和每个元素所在的桶都不变
+     *        构造时在 resize_mutex_ 下增加遍历计数，等待正在进行的迁移完成，
+     *        之后的扩缩容看到计数不为 0 直接返回，析构后由后续的写操作补上
+     *        不持有 resize_mutex_，因此多个遍历可以同时进行，遍历期间也可以读写
+     */
+    class ScanGuard {
+    public:
+        explicit ScanGuard(ConcurrentHashMap* cmp) : cmp_(cmp) {
+            std::lock_guard<std::mutex> resize_guard(cmp_->resize_mutex_);
+            cmp_->scan_count_.fetch_add(1, std::memory_order_relaxed);
+        }
+        ~ScanGuard() {
+            if (cmp_ != nullptr) {
+                cmp_->scan_count_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        ScanGuard(const ScanGuard&) = delete;
+        ScanGuard& operator=(const ScanGuard&) = delete;
+        ScanGuard(ScanGuard&& other) : cmp_(other.cmp_) {
+            other.cmp_ = nullptr;
+        }
+        ScanGuard& operator=(ScanGuard&& other) {
+            std::swap(cmp_, other.cmp_);
+            return *this;
+        }
+
+    private:
+        ConcurrentHashMap* cmp_;
+    };
+
+    // 记录统计项，未定义 CONCURRENT_HASH_MAP_STATS 时是空函数
+    void record(MapStatsItem item, uint64_t delta) const {
+#ifdef CONCURRENT_HASH_MAP_STATS
+        stats_counters_.add(item, delta);
+#else
+        (void)item;
+        (void)delta;
+#endif
+    }
+
+    // 并行操作实际使用的线程数上限，0 表示使用 CPU 核数
+    static size_t resolve_thread_count(size_t thread_count) {
+        if (thread_count == 0) {
+            thread_count = std::thread::hardware_concurrency();
+        }
+        return thread_count == 0 ? 1 : thread_count;
+    }
+
+    /**
+     * @brief 把 [0, total) 按 chunk_size 分段，由多个线程（包括调用线程）领取，对每段调用 fn(worker, begin, end)
+     *        worker 是线程的编号，小于 resolve_thread_count(thread_count)，同一编号不会并发调用
+     *        某个线程抛出异常后其他线程不再领取新的段，第一个异常在所有线程结束后重新抛出
+     * 
+     * @param total 
+     * @param chunk_size 
+     * @param thread_count 0 表示使用 CPU 核数
+     * @param fn 
+     */
+    template <typename Fn>
+    static void parallel_chunks(size_t total, size_t chunk_size, size_t thread_count, const Fn& fn) {
+        size_t chunk_count = (total + chunk_size - 1) / chunk_size;
+        thread_count = resolve_thread_count(thread_count);
+        if (thread_count > chunk_count) {
+            thread_count = chunk_count;
+        }
+        std::atomic<size_t> next_chunk{0};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto worker = [&](size_t worker_id) {
+            try {
+                for (;;) {
+                    size_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+                    if (chunk >= chunk_count) {
+                        break;
+                    }
+                    size_t begin = chunk * chunk_size;
+                    fn(worker_id, begin, total - begin < chunk_size ? total : begin + chunk_size);
+                }
+            } catch (...) {
+                next_chunk.store(chunk_count, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> guard(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < thread_count; ++i) {
+            threads.emplace_back(worker, i);
+        }
+        worker(0);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // 加读锁对第 index 个桶中的每个元素调用 fn(const K&, const V&)，需要持有 ScanGuard
+    template <typename Fn>
+    void visit_bucket(size_t index, Fn& fn) const {
+        B* bucket = bucket_at_index(index);
+        LockStripe<L>* stripe = stripe_at_index(index);
+        stripe->rdlock();
+        try {
+            for (typename B::node_type* node = bucket->first(); node != nullptr; node = bucket->next(node)) {
+                fn(node->get_key(), node->get_value());
+            }
+        } catch (...) {
+            stripe->unlock();
+            throw;
+        }
+        stripe->unlock();
+    }
+
+    // 加写锁清空 [begin, end) 的桶，返回删除的元素个数，需要持有 resize_mutex_
+    size_t clear_buckets(size_t begin, size_t end) {
+        size_t removed = 0;
+        for (size_t i = begin; i < end; ++i) {
+            B* bucket = bucket_at_index(i);
+            LockStripe<L>* stripe = stripe_at_index(i);
+            stripe->wrlock();
+            bucket->begin_write();
+            ChangeFeed<K, V>* feed = change_feed_.load(std::memory_order_relaxed);
+            if (feed != nullptr) {
+                for (typename B::node_type* node = bucket->first(); node != nullptr; node = bucket->next(node)) {
+                    feed->on_erase(node->get_key());
+                }
+            }
+            removed += bucket->clear();
+            unlock_bucket(bucket, stripe, true);
+        }
+        return removed;
+    }
+
+    // 加读锁把第 index 个桶中的键值拷贝到 out 的末尾，需要持有 ScanGuard
+    template <typename Entry>
+    void copy_bucket(size_t index, std::vector<Entry>* out) const {
+        B* bucket = bucket_at_index(index);
+        LockStripe<L>* stripe = stripe_at_index(index);
+        stripe->rdlock();
+        try {
+            for (typename B::node_type* node = bucket->first(); node != nullptr; node = bucket->next(node)) {
+                out->emplace_back(node->get_key(), node->get_value());
+            }
+        } catch (...) {
+            stripe->unlock();
+            throw;
+        }
+        stripe->unlock();
+    }
+
+    // 加写锁执行桶的 upsert，新插入了键时更新元素个数
+    template <typename KArg, typename U, typename... Args>
+    bool upsert_key(KArg&& key, U&& update, Args&&... args) {
+        record(kStatsUpsert, 1);
+        size_t hash_val = hash_of(key);
+        LockStripe<L>* stripe = nullptr;
+        B* bucket = lock_bucket(hash_val, true, &stripe);
+        bool is_new;
+        try {
+            ChangeFeed<K, V>* feed = change_feed_.load(std::memory_order_relaxed);
+            if (feed == nullptr) {
+                is_new = bucket->upsert(hash_val, std::forward<KArg>(key), key_eq_, update,
+                    std::forward<Args>(args)...);
+            } else {
+                // 有订阅者时不移动键，修改之后还要用它找到节点
+                const K& key_ref = key;
+                is_new = bucket->upsert(hash_val, key_ref, key_eq_, update, std::forward<Args>(args)...);
+                notify_assign(bucket, hash_val, key_ref);
+            }
+        } catch (...) {
+            unlock_bucket(bucket, stripe, true);
+            throw;
+        }
+        unlock_bucket(bucket, stripe, true);
+        if (is_new) {
+            on_size_changed(1);
+        }
+        return is_new;
+    }
+
+    template <typename Q>
+    bool contains_key(const Q& key) const {
+        record(kStatsFind, 1);
+        return contains_key(hash_of(key), key, std::integral_constant<bool, B::kOptimisticRead>());
+    }
+
+    // 支持乐观读时 V 是平凡可复制的，借用查找读到一个临时变量中
+    template <typename Q>
+    bool contains_key(size_t hash_val, const Q& key, std::true_type) const {
+        V value;
+        return find(hash_val, key, value, std::true_type());
+    }
+
+    template <typename Q>
+    bool contains_key(size_t hash_val, const Q& key, std::false_type) const {
+        LockStripe<L>* stripe = nullptr;
+        B* bucket = lock_bucket(hash_val, false, &stripe);
+        bool is_exist = bucket->find_node(hash_val, key, key_eq_) != nullptr;
+        unlock_bucket(bucket, stripe, false);
+        return is_exist;
+    }
+
+    // 加写锁删除 [begin, end) 的桶中满足 pred(const K&, V&) 的元素，返回删除的元素个数，需要持有 ScanGuard
+    template <typename Pred>
+    size_t erase_if_in_buckets(size_t begin, size_t end, Pred& pred) {
+        size_t removed = 0;
+        for (size_t i = begin; i < end; ++i) {
+            B* bucket = bucket_at_index(i);
+            LockStripe<L>* stripe = stripe_at_index(i);
+            stripe->wrlock();
+            bucket->begin_write();
+            ChangeFeed<K, V>* feed = change_feed_.load(std::memory_order_relaxed);
+            try {
+                removed += bucket->erase_if([&pred, feed](typename B::node_type& node) {
+                    if (!pred(node.get_key(), node.get_value())) {
+                        return false;
+                    }
+                    if (feed != nullptr) {
+                        feed->on_erase(node.get_key());
+                    }
+                    return true;
+                });
+            } catch (...) {
+                unlock_bucket(bucket, stripe, true);
+                throw;
+            }
+            unlock_bucket(bucket, stripe, true);
+        }
+        return removed;
+    }
+
+    // 有变更订阅者时，在桶的写锁下通知 key 修改之后的值
+    template <typename Q>
+    void notify_assign(B* bucket, size_t hash_val, const Q& key) {
+        ChangeFeed<K, V>* feed = change_feed_.load(std::memory_order_relaxed);
+        if (feed != nullptr) {
+            typename B::node_type* node = bucket->find_node(hash_val, key, key_eq_);
+            feed->on_assign(node->get_key(), node->get_value());
+        }
+    }
+
+    // 有变更订阅者时，在桶的写锁下、删除之前通知 key 将被删除，key 不存在时不通知
+    template <typename Q>
+    void notify_erase(B* bucket, size_t hash_val, const Q& key) {
+        ChangeFeed<K, V>* feed = change_feed_.load(std::memory_order_relaxed);
+        if (feed != nullptr) {
+            typename B::node_type* node = bucket->find_node(hash_val, key, key_eq_);
+            if (node != nullptr) {
+                feed->on_erase(node->get_key());
+            }
+        }
+    }
+
+    template <typename Q>
+    void erase_key(const Q& key) {
+        record(kStatsErase, 1);
+        size_t hash_val = hash_of(key);
+        LockStripe<L>* stripe = nullptr;
+        B* bucket = lock_bucket(hash_val, true, &stripe);
+        notify_erase(bucket, hash_val, key);
+        bool is_erased = bucket->erase(hash_val, key, key_eq_);
+        unlock_bucket(bucket, stripe, true);
+        if (is_erased) {
+            on_size_changed(-1);
+        }
+    }
+
+    // 加锁查找的批量版本
+    template <typename KeyIt, typename ValueIt, typename FoundIt>
+    size_t find_many(KeyIt first, size_t count, ValueIt values, FoundIt found, std::false_type) const {
+        size_t found_count = 0;
+        batch_apply(first, count, false, [&](size_t pos, size_t hash_val, B* bucket) {
+            typename B::node_type* node = bucket->find_node(hash_val, first[pos], key_eq_);
+            if (node != nullptr) {
+                values[pos] = node->get_value();
+            }
+            found[pos] = node != nullptr;
+            found_count += node != nullptr;
+        });
+        return found_count;
+    }
+
+    // 乐观读的批量版本，先整批哈希、预取，再逐个不加锁查找
+    template <typename KeyIt, typename ValueIt, typename FoundIt>
+    size_t find_many(KeyIt first, size_t count, ValueIt values, FoundIt found, std::true_type) const {
+        size_t hashes[BATCH_CHUNK_SIZE];
+        size_t found_count = 0;
+        typename B::reclaimer_type::Guard guard;
+        for (size_t begin = 0; begin < count; begin += BATCH_CHUNK_SIZE) {
+            size_t chunk = count - begin < BATCH_CHUNK_SIZE ? count - begin : BATCH_CHUNK_SIZE;
+            uint64_t layout = layout_.load(std::memory_order_acquire);
+            for (size_t i = 0; i < chunk; ++i) {
+                hashes[i] = hash_of(first[begin + i]);
+                __builtin_prefetch(bucket_at_index(bucket_index_of(hashes[i], layout)));
+            }
+            for (size_t i = 0; i < chunk; ++i) {
+                bucket_at_index(bucket_index_of(hashes[i], layout))->prefetch();
+            }
+            for (size_t i = 0; i < chunk; ++i) {
+                bool is_exist = find(hashes[i], first[begin + i], values[begin + i], std::true_type());
+                found[begin + i] = is_exist;
+                found_count += is_exist;
+            }
+        }
+        return found_count;
+    }
+
+    // 批量操作中的一个键
+    struct BatchSlot {
+        size_t hash_val;
+        // 按加锁前的桶分布算出的桶下标
+        size_t index;
+        // 在调用者输入中的位置
+        size_t pos;
+    };
+
+    /**
+     * @brief 批量操作的骨架：每 BATCH_CHUNK_SIZE 个键一组，计算哈希值和桶下标并预取桶，
+     *        按锁分片排序后预取链表头，同一分片的键只加一次锁
+     *        加锁后桶已经被分裂或合并的键，解锁后再逐个按单键的方式处理
+     * 
+     * @param first 
+     * @param count 
+     * @param exclusive 是否加写锁
+     * @param op 对每个键调用 op(pos, hash_val, bucket)，调用时桶已加锁
+     */
+    template <typename KeyIt, typename Op>
+    void batch_apply(KeyIt first, size_t count, bool exclusive, Op op) const {
+        BatchSlot slots[BATCH_CHUNK_SIZE];
+        size_t deferred[BATCH_CHUNK_SIZE];
+        for (size_t begin = 0; begin < count; begin += BATCH_CHUNK_SIZE) {
+            size_t chunk = count - begin < BATCH_CHUNK_SIZE ? count - begin : BATCH_CHUNK_SIZE;
+            uint64_t layout = layout_.load(std::memory_order_acquire);
+            for (size_t i = 0; i < chunk; ++i) {
+                size_t hash_val = hash_of(first[begin + i]);
+                size_t index = bucket_index_of(hash_val, layout);
+                __builtin_prefetch(bucket_at_index(index));
+                // 插入排序，按锁分片、再按输入位置排列，同一个键的多次操作保持输入顺序
+                size_t j = i;
+                for (; j > 0 && stripe_at_index(slots[j - 1].index) > stripe_at_index(index); --j) {
+                    slots[j] = slots[j - 1];
+                }
+                slots[j] = BatchSlot{hash_val, index, begin + i};
+            }
+            for (size_t i = 0; i < chunk; ++i) {
+                bucket_at_index(slots[i].index)->prefetch();
+            }
+            size_t deferred_count = 0;
+            for (size_t i = 0; i < chunk;) {
+                LockStripe<L>* stripe = stripe_at_index(slots[i].index);
+                if (exclusive) {
+                    stripe->wrlock();
+                } else {
+                    stripe->rdlock();
+                }
+                for (; i < chunk && stripe_at_index(slots[i].index) == stripe; ++i) {
+                    B* bucket = bucket_at_index(slots[i].index);
+                    size_t hi = div_base(slots[i].hash_val);
+                    if (!bucket->live_ || (hi & level_mask(bucket->level_)) != div_base(slots[i].index)) {
+                        deferred[deferred_count++] = i;
+                        continue;
+                    }
+                    if (exclusive) {
+                        bucket->begin_write();
+                    }
+                    try {
+                        op(slots[i].pos, slots[i].hash_val, bucket);
+                    } catch (...) {
+                        unlock_bucket(bucket, stripe, exclusive);
+                        throw;
+                    }
+                    if (exclusive) {
+                        bucket->end_write();
+                    }
+                }
+                stripe->unlock();
+            }
+            for (size_t i = 0; i < deferred_count; ++i) {
+                const BatchSlot& slot = slots[deferred[i]];
+                LockStripe<L>* stripe = nullptr;
+                B* bucket = lock_bucket(slot.hash_val, exclusive, &stripe);
+                try {
+                    op(slot.pos, slot.hash_val, bucket);
+                } catch (...) {
+                    unlock_bucket(bucket, stripe, exclusive);
+                    throw;
+                }
+                unlock_bucket(bucket, stripe, exclusive);
+            }
+        }
+    }
+
+    // 桶的分布由 (level, split) 描述：桶数为 B * 2^level + split
+    // 下标小于 split 的桶已经分裂过，需要按 level + 1 寻址
+    // 两者打包在一个原子变量中，保证读取到的是一致的快照
+    static uint64_t pack_layout(size_t level, size_t split) {
+        return (static_cast<uint64_t>(level) << 56) | split;
+    }
+    static size_t layout_level(uint64_t layout) {
+        return static_cast<size_t>(layout >> 56);
+    }
+    static size_t layout_split(uint64_t layout) {
+        return static_cast<size_t>(layout & ((static_cast<uint64_t>(1) << 56) - 1));
+    }
+    static size_t level_mask(size_t level) {
+        return (static_cast<size_t>(1) << level) - 1;
+    }
+
+    /**
+     * @brief 按桶分布的快照计算哈希值所在的桶下标，不加锁时只是一个提示，加锁后需要校验
+     * 
+     * @param hash_val 
+     * @param layout 
+     * @return size_t 
+     */
+    size_t bucket_index_of(size_t hash_val, uint64_t layout) const {
+        size_t hi = div_base(hash_val);
+        size_t lo = mod_base(hash_val);
+        size_t level = layout_level(layout);
+        size_t slot_hi = hi & level_mask(level);
+        if (base_bucket_size_ * slot_hi + lo < layout_split(layout)) {
+            slot_hi = hi & level_mask(level + 1);
+        }
+        return base_bucket_size_ * slot_hi + lo;
+    }
+
+    /**
+     * @brief 获取桶
+     *        桶的下标为 B * slot_hi + lo，其中 lo < B，slot_hi 的最高位决定桶所在的段
+     * 
+     * @param slot_hi 
+     * @param lo 
+     * @return B* 
+     */
+    B* bucket_at(size_t slot_hi, size_t lo) const {
+        if (slot_hi == 0) {
+            return segments_[0].load(std::memory_order_acquire) + lo;
+        }
+        size_t segment = 64 - __builtin_clzll(slot_hi);
+        size_t segment_first = static_cast<size_t>(1) << (segment - 1);
+        return segments_[segment].load(std::memory_order_acquire)
+            + base_bucket_size_ * (slot_hi - segment_first) + lo;
+    }
+
+    // 桶数的分解 x = B * div_base(x) + mod_base(x)，B 是 2 的幂时用移位和掩码
+    size_t div_base(size_t x) const {
+        return base_pow2_ ? x >> base_shift_ : x / base_bucket_size_;
+    }
+
+    size_t mod_base(size_t x) const {
+        return base_pow2_ ? x & (base_bucket_size_ - 1) : x % base_bucket_size_;
+    }
+
+    // 键的哈希值，B 是 2 的幂时经过混合，所有的操作都使用此函数计算哈希值
+    template <typename Q>
+    size_t hash_of(const Q& key) const {
+        size_t hash_val = hash_fn_(key);
+        return base_pow2_ ? mix_hash(hash_val) : hash_val;
+    }
+
+    // 元素的哈希值，元素缓存了哈希值时直接读取，否则重新计算
+    size_t node_hash(const typename B::node_type& node) const {
+        return node_hash(node, std::integral_constant<bool, B::node_type::kStoresHash>());
+    }
+
+    size_t node_hash(const typename B::node_type& node, std::true_type) const {
+        return node.get_hash();
+    }
+
+    size_t node_hash(const typename B::node_type& node, std::false_type) const {
+        return hash_of(node.get_key());
+    }
+
+    B* bucket_at_index(size_t index) const {
+        return bucket_at(div_base(index), mod_base(index));
+    }
+
+    // 桶的下标在桶的生命周期内不变，因此保护它的锁分片也不变
+    LockStripe<L>* stripe_at_index(size_t index) const {
+        return stripes_ + (index & (stripe_count_ - 1));
+    }
+
+    /**
+     * @brief 定位哈希值所在的桶并加锁
+     *        加锁后需要校验桶的分裂层级，如果在加锁前桶被分裂或者合并了，则重新定位
+     *        加写锁时桶的版本号同时变为奇数
+     * 
+     * @param hash_val 
+     * @param exclusive 是否加写锁
+     * @param stripe 返回加锁的分片，解锁时传给 unlock_bucket
+     * @return B* 已加锁的桶
+     */
+    B* lock_bucket(size_t hash_val, bool exclusive, LockStripe<L>** stripe) const {
+        // 哈希值对 B * 2^level 取模，等于 B * (hi % 2^level) + lo
+        size_t hi = div_base(hash_val);
+        size_t lo = mod_base(hash_val);
+        for (;;) {
+            uint64_t layout = layout_.load(std::memory_order_acquire);
+            size_t level = layout_level(layout);
+            size_t slot_hi = hi & level_mask(level);
+            if (base_bucket_size_ * slot_hi + lo < layout_split(layout)) {
+                slot_hi = hi & level_mask(level + 1);
+            }
+            B* bucket = bucket_at(slot_hi, lo);
+            LockStripe<L>* bucket_stripe = stripe_at_index(base_bucket_size_ * slot_hi + lo);
+            if (exclusive) {
+                bucket_stripe->wrlock();
+            } else {
+                bucket_stripe->rdlock();
+            }
+            if (bucket->live_ && (hi & level_mask(bucket->level_)) == slot_hi) {
+                if (exclusive) {
+                    bucket->begin_write();
+                }
+                *stripe = bucket_stripe;
+                return bucket;
+            }
+            bucket_stripe->unlock();
+        }
+    }
+
+    /**
+     * @brief 解锁 lock_bucket 返回的桶
+     * 
+     * @param bucket 
+     * @param stripe 
+     * @param exclusive 是否持有写锁
+     */
+    void unlock_bucket(B* bucket, LockStripe<L>* stripe, bool exclusive) const {
+        if (exclusive) {
+            bucket->end_write();
+        }
+        stripe->unlock();
+    }
+
+    /**
+     * @brief 给分裂或合并涉及的两个桶加写锁
+     *        两个桶可能落在同一个分片上，此时只加一次锁；否则总是先锁下标小的分片，避免死锁
+     * 
+     * @param first_index 
+     * @param second_index 
+     */
+    void lock_bucket_pair(size_t first_index, size_t second_index) {
+        LockStripe<L>* first = stripe_at_index(first_index);
+        LockStripe<L>* second = stripe_at_index(second_index);
+        if (first > second) {
+            std::swap(first, second);
+        }
+        first->wrlock();
+        if (second != first) {
+            second->wrlock();
+        }
+        bucket_at_index(first_index)->begin_write();
+        bucket_at_index(second_index)->begin_write();
+    }
+
+    void unlock_bucket_pair(size_t first_index, size_t second_index) {
+        bucket_at_index(second_index)->end_write();
+        bucket_at_index(first_index)->end_write();
+        LockStripe<L>* first = stripe_at_index(first_index);
+        LockStripe<L>* second = stripe_at_index(second_index);
+        if (second != first) {
+            second->unlock();
+        }
+        first->unlock();
+    }
+
+    /**
+     * @brief 元素个数变化后，定期检查负载因子
+     * 
+     * @param delta 
+     */
+    void on_size_changed(int64_t delta) {
+        if (delta == 0) {
+            return;
+        }
+        record(delta > 0 ? kStatsNodeAlloc : kStatsNodeFree, static_cast<uint64_t>(delta > 0 ? delta : -delta));
+        // 批量操作一次变化多个，跨过 RESIZE_CHECK_INTERVAL 的整数倍就检查
+        int64_t after = size_counter_.add(delta);
+        if (after % RESIZE_CHECK_INTERVAL == 0
+            || after / RESIZE_CHECK_INTERVAL != (after - delta) / RESIZE_CHECK_INTERVAL) {
+            maybe_resize();
+        }
+    }
+
+    /**
+     * @brief 根据负载因子扩容或者缩容，每次最多迁移 MIGRATE_BUCKET_STEP 个桶
+     *        同一时刻只有一个线程在迁移，其他线程拿不到锁直接返回
+     */
+    void maybe_resize() {
+        std::unique_lock<std::mutex> resize_guard(resize_mutex_, std::try_to_lock);
+        if (!resize_guard.owns_lock() || scan_count_.load(std::memory_order_relaxed) != 0) {
+            return;
+        }
+        double element_size = static_cast<double>(size());
+        float max_load_factor = max_load_factor_.load(std::memory_order_relaxed);
+        for (size_t step = 0; step < MIGRATE_BUCKET_STEP; ++step) {
+            size_t bucket_size = bucket_count();
+            if (element_size > static_cast<double>(bucket_size) * max_load_factor) {
+                if (!split_one_bucket()) break;
+            } else if (bucket_size > base_bucket_size_ && bucket_size > reserved_bucket_size_
+                && element_size < static_cast<double>(bucket_size) * max_load_factor / 4) {
+                merge_one_bucket();
+            } else {
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief 分配一段 count 个桶的内存，指定了 NUMA 节点时放在该节点上
+     *        以 mmap 分配且不构造，桶在第一次分裂出来时才构造，段中还没有用到的部分不占用物理内存；
+     *        每一段的桶数等于此前所有段之和，如果分配时就构造整段，刚进入新的一段时桶数组占用的内存就会翻倍
+     * 
+     * @param count 
+     * @return B* 
+     */
+    B* new_segment(size_t count) {
+        static_assert(alignof(B) <= 4096, "bucket engines must not be page over-aligned");
+        B* segment = static_cast<B*>(numa_alloc(sizeof(B) * count, numa_node_));
+        if (segment == nullptr) {
+            throw std::bad_alloc();
+        }
+        return segment;
+    }
+
+    // 析构段中已经构造的桶并释放，first_index 是段中第一个桶的下标
+    void delete_segment(B* segment, size_t first_index, size_t count) {
+        if (segment == nullptr) {
+            return;
+        }
+        for (size_t i = 0; i < count && first_index + i < constructed_bucket_size_; ++i) {
+            segment[i].~B();
+        }
+        numa_free(segment, sizeof(B) * count);
+    }
+
+    /**
+     * @brief 分裂 split 指向的桶，需要持有 resize_mutex_
+     * 
+     * @return true 分裂成功
+     * @return false 桶的数量已经达到上限
+     */
+    bool split_one_bucket() {
+        uint64_t layout = layout_.load(std::memory_order_relaxed);
+        size_t level = layout_level(layout);
+        size_t split = layout_split(layout);
+        if (level + 2 >= MAX_BUCKET_SEGMENT_COUNT) {
+            return false;
+        }
+        // 新桶位于第 level + 1 段，第一次用到时分配
+        if (segments_[level + 1].load(std::memory_order_relaxed) == nullptr) {
+            segments_[level + 1].store(new_segment(base_bucket_size_ << level), std::memory_order_release);
+        }
+        size_t slot_hi = div_base(split);
+        size_t lo = mod_base(split);
+        size_t new_slot_hi = slot_hi | (static_cast<size_t>(1) << level);
+        B* bucket = bucket_at(slot_hi, lo);
+        B* new_bucket = bucket_at(new_slot_hi, lo);
+        size_t new_index = base_bucket_size_ * new_slot_hi + lo;
+        // 桶按下标顺序分裂出来，已经构造过的桶（合并后再次分裂）不再构造
+        if (new_index == constructed_bucket_size_) {
+            new (new_bucket) B();
+            ++constructed_bucket_size_;
+        }
+        lock_bucket_pair(split, new_index);
+        bucket->split_to(new_bucket, [&](const typename B::node_type& node) {
+            return (div_base(node_hash(node)) & level_mask(level + 1)) == new_slot_hi;
+        });
+        bucket->level_ = level + 1;
+        new_bucket->level_ = level + 1;
+        new_bucket->live_ = true;
+        if (split + 1 == (base_bucket_size_ << level)) {
+            layout_.store(pack_layout(level + 1, 0), std::memory_order_release);
+        } else {
+            layout_.store(pack_layout(level, split + 1), std::memory_order_release);
+        }
+        unlock_bucket_pair(split, new_index);
+        return true;
     }
 
     /**
-     * @brief 删除某个键
+     * @brief 把最后一个桶合并回它分裂前的桶，需要持有 resize_mutex_
      * 
-     * @param key 
      */
-    void erase(const K& key) {
-        size_t hash_val = hash_fn_(key) % hash_bucket_size_;
-        hash_table_[hash_val].erase(key);
+    void merge_one_bucket() {
+        uint64_t layout = layout_.load(std::memory_order_relaxed);
+        size_t level = layout_level(layout);
+        size_t split = layout_split(layout);
+        if (level == 0 && split == 0) {
+            return;
+        }
+        if (split > 0) {
+            split = split - 1;
+        } else {
+            level = level - 1;
+            split = (base_bucket_size_ << level) - 1;
+        }
+        size_t slot_hi = div_base(split);
+        size_t lo = mod_base(split);
+        size_t old_slot_hi = slot_hi | (static_cast<size_t>(1) << level);
+        size_t old_index = base_bucket_size_ * old_slot_hi + lo;
+        B* bucket = bucket_at(slot_hi, lo);
+        B* old_bucket = bucket_at(old_slot_hi, lo);
+        lock_bucket_pair(split, old_index);
+        bucket->merge_from(old_bucket);
+        bucket->level_ = level;
+        old_bucket->live_ = false;
+        layout_.store(pack_layout(level, split), std::memory_order_release);
+        unlock_bucket_pair(split, old_index);
+    }
+
+private:
+    // 哈希桶，按段分配，段一旦分配就不会移动，因此扩容时无需搬迁整个数组
+    std::atomic<B*> segments_[MAX_BUCKET_SEGMENT_COUNT];
+    // 桶的分布 (level, split)
+    std::atomic<uint64_t> layout_;
+    // 初始桶的个数
+    size_t base_bucket_size_;
+    // 初始桶数是否为 2 的幂，以及此时的位数
+    bool base_pow2_;
+    size_t base_shift_;
+    // 锁分片，个数为 2 的幂
+    LockStripe<L>* stripes_;
+    size_t stripe_count_;
+    // 桶和锁分片所在的 NUMA 节点，-1 表示不指定
+    int numa_node_;
+    // 最大负载因子
+    std::atomic<float> max_load_factor_;
+    // 元素个数
+    StripedCounter size_counter_;
+#ifdef CONCURRENT_HASH_MAP_STATS
+    // 操作次数的统计
+    mutable StatsCounters stats_counters_;
+#endif
+    // 扩缩容的互斥锁，保证同一时刻只有一个线程在迁移桶
+    std::mutex resize_mutex_;
+    // 正在进行的遍历数，不为 0 时暂停扩缩容，在 resize_mutex_ 下增加
+    std::atomic<size_t> scan_count_{0};
+    // reserve 预留的桶数，自动缩容不会低于此值，在 resize_mutex_ 下访问
+    size_t reserved_bucket_size_ = 0;
+    // 已经构造的桶数，下标小于此值的桶都已构造，在 resize_mutex_ 下访问
+    size_t constructed_bucket_size_ = 0;
+    // 哈希函数
+    F hash_fn_;
+    // 键的相等比较
+    E key_eq_;
+    // 变更的订阅者，在桶的写锁下读取
+    std::atomic<ChangeFeed<K, V>*> change_feed_{nullptr};
+    friend class ConstIterator<K, V, F, B, E, L>;
+    friend class SnapshotIterator<K, V, F, B, E, L>;
+};
+
+/**
+ * @brief 哈希桶的公共部分：线性哈希需要的分裂层级以及版本号
+ *        各种存储引擎的桶都继承于此，桶本身不含锁，
+ *        由 ConcurrentHashMap 在调用前给桶所在的锁分片加锁，加锁后再校验桶的分裂层级
+ * 
+ *        版本号（seqlock）：持有写锁修改桶期间版本号为奇数，每次写操作结束版本号加 2，
+ *        不加锁的读操作在读前读后比较版本号，版本号不变说明期间没有写操作，读到的数据是一致的
+ *        版本号按桶维护，同一分片中其他桶的写操作不会让读者重试
+ */
+class HashBucketBase {
+public:
+    HashBucketBase() = default;
+    HashBucketBase(const HashBucketBase&) = delete;
+    HashBucketBase& operator=(const HashBucketBase&) = delete;
+    HashBucketBase(HashBucketBase&&) = delete;
+    HashBucketBase& operator=(HashBucketBase&&) = delete;
+
+public:
+    // 加写锁后开始修改，版本号变为奇数
+    void begin_write() {
+        version_.store(version_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    // 修改结束，版本号变回偶数
+    void end_write() {
+        version_.store(version_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
     }
 
     /**
-     * @brief 清空哈希表
+     * @brief 不加锁读之前获取版本号，奇数表示正在写
      * 
+     * @return uint32_t 
      */
-    void clear() {
-        for (size_t i = 0; i < hash_bucket_size_; ++i) {
-            hash_table_[i].clear();
-        }
+    uint32_t read_version() const {
+        return version_.load(std::memory_order_acquire);
     }
 
     /**
-     * @brief 获取迭代器
+     * @brief 不加锁读之后校验版本号，没有变化说明读到的数据有效
      * 
-     * @return ConstIterator 
+     * @param version read_version 的返回值
+     * @return true 
+     * @return false 
      */
-    ConstIterator<K, V> get_iterator() {
-        return ConstIterator<K, V>(this);
+    bool validate(uint32_t version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return version_.load(std::memory_order_relaxed) == version;
     }
 
+public:
+    // 桶的分裂层级，桶的下标等于哈希值对 B * 2^level_ 取模
+    std::atomic<size_t> level_{0};
+    // 桶是否在使用中，未分裂出来的桶和被合并掉的桶不在使用中
+    std::atomic<bool> live_{false};
+
 private:
-    // 哈希桶，以数组的形式实现
-    HashBucket<K, V>* hash_table_;
-    // 哈希函数
-    F hash_fn_;
-    // 哈希桶的个数
-    size_t hash_bucket_size_;
-    friend class ConstIterator<K, V>;
+    // 版本号
+    std::atomic<uint32_t> version_{0};
 };
 
 /**
  * @brief 哈希桶的实现
  *        每个桶是以一个单链表的形式实现
+ *        下面的操作都需要调用者持有桶的锁，hash_val 参数留给需要哈希值的存储引擎使用
+ * 
+ *        删除的节点交给回收策略 R 释放，默认基于 epoch 延迟释放，
+ *        不加锁的读者和迭代器在进入临界区后访问到的节点不会被释放
+ *        节点的键在节点的生命周期内不会修改，V 是平凡可复制的类型且延迟释放时，支持不加锁的乐观读（try_find）：
+ *        读到一半被修改的值最多是内容不一致，会被版本号校验发现
+ *        节点的内存由分配器 A 管理，默认使用线程本地缓存的节点池，分配器需要是无状态的
  * 
  * @tparam K 
  * @tparam V 
+ * @tparam R 节点的回收策略，EpochReclaimer 或者 ImmediateReclaimer
+ * @tparam A 节点的分配器，会被 rebind 到 HashNode<K, V>，例如 NodePoolAllocator、std::allocator
  */
-template <typename K, typename V>
-class HashBucket {
+template <typename K, typename V, typename R, typename A>
+class HashBucket : public HashBucketBase {
 public:
-    HashBucket() {
-        pthread_rwlock_init(&rw_lock_, nullptr);
-    }
+    // 迭代器访问的元素类型
+    typedef HashNode<K, V> node_type;
+    // 节点的回收策略
+    typedef R reclaimer_type;
+    // 节点的分配器
+    typedef typename std::allocator_traits<A>::template rebind_alloc<HashNode<K, V>> allocator_type;
+    // 是否支持不加锁的乐观读，乐观读先把值读到一个临时变量中，要求 V 可以默认构造
+    static constexpr bool kOptimisticRead = std::is_trivially_copyable<V>::value
+        && std::is_default_constructible<V>::value && R::kDeferred;
+
+    HashBucket() = default;
     ~HashBucket() {
-        clear();
-        pthread_rwlock_destroy(&rw_lock_);
+        // 析构时不会再有读者，直接释放
+        HashNode<K, V>* node = head_.load(std::memory_order_relaxed);
+        for (; node != nullptr;) {
+            HashNode<K, V>* next = node->next_.load(std::memory_order_relaxed);
+            destroy_node(node);
+            node = next;
+        }
     }
-    HashBucket(const HashBucket&) = delete;
-    HashBucket& operator=(const HashBucket&) = delete;
-    HashBucket(HashBucket&&) = delete;
-    HashBucket& operator=(HashBucket&&) = delete;
 
 public:
     /**
-     * @brief 查找某个键值，返回 bool 值
-     *        如果存在，则给 value 赋值
+     * @brief 默认的最大负载因子
+     * 
+     * @return float 
+     */
+    static float default_max_load_factor() {
+        return DEFAULT_MAX_LOAD_FACTOR;
+    }
+
+    /**
+     * @brief 查找某个键所在的节点，需要持有锁
      * 
      * @param key 
-     * @param value 
-     * @return true 
-     * @return false 
+     * @param eq 键的相等比较，以 eq(节点的键, key) 调用
+     * @return node_type* 不存在时返回 nullptr
      */
-    bool find(const K& key, V& value) {
-        // 加读锁
-        pthread_rwlock_rdlock(&rw_lock_);
-        HashNode<K, V>* node = head_;
+    template <typename Q, typename E>
+    node_type* find_node(size_t hash_val, const Q& key, const E& eq) const {
+        HashNode<K, V>* node = head_.load(std::memory_order_relaxed);
         for (; node != nullptr;) {
-            if (node->get_key() == key) {
-                value = node->get_value();
-                pthread_rwlock_unlock(&rw_lock_);
-                return true;
+            if (node->matches(hash_val, key, eq)) {
+                return node;
             }
-            node = node->next_;
+            node = node->next_.load(std::memory_order_relaxed);
         }
-        pthread_rwlock_unlock(&rw_lock_);
-        return false;
+        return nullptr;
     }
 
     /**
-     * @brief 插入一对键值
+     * @brief 不加锁查找某个键值，只在 kOptimisticRead 时可用
+     *        每前进一个节点都检查一次版本号，一旦有写操作立即放弃，不会在被修改的链表上打转
      * 
+     * @param version 查找前通过 read_version 获取的版本号
+     * @param hash_val 
      * @param key 
+     * @param eq 
      * @param value 
+     * @param is_exist 查找结果
+     * @return true 读取过程中没有写操作，查找结果有效
+     * @return false 读取过程中有写操作，需要重试
      */
-    void insert(const K& key, const V& value) {
-        // 加写锁
-        pthread_rwlock_wrlock(&rw_lock_);
-        HashNode<K, V>* prev = nullptr, *node = head_;
-        for (; node != nullptr && node->get_key() != key;) {
-            prev = node;
-            node = node->next_;
-        }
-        // 此时有两种情况
-        // 1. head_ 本身为空
-        // 2. head_ 链表遍历完也没有发现 key，此时 node 指向尾节点的 next，为空，prev 指向尾节点
-        if (node == nullptr) {
-            if (head_ == nullptr) {
-                head_ = new HashNode<K, V>(key, value);
-            } else {
-                prev->next_ = new HashNode<K, V>(key, value);
+    template <typename Q, typename E>
+    bool try_find(uint32_t version, size_t hash_val, const Q& key, const E& eq, V& value, bool& is_exist) const {
+        is_exist = false;
+        HashNode<K, V>* node = head_.load(std::memory_order_acquire);
+        for (; node != nullptr;) {
+            if (node->matches(hash_val, key, eq)) {
+                value = node->get_value();
+                is_exist = true;
+                break;
+            }
+            node = node->next_.load(std::memory_order_acquire);
+            if (read_version() != version) {
+                return false;
             }
-        } else {
-            // 桶中存在 key，直接修改
-            node->set_value(value);
         }
-        pthread_rwlock_unlock(&rw_lock_);
+        return validate(version);
     }
 
     /**
-     * @brief 插入一对键值，如果键存在，则增加值
+     * @brief 不检查重复，直接在链表头插入新节点，调用者保证 key 不在桶中，需要持有写锁
      * 
      * @param key 
-     * @param value 
+     * @param args 转发给值的构造函数
      */
-    void insert_and_inc(const K& key, const V& value) {
-        // 加写锁
-        pthread_rwlock_wrlock(&rw_lock_);
-        HashNode<K, V>* prev = nullptr, *node = head_;
-        for (; node != nullptr && node->get_key() != key;) {
+    template <typename KArg, typename... Args>
+    void insert_unique(size_t hash_val, KArg&& key, Args&&... args) {
+        HashNode<K, V>* node = new_node(hash_val, std::forward<KArg>(key), std::forward<Args>(args)...);
+        node->next_.store(head_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        head_.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief 不加锁查找某个键所在的节点，只在延迟释放节点时可用，检查版本号的方式同 try_find
+     * 
+     * @tparam Q 
+     * @tparam E 
+     * @param version 
+     * @param hash_val 
+     * @param key 
+     * @param eq 
+     * @param node 查找结果，不存在时为 nullptr
+     * @return true 读取过程中没有写操作，查找结果有效
+     * @return false 读取过程中有写操作，需要重试
+     */
+    template <typename Q, typename E>
+    bool try_find_node(uint32_t version, size_t hash_val, const Q& key, const E& eq, node_type*& node) const {
+        node = head_.load(std::memory_order_acquire);
+        for (; node != nullptr && !node->matches(hash_val, key, eq);) {
+            node = node->next_.load(std::memory_order_acquire);
+            if (read_version() != version) {
+                return false;
+            }
+        }
+        return validate(version);
+    }
+
+    /**
+     * @brief 键不存在时用 key 和 args 原地构造新节点，键存在时对值调用 update，需要持有写锁
+     * 
+     * @param key 键，只在新建节点时转发给节点的构造函数
+     * @param eq 
+     * @param update 以 update(V&) 调用
+     * @param args 转发给值的构造函数
+     * @return true 新插入了节点
+     * @return false 键已存在，调用了 update
+     */
+    template <typename E, typename KArg, typename U, typename... Args>
+    bool upsert(size_t hash_val, KArg&& key, const E& eq, U&& update, Args&&... args) {
+        HashNode<K, V>* prev = nullptr, *node = head_.load(std::memory_order_relaxed);
+        for (; node != nullptr && !node->matches(hash_val, key, eq);) {
             prev = node;
-            node = node->next_;
+            node = node->next_.load(std::memory_order_relaxed);
         }
         // 此时有两种情况
         // 1. head_ 本身为空
         // 2. head_ 链表遍历完也没有发现 key，此时 node 指向尾节点的 next，为空，prev 指向尾节点
         if (node == nullptr) {
-            if (head_ == nullptr) {
-                head_ = new HashNode<K, V>(key, value);
+            node = new_node(hash_val, std::forward<KArg>(key), std::forward<Args>(args)...);
+            if (prev == nullptr) {
+                head_.store(node, std::memory_order_release);
             } else {
-                prev->next_ = new HashNode<K, V>(key, value);
+                prev->next_.store(node, std::memory_order_release);
             }
-        } else {
-            // 桶中存在 key，给他增加
-            node->get_value() += value;
+            return true;
         }
-        pthread_rwlock_unlock(&rw_lock_);
+        // 桶中存在 key，原地修改
+        update(node->get_value());
+        return false;
     }
 
     /**
-     * @brief 删除某个键值
+     * @brief 删除某个键值，需要持有写锁
      * 
      * @param key 
+     * @param eq 
+     * @return true 删除成功
+     * @return false key 不存在
      */
-    void erase(const K& key) {
-        // 加写锁
-        pthread_rwlock_wrlock(&rw_lock_);
-        HashNode<K, V>* prev = nullptr, *node = head_;
-        for (; node != nullptr && node->get_key() != key;) {
+    template <typename Q, typename E>
+    bool erase(size_t hash_val, const Q& key, const E& eq) {
+        HashNode<K, V>* prev = nullptr, *node = head_.load(std::memory_order_relaxed);
+        for (; node != nullptr && !node->matches(hash_val, key, eq);) {
             prev = node;
-            node = node->next_;
+            node = node->next_.load(std::memory_order_relaxed);
         }
         // key 没有找到，直接返回
         if (node == nullptr) {
-            pthread_rwlock_unlock(&rw_lock_);
-            return;
+            return false;
+        }
+        // 找到 key，分情况处理
+        // 修改链表指针都使用 release，不加锁的读者沿着指针访问到的节点都已经完整构造
+        // 1. 如果此节点是头节点 2. 如果此节点不是头节点
+        HashNode<K, V>* next = node->next_.load(std::memory_order_relaxed);
+        if (prev == nullptr) {
+            head_.store(next, std::memory_order_release);
         } else {
-            // 找到 key，分情况处理
-            // 1. 如果此节点是头节点 2. 如果此节点不是头节点
-            if (head_ == node) {
-                head_ = node->next_;
+            prev->next_.store(next, std::memory_order_release);
+        }
+        delete_node(node);
+        return true;
+    }
+
+    /**
+     * @brief 删除满足条件的节点，需要持有写锁
+     * 
+     * @param pred 以 pred(node_type&) 判断节点是否需要删除
+     * @return size_t 删除的节点个数
+     */
+    template <typename P>
+    size_t erase_if(P pred) {
+        size_t count = 0;
+        HashNode<K, V>* prev = nullptr, *node = head_.load(std::memory_order_relaxed);
+        for (; node != nullptr;) {
+            HashNode<K, V>* next = node->next_.load(std::memory_order_relaxed);
+            if (pred(*node)) {
+                if (prev == nullptr) {
+                    head_.store(next, std::memory_order_release);
+                } else {
+                    prev->next_.store(next, std::memory_order_release);
+                }
+                delete_node(node);
+                ++count;
             } else {
-                prev->next_ = node->next_;
+                prev = node;
             }
-            delete node;
+            node = next;
         }
-        pthread_rwlock_unlock(&rw_lock_);
+        return count;
     }
 
     /**
-     * @brief 清理桶中所有元素
+     * @brief 清理桶中所有元素，需要持有写锁
      * 
+     * @return size_t 删除的元素个数
      */
-    void clear() {
-        // 加写锁
-        pthread_rwlock_wrlock(&rw_lock_);
-        HashNode<K, V>* prev = nullptr, *node = head_;
+    size_t clear() {
+        size_t count = 0;
+        HashNode<K, V>* prev = nullptr, *node = head_.load(std::memory_order_relaxed);
         for (; node != nullptr;) {
             prev = node;
-            node = node->next_;
-            delete prev;
+            node = node->next_.load(std::memory_order_relaxed);
+            delete_node(prev);
+            ++count;
         }
-        head_ = nullptr;
-        pthread_rwlock_unlock(&rw_lock_);
+        head_.store(nullptr, std::memory_order_relaxed);
+        return count;
+    }
+
+    /**
+     * @brief 把满足条件的节点迁移到另一个桶，用于桶的分裂，需要持有两个桶的写锁
+     * 
+     * @param other 新桶
+     * @param should_move 以 should_move(const node_type&) 判断节点是否需要迁移
+     */
+    template <typename P>
+    void split_to(HashBucket* other, P should_move) {
+        HashNode<K, V>* prev = nullptr, *node = head_.load(std::memory_order_relaxed);
+        for (; node != nullptr;) {
+            HashNode<K, V>* next = node->next_.load(std::memory_order_relaxed);
+            if (should_move(*node)) {
+                if (prev == nullptr) {
+                    head_.store(next, std::memory_order_release);
+                } else {
+                    prev->next_.store(next, std::memory_order_release);
+                }
+                node->next_.store(other->head_.load(std::memory_order_relaxed), std::memory_order_release);
+                other->head_.store(node, std::memory_order_release);
+            } else {
+                prev = node;
+            }
+            node = next;
+        }
+    }
+
+    /**
+     * @brief 把另一个桶的所有节点并入此桶，用于桶的合并，需要持有两个桶的写锁
+     * 
+     * @param other 被合并的桶
+     */
+    void merge_from(HashBucket* other) {
+        HashNode<K, V>* node = other->head_.load(std::memory_order_relaxed);
+        if (node == nullptr) {
+            return;
+        }
+        for (; node->next_.load(std::memory_order_relaxed) != nullptr;) {
+            node = node->next_.load(std::memory_order_relaxed);
+        }
+        node->next_.store(head_.load(std::memory_order_relaxed), std::memory_order_release);
+        head_.store(other->head_.load(std::memory_order_relaxed), std::memory_order_release);
+        other->head_.store(nullptr, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 批量操作加锁前预取链表的第一个节点，不需要持有锁
+     */
+    void prefetch() const {
+        __builtin_prefetch(head_.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief 获取桶中第一个元素，用于迭代
+     *        与插入的 release 配对，不加锁的迭代器在回收策略的临界区内也可以调用
+     * 
+     * @return node_type* 
+     */
+    node_type* first() const {
+        return head_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 获取桶中下一个元素，用于迭代，不加锁时同 first
+     * 
+     * @param node 
+     * @return node_type* 
+     */
+    node_type* next(node_type* node) const {
+        return node->next_.load(std::memory_order_acquire);
+    }
+
+private:
+    // 创建节点，key 和 args 分别转发给键和值的构造函数
+    template <typename KArg, typename... Args>
+    HashNode<K, V>* new_node(size_t hash_val, KArg&& key, Args&&... args) {
+        allocator_type alloc;
+        HashNode<K, V>* node = alloc.allocate(1);
+        try {
+            new (node) HashNode<K, V>(std::piecewise_construct, hash_val, std::forward<KArg>(key),
+                std::forward<Args>(args)...);
+        } catch (...) {
+            alloc.deallocate(node, 1);
+            throw;
+        }
+        return node;
+    }
+
+    // 删除节点，交给回收策略，不加锁的读者可能还在访问它
+    void delete_node(HashNode<K, V>* node) {
+        R::retire(node, &HashBucket::destroy_node);
+    }
+
+    static void destroy_node(void* ptr) {
+        HashNode<K, V>* node = static_cast<HashNode<K, V>*>(ptr);
+        node->~HashNode();
+        allocator_type alloc;
+        alloc.deallocate(node, 1);
     }
 
 public:
     // 桶中单链表的头节点
-    HashNode<K, V>* head_ = nullptr;
+    std::atomic<HashNode<K, V>*> head_{nullptr};
+};
+
+/**
+ * @brief 节点中是否缓存键的哈希值，默认对整数、枚举、指针以外的键缓存
+ *        缓存后比较键之前先比较哈希值，长字符串等比较代价高的键几乎只在命中时才比较完整的键；
+ *        桶分裂时直接使用缓存的哈希值，不需要重新计算。代价是每个元素多占 sizeof(size_t) 字节
+ *        可以对自定义的键类型特化此模板
+ * 
+ * @tparam K 
+ */
+template <typename K>
+struct StoreHash : std::integral_constant<bool, !std::is_arithmetic<K>::value && !std::is_enum<K>::value
+                                                && !std::is_pointer<K>::value> {};
+
+/**
+ * @brief 节点缓存的哈希值，Store 为 false 时是空类，不占空间，哈希值的比较总是成立
+ * 
+ * @tparam Store 
+ */
+template <bool Store>
+class CachedHash {
+public:
+    static constexpr bool kStoresHash = true;
+
+    explicit CachedHash(size_t hash_val) : hash_(hash_val) {}
+
+    size_t get_hash() const {
+        return hash_;
+    }
+
+    bool hash_equals(size_t hash_val) const {
+        return hash_ == hash_val;
+    }
 
 private:
-    // 读写锁
-    pthread_rwlock_t rw_lock_;
+    size_t hash_;
+};
+
+template <>
+class CachedHash<false> {
+public:
+    static constexpr bool kStoresHash = false;
+
+    explicit CachedHash(size_t) {}
+
+    bool hash_equals(size_t) const {
+        return true;
+    }
 };
 
 /**
@@ -297,12 +2858,21 @@ private:
  * @tparam V 
  */
 template <typename K, typename V>
-class HashNode {
+class HashNode : public CachedHash<StoreHash<K>::value> {
 public:
-    HashNode() = default;
-    HashNode(K key, V value) : key_(key), value_(value) {}
+    /**
+     * @brief 分段构造，key 转发给键的构造函数，args 转发给值的构造函数
+     * 
+     * @param hash_val 键的哈希值，StoreHash<K> 为 true 时缓存在节点中
+     * @param key 
+     * @param args 
+     */
+    template <typename KArg, typename... Args>
+    HashNode(std::piecewise_construct_t, size_t hash_val, KArg&& key, Args&&... args)
+        : CachedHash<StoreHash<K>::value>(hash_val), key_(std::forward<KArg>(key)),
+          value_(std::forward<Args>(args)...) {}
     ~HashNode() {
-        next_ = nullptr;
+        next_.store(nullptr, std::memory_order_relaxed);
     }
     HashNode(const HashNode&) = delete;
     HashNode& operator=(const HashNode&) = delete;
@@ -319,6 +2889,20 @@ public:
         return key_;
     }
 
+    /**
+     * @brief 节点是否是要找的键，缓存了哈希值时先比较哈希值
+     * 
+     * @param hash_val 
+     * @param key 
+     * @param eq 
+     * @return true 
+     * @return false 
+     */
+    template <typename Q, typename E>
+    bool matches(size_t hash_val, const Q& key, const E& eq) const {
+        return this->hash_equals(hash_val) && eq(key_, key);
+    }
+
     /**
      * @brief 获取节点的值
      * 
@@ -342,13 +2926,14 @@ public:
      * 
      * @param value 
      */
-    void set_value(const V value) {
-        value_ = value;
+    template <typename M>
+    void set_value(M&& value) {
+        value_ = std::forward<M>(value);
     }
 
 public:
-    // 单链表的下一个指针
-    HashNode* next_ = nullptr;
+    // 单链表的下一个指针，不加锁的读者会并发读取，因此是原子变量
+    std::atomic<HashNode*> next_{nullptr};
 
 private:
     // 节点的键
@@ -365,22 +2950,30 @@ private:
 /**
  * @brief 迭代器
  *  注意：此迭代器非线程安全，特别注意
+ *  迭代器存活期间处于回收策略的临界区中，并发删除的节点不会被释放，不会访问到已释放的内存，
+ *  但并发修改时可能漏掉或者重复访问某些元素，需要与写操作并发遍历时使用 SnapshotIterator 或者 for_each
  * @tparam K 
  * @tparam V 
+ * @tparam F 
+ * @tparam B 
+ * @tparam E 
  */
-template <typename K, typename V>
+template <typename K, typename V, typename F, typename B, typename E, typename L>
 class ConstIterator {
+    // 桶中元素的类型，链表引擎为 HashNode
+    typedef typename B::node_type node_type;
+
 public:
     ConstIterator() = delete;
     ~ConstIterator() = default;
-    explicit ConstIterator(ConcurrentHashMap<K, V>* cmp) : cmp_(cmp) {
-        for (; hash_node_ == nullptr && bucket_pos_ < cmp_->hash_bucket_size_;) {
-            HashNode<K, V>* node = cmp_->hash_table_[bucket_pos_].head_;
+    explicit ConstIterator(ConcurrentHashMap<K, V, F, B, E, L>* cmp) : cmp_(cmp) {
+        for (; hash_node_ == nullptr && bucket_pos_ < cmp_->bucket_count();) {
+            node_type* node = cmp_->bucket_at_index(bucket_pos_)->first();
             if (node != nullptr) {
                 hash_node_ = node;
                 break;
             }
-            if (++bucket_pos_ >= cmp_->hash_bucket_size_) break;
+            if (++bucket_pos_ >= cmp_->bucket_count()) break;
         }
     }
     // 拷贝函数使用浅拷贝是没有问题的
@@ -421,7 +3014,7 @@ public:
 
     /**
      * @brief 运算符 != 重载
-     *  
+     * 
      * @param other 
      * @return true 
      * @return false 
@@ -450,14 +3043,15 @@ public:
         // hash_node 为空，直接返回
         if (hash_node_ == nullptr) return *this;
         // hash_node 不为空，并且 next 有值，则返回 next
-        if (hash_node_->next_ != nullptr) {
-            hash_node_ = hash_node_->next_;
+        node_type* next = cmp_->bucket_at_index(bucket_pos_)->next(hash_node_);
+        if (next != nullptr) {
+            hash_node_ = next;
             return *this;
         }
         // 如果 hash_node 是当前桶中最后一个元素，寻找下一个桶的非空头节点
         ++bucket_pos_;
-        for (; bucket_pos_ < cmp_->hash_bucket_size_; ++bucket_pos_) {
-            HashNode<K, V>* node = cmp_->hash_table_[bucket_pos_].head_;
+        for (; bucket_pos_ < cmp_->bucket_count(); ++bucket_pos_) {
+            node_type* node = cmp_->bucket_at_index(bucket_pos_)->first();
             if (node != nullptr) {
                 hash_node_ = node;
                 return *this;
@@ -470,19 +3064,145 @@ public:
     /**
      * @brief 运算符 -> 重载
      *  返回 node 指针
-     * @return HashNode<K, V>* 
+     * @return node_type* 
      */
-    HashNode<K, V>* operator->() const {
+    node_type* operator->() const {
         return hash_node_;
     }
 
 private:
+    // 回收策略的临界区守卫，必须在遍历之前构造
+    typename B::reclaimer_type::Guard guard_;
     // hash map 的指针
-    ConcurrentHashMap<K, V>* cmp_;
+    ConcurrentHashMap<K, V, F, B, E, L>* cmp_;
     // 当前处于那个 bucket 位置
     uint64_t bucket_pos_ = 0;
     // 当前指向的 node
-    HashNode<K, V>* hash_node_ = nullptr;
+    node_type* hash_node_ = nullptr;
+};
+
+/**
+ * @brief 弱一致迭代器中的一个元素，是迭代器经过时桶中键值的拷贝
+ * 
+ * @tparam K 
+ * @tparam V 
+ */
+template <typename K, typename V>
+class SnapshotEntry {
+public:
+    SnapshotEntry(const K& key, const V& value) : key_(key), value_(value) {}
+
+public:
+    const K& get_key() const {
+        return key_;
+    }
+
+    const V& get_value() const {
+        return value_;
+    }
+
+private:
+    K key_;
+    V value_;
+};
+
+/**
+ * @brief 弱一致的迭代器，用法同 ConstIterator，遍历期间其他线程可以并发读写
+ *        存活期间暂停扩缩容，桶的数量不变，每次给一个桶加读锁，
+ *        把桶中的键值拷贝到缓冲区后解锁，再从缓冲区中逐个返回
+ *        迭代器只能移动，不能拷贝
+ * 
+ * @tparam K 
+ * @tparam V 
+ * @tparam F 
+ * @tparam B 
+ * @tparam E 
+ */
+template <typename K, typename V, typename F, typename B, typename E, typename L>
+class SnapshotIterator {
+public:
+    SnapshotIterator() = delete;
+    ~SnapshotIterator() = default;
+    explicit SnapshotIterator(ConcurrentHashMap<K, V, F, B, E, L>* cmp)
+        : cmp_(cmp), scan_guard_(cmp), bucket_size_(cmp->bucket_count()) {
+        fill();
+    }
+    SnapshotIterator(const SnapshotIterator&) = delete;
+    SnapshotIterator& operator=(const SnapshotIterator&) = delete;
+    SnapshotIterator(SnapshotIterator&&) = default;
+    SnapshotIterator& operator=(SnapshotIterator&&) = default;
+
+public:
+    /**
+     * @brief 运算符 == 重载
+     *  比较当前元素是否为空，遍历结束时为空
+     * @param point 
+     * @return true 
+     * @return false 
+     */
+    bool operator==(void* point) const {
+        return current() == point;
+    }
+
+    /**
+     * @brief 运算符 != 重载
+     * 
+     * @param point 
+     * @return true 
+     * @return false 
+     */
+    bool operator!=(void* point) const {
+        return !SnapshotIterator::operator==(point);
+    }
+
+    /**
+     * @brief 运算符 ++ 重载
+     * 
+     * @return SnapshotIterator& 
+     */
+    SnapshotIterator& operator++(int) {
+        if (pos_ < buffer_.size() && ++pos_ == buffer_.size()) {
+            fill();
+        }
+        return *this;
+    }
+
+    /**
+     * @brief 运算符 -> 重载
+     *  返回当前元素
+     * @return const SnapshotEntry<K, V>* 
+     */
+    const SnapshotEntry<K, V>* operator->() const {
+        return current();
+    }
+
+private:
+    const SnapshotEntry<K, V>* current() const {
+        return pos_ < buffer_.size() ? &buffer_[pos_] : nullptr;
+    }
+
+    // 拷贝下一个非空的桶
+    void fill() {
+        buffer_.clear();
+        pos_ = 0;
+        for (; buffer_.empty() && bucket_pos_ < bucket_size_; ++bucket_pos_) {
+            cmp_->copy_bucket(bucket_pos_, &buffer_);
+        }
+    }
+
+private:
+    // hash map 的指针
+    ConcurrentHashMap<K, V, F, B, E, L>* cmp_;
+    // 遍历期间暂停扩缩容
+    typename ConcurrentHashMap<K, V, F, B, E, L>::ScanGuard scan_guard_;
+    // 遍历开始时的桶数，遍历期间不变
+    size_t bucket_size_;
+    // 下一个要拷贝的桶
+    size_t bucket_pos_ = 0;
+    // 当前桶的拷贝
+    std::vector<SnapshotEntry<K, V>> buffer_;
+    // 当前元素在缓冲区中的位置
+    size_t pos_ = 0;
 };
 
 }  // namespace concurrent
@@ -0,0 +1,757 @@
+/**
+ * @file cuckoo_hash_map.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "cache_aligned.h"
+#include "concurrent_hash_map.h"
+#include "spin_lock.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 每个桶的槽位数（组相联的路数）
+#define CUCKOO_SLOTS_PER_BUCKET (4)
+// 锁分片数，必须是 2 的幂，桶按下标映射到分片
+#define CUCKOO_LOCK_STRIPE_COUNT (2048)
+// 广度优先搜索的最大路径长度，即一次插入最多搬动的元素个数
+#define CUCKOO_MAX_BFS_PATH_LEN (5)
+// 广度优先搜索最多访问的桶数，限制搜索的耗时和栈上队列的大小
+#define CUCKOO_BFS_MAX_BUCKETS (256)
+// 默认的初始桶数
+#define CUCKOO_DEFAULT_BUCKET_COUNT (1024)
+// reserve 按此负载因子预留槽位
+#define CUCKOO_RESERVE_LOAD_FACTOR (0.9f)
+
+/**
+ * @brief 并发布谷鸟哈希表，每个键有两个候选桶，每个桶有 CUCKOO_SLOTS_PER_BUCKET 个槽位
+ *        与 ConcurrentHashMap 的链表/数组桶不同，查找最多检查两个桶，最坏情况的耗时有上界；
+ *        负载因子可以达到 90% 以上，没有节点和指针的开销
+ *        1. 定位：h = mix_hash(F(key))，第一个桶为 h 的低位，第二个桶为第一个桶异或指纹（h 的最高字节）的哈希，
+ *           两个桶互为对方的候选，只凭桶下标和指纹就能算出另一个候选桶，搬动元素不需要重新计算 F
+ *        2. 加锁：桶按下标映射到自旋锁的分片，操作前按分片下标从小到大锁住两个候选桶，
+ *           之后检查表没有被扩容，否则解锁重试
+ *        3. 插入：两个候选桶都满时，逐个锁住桶做广度优先搜索，找一条以空槽结尾、长度不超过 CUCKOO_MAX_BFS_PATH_LEN
+ *           的搬动路径，再从路径末端开始每次锁住两个桶搬动一个元素，搬动前确认槽位没有被其他线程改变，否则重新插入
+ *        4. 扩容：找不到路径时锁住所有分片，桶数翻倍后重新插入所有元素
+ *        不支持不加锁的读，find 也需要加锁；值在锁内拷贝给调用者
+ * 
+ * @tparam K 
+ * @tparam V 
+ * @tparam F 
+ * @tparam E 
+ */
+template <typename K, typename V, typename F = std::hash<K>, typename E = std::equal_to<K>>
+class ConcurrentCuckooMap {
+public:
+    /**
+     * @brief 构造函数
+     * 
+     * @param bucket_count 初始桶数，向上取整到 2 的幂
+     */
+    explicit ConcurrentCuckooMap(size_t bucket_count = CUCKOO_DEFAULT_BUCKET_COUNT)
+        : locks_(cache_aligned_new<SpinLock>(CUCKOO_LOCK_STRIPE_COUNT)) {
+        size_t hash_power = 1;
+        for (; (static_cast<size_t>(1) << hash_power) < bucket_count;) {
+            ++hash_power;
+        }
+        buckets_.store(new_buckets(hash_power), std::memory_order_relaxed);
+        hash_power_.store(hash_power, std::memory_order_release);
+        pthread_rwlock_init(&resize_lock_, nullptr);
+    }
+    ~ConcurrentCuckooMap() {
+        delete_buckets(buckets_.load(std::memory_order_relaxed), hash_power_.load(std::memory_order_relaxed));
+        cache_aligned_delete(locks_, CUCKOO_LOCK_STRIPE_COUNT);
+        pthread_rwlock_destroy(&resize_lock_);
+    }
+    ConcurrentCuckooMap(const ConcurrentCuckooMap&) = delete;
+    ConcurrentCuckooMap& operator=(const ConcurrentCuckooMap&) = delete;
+
+public:
+    /**
+     * @brief 查找，找到时给 value 赋值，最多检查两个桶
+     * 
+     * @param key 
+     * @param value 
+     * @return true 
+     * @return false 
+     */
+    bool find(const K& key, V& value) const {
+        return visit(key, [&value](const V& v) { value = v; });
+    }
+
+    /**
+     * @brief 在锁内对 key 对应的值调用 fn(const V&)，fn 中不能访问此哈希表
+     * 
+     * @param key 
+     * @param fn 
+     * @return true 找到了 key 并调用了 fn
+     * @return false 
+     */
+    template <typename Fn>
+    bool visit(const K& key, Fn&& fn) const {
+        size_t hash_val = hash_of(key);
+        BucketPair pair = lock_pair(hash_val);
+        Entry* entry = locate(pair, key, tag_of(hash_val));
+        if (entry != nullptr) {
+            try {
+                fn(static_cast<const V&>(entry->value));
+            } catch (...) {
+                unlock_pair(pair);
+                throw;
+            }
+        }
+        unlock_pair(pair);
+        return entry != nullptr;
+    }
+
+    /**
+     * @brief 是否存在 key
+     * 
+     * @param key 
+     * @return true 
+     * @return false 
+     */
+    bool contains(const K& key) const {
+        return visit(key, [](const V&) {});
+    }
+
+    /**
+     * @brief 插入，键已存在时更新值
+     * 
+     * @param key 
+     * @param value 
+     */
+    void insert(const K& key, const V& value) {
+        upsert_key(key, [&value](V& old) { old = value; }, value);
+    }
+
+    /**
+     * @brief 插入或者赋值
+     * 
+     * @param key 
+     * @param obj 
+     * @return true 新插入了键
+     * @return false 键已存在，赋值
+     */
+    template <typename M>
+    bool insert_or_assign(const K& key, M&& obj) {
+        return upsert_key(key, [&obj](V& old) { old = std::forward<M>(obj); }, std::forward<M>(obj));
+    }
+
+    /**
+     * @brief 键不存在时用 args 原地构造值，键存在时什么都不做
+     * 
+     * @param key 
+     * @param args 
+     * @return true 新插入了键
+     * @return false 键已存在
+     */
+    template <typename... Args>
+    bool try_emplace(const K& key, Args&&... args) {
+        return upsert_key(key, [](V&) {}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief 键不存在时用 init 构造值，键存在时在锁内调用 updater(V&)
+     * 
+     * @param key 
+     * @param init 
+     * @param updater 
+     * @return true 新插入了键
+     * @return false 键已存在，调用了 updater
+     */
+    template <typename Init, typename Updater>
+    bool upsert(const K& key, Init&& init, Updater&& updater) {
+        return upsert_key(key, updater, std::forward<Init>(init));
+    }
+
+    /**
+     * @brief 删除某个键
+     * 
+     * @param key 
+     * @return true 删除了键
+     * @return false 键不存在
+     */
+    bool erase(const K& key) {
+        size_t hash_val = hash_of(key);
+        uint8_t tag = tag_of(hash_val);
+        BucketPair pair = lock_pair(hash_val);
+        bool erased = false;
+        for (size_t index : {pair.first, pair.second}) {
+            Bucket& bucket = pair.buckets[index];
+            for (size_t slot = 0; !erased && slot < CUCKOO_SLOTS_PER_BUCKET; ++slot) {
+                if (bucket.tags[slot] == tag && key_eq_(bucket.entry(slot).key, key)) {
+                    bucket.destroy(slot);
+                    erased = true;
+                }
+            }
+        }
+        unlock_pair(pair);
+        if (erased) {
+            size_counter_.add(-1);
+        }
+        return erased;
+    }
+
+    /**
+     * @brief 清空，不缩小桶数
+     */
+    void clear() {
+        pthread_rwlock_wrlock(&resize_lock_);
+        lock_all();
+        Bucket* buckets = buckets_.load(std::memory_order_relaxed);
+        size_t bucket_count = static_cast<size_t>(1) << hash_power_.load(std::memory_order_relaxed);
+        int64_t erased = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            for (size_t slot = 0; slot < CUCKOO_SLOTS_PER_BUCKET; ++slot) {
+                if (buckets[i].tags[slot] != 0) {
+                    buckets[i].destroy(slot);
+                    ++erased;
+                }
+            }
+        }
+        size_counter_.add(-erased);
+        unlock_all();
+        pthread_rwlock_unlock(&resize_lock_);
+    }
+
+    /**
+     * @brief 预先扩容，负载因子不超过 CUCKOO_RESERVE_LOAD_FACTOR 时能容纳 element_count 个元素
+     * 
+     * @param element_count 
+     */
+    void reserve(size_t element_count) {
+        size_t slot_count = static_cast<size_t>(element_count / CUCKOO_RESERVE_LOAD_FACTOR) + 1;
+        size_t hash_power = 1;
+        for (; (static_cast<size_t>(CUCKOO_SLOTS_PER_BUCKET) << hash_power) < slot_count;) {
+            ++hash_power;
+        }
+        resize(hash_power_.load(std::memory_order_acquire), hash_power);
+    }
+
+    /**
+     * @brief 对每个元素调用 fn(const K&, const V&)，每次锁住一个锁分片，遍历期间暂停扩容
+     *        遍历开始前就存在、期间没有被删除或者搬动的元素恰好访问一次；fn 中不能访问此哈希表
+     * 
+     * @param fn 
+     */
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        pthread_rwlock_rdlock(&resize_lock_);
+        Bucket* buckets = buckets_.load(std::memory_order_acquire);
+        size_t bucket_count = static_cast<size_t>(1) << hash_power_.load(std::memory_order_acquire);
+        for (size_t stripe = 0; stripe < CUCKOO_LOCK_STRIPE_COUNT && stripe < bucket_count; ++stripe) {
+            locks_[stripe].lock();
+            for (size_t i = stripe; i < bucket_count; i += CUCKOO_LOCK_STRIPE_COUNT) {
+                for (size_t slot = 0; slot < CUCKOO_SLOTS_PER_BUCKET; ++slot) {
+                    if (buckets[i].tags[slot] != 0) {
+                        const Entry& entry = buckets[i].entry(slot);
+                        try {
+                            fn(entry.key, entry.value);
+                        } catch (...) {
+                            locks_[stripe].unlock();
+                            pthread_rwlock_unlock(&resize_lock_);
+                            throw;
+                        }
+                    }
+                }
+            }
+            locks_[stripe].unlock();
+        }
+        pthread_rwlock_unlock(&resize_lock_);
+    }
+
+    /**
+     * @brief 元素个数
+     * 
+     * @return size_t 
+     */
+    size_t size() const {
+        return size_counter_.sum();
+    }
+
+    /**
+     * @brief 桶数
+     * 
+     * @return size_t 
+     */
+    size_t bucket_count() const {
+        return static_cast<size_t>(1) << hash_power_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 槽位数，即桶数乘以每个桶的槽位数
+     * 
+     * @return size_t 
+     */
+    size_t capacity() const {
+        return bucket_count() * CUCKOO_SLOTS_PER_BUCKET;
+    }
+
+    /**
+     * @brief 负载因子，元素个数除以槽位数
+     * 
+     * @return float 
+     */
+    float load_factor() const {
+        return static_cast<float>(size()) / capacity();
+    }
+
+private:
+    struct Entry {
+        template <typename KArg, typename... Args>
+        Entry(KArg&& k, Args&&... args) : key(std::forward<KArg>(k)), value(std::forward<Args>(args)...) {}
+
+        K key;
+        V value;
+    };
+
+    // 一个桶：指纹和槽位，指纹为 0 表示槽位空闲
+    struct Bucket {
+        Bucket() {
+            memset(tags, 0, sizeof(tags));
+        }
+
+        Entry& entry(size_t slot) {
+            return *static_cast<Entry*>(static_cast<void*>(&slots[slot]));
+        }
+
+        template <typename... Args>
+        void construct(size_t slot, uint8_t tag, Args&&... args) {
+            new (&slots[slot]) Entry(std::forward<Args>(args)...);
+            tags[slot] = tag;
+        }
+
+        void destroy(size_t slot) {
+            entry(slot).~Entry();
+            tags[slot] = 0;
+        }
+
+        uint8_t tags[CUCKOO_SLOTS_PER_BUCKET];
+        typename std::aligned_storage<sizeof(Entry), alignof(Entry)>::type slots[CUCKOO_SLOTS_PER_BUCKET];
+    };
+
+    // 锁住的两个候选桶
+    struct BucketPair {
+        Bucket* buckets;
+        size_t first;
+        size_t second;
+    };
+
+    // 搬动路径上的一个槽位，tag 是搜索时槽位中元素的指纹
+    struct PathSlot {
+        size_t bucket;
+        size_t slot;
+        uint8_t tag;
+    };
+
+    // 广度优先搜索的队列元素，path_code 依次记录起点（两个候选桶之一）和每一步的槽位
+    struct BfsEntry {
+        size_t bucket;
+        size_t path_code;
+        size_t depth;
+    };
+
+    // 搬动路径搜索的结果
+    enum SearchResult {
+        kPathFound,
+        kPathNotFound,
+        // 表被扩容，或者路径上的槽位被其他线程改变，需要重新插入
+        kPathRetry,
+    };
+
+    static size_t mask(size_t hash_power) {
+        return (static_cast<size_t>(1) << hash_power) - 1;
+    }
+
+    size_t hash_of(const K& key) const {
+        return mix_hash(hasher_(key));
+    }
+
+    // 指纹取哈希值的最高字节，0 留给空闲槽位
+    static uint8_t tag_of(size_t hash_val) {
+        uint8_t tag = static_cast<uint8_t>(hash_val >> (sizeof(size_t) * 8 - 8));
+        return tag == 0 ? 1 : tag;
+    }
+
+    // 另一个候选桶，对同一个指纹是对合的：alt_index(alt_index(i)) == i
+    static size_t alt_index(size_t index, uint8_t tag, size_t hash_power) {
+        return (index ^ ((tag + 1) * 0xc6a4a7935bd1e995ULL)) & mask(hash_power);
+    }
+
+    static Bucket* new_buckets(size_t hash_power) {
+        return cache_aligned_new<Bucket>(static_cast<size_t>(1) << hash_power);
+    }
+
+    // 析构桶中剩余的元素并释放
+    static void delete_buckets(Bucket* buckets, size_t hash_power) {
+        size_t bucket_count = static_cast<size_t>(1) << hash_power;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            for (size_t slot = 0; slot < CUCKOO_SLOTS_PER_BUCKET; ++slot) {
+                if (buckets[i].tags[slot] != 0) {
+                    buckets[i].destroy(slot);
+                }
+            }
+        }
+        cache_aligned_delete(buckets, bucket_count);
+    }
+
+    SpinLock& lock_of(size_t index) const {
+        return locks_[index & (CUCKOO_LOCK_STRIPE_COUNT - 1)];
+    }
+
+    // 按分片下标从小到大锁住两个桶，同一个分片只锁一次
+    void lock_two(size_t a, size_t b) const {
+        size_t la = a & (CUCKOO_LOCK_STRIPE_COUNT - 1);
+        size_t lb = b & (CUCKOO_LOCK_STRIPE_COUNT - 1);
+        if (la > lb) {
+            std::swap(la, lb);
+        }
+        locks_[la].lock();
+        if (la != lb) {
+            locks_[lb].lock();
+        }
+    }
+
+    void unlock_two(size_t a, size_t b) const {
+        size_t la = a & (CUCKOO_LOCK_STRIPE_COUNT - 1);
+        size_t lb = b & (CUCKOO_LOCK_STRIPE_COUNT - 1);
+        locks_[la].unlock();
+        if (la != lb) {
+            locks_[lb].unlock();
+        }
+    }
+
+    // 锁住键的两个候选桶，返回时表没有被扩容
+    BucketPair lock_pair(size_t hash_val) const {
+        uint8_t tag = tag_of(hash_val);
+        for (;;) {
+            size_t hash_power = hash_power_.load(std::memory_order_acquire);
+            size_t first = hash_val & mask(hash_power);
+            size_t second = alt_index(first, tag, hash_power);
+            lock_two(first, second);
+            if (hash_power_.load(std::memory_order_relaxed) == hash_power) {
+                return BucketPair{buckets_.load(std::memory_order_relaxed), first, second};
+            }
+            unlock_two(first, second);
+        }
+    }
+
+    void unlock_pair(const BucketPair& pair) const {
+        unlock_two(pair.first, pair.second);
+    }
+
+    void lock_all() const {
+        for (size_t i = 0; i < CUCKOO_LOCK_STRIPE_COUNT; ++i) {
+            locks_[i].lock();
+        }
+    }
+
+    void unlock_all() const {
+        for (size_t i = 0; i < CUCKOO_LOCK_STRIPE_COUNT; ++i) {
+            locks_[i].unlock();
+        }
+    }
+
+    // 在两个候选桶中查找，需要持有锁
+    Entry* locate(const BucketPair& pair, const K& key, uint8_t tag) const {
+        for (size_t index : {pair.first, pair.second}) {
+            Bucket& bucket = pair.buckets[index];
+            for (size_t slot = 0; slot < CUCKOO_SLOTS_PER_BUCKET; ++slot) {
+                if (bucket.tags[slot] == tag && key_eq_(bucket.entry(slot).key, key)) {
+                    return &bucket.entry(slot);
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    // 在两个候选桶中找空闲槽位放入新元素，需要持有锁
+    template <typename... Args>
+    static bool place(const BucketPair& pair, uint8_t tag, Args&&... args) {
+        for (size_t index : {pair.first, pair.second}) {
+            Bucket& bucket = pair.buckets[index];
+            for (size_t slot = 0; slot < CUCKOO_SLOTS_PER_BUCKET; ++slot) {
+                if (bucket.tags[slot] == 0) {
+                    bucket.construct(slot, tag, std::forward<Args>(args)...);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief 键不存在时用 args 构造新元素，存在时对已有的值调用 updater(V&)
+     *        两个候选桶都满时搬动元素腾出槽位，找不到搬动路径时扩容，然后重新尝试
+     *        args 只在最终放入时使用一次
+     */
+    template <typename U, typename... Args>
+    bool upsert_key(const K& key, U&& updater, Args&&... args) {
+        size_t hash_val = hash_of(key);
+        uint8_t tag = tag_of(hash_val);
+        for (;;) {
+            BucketPair pair = lock_pair(hash_val);
+            bool placed = false;
+            try {
+                Entry* entry = locate(pair, key, tag);
+                if (entry != nullptr) {
+                    updater(entry->value);
+                    unlock_pair(pair);
+                    return false;
+                }
+                placed = place(pair, tag, key, std::forward<Args>(args)...);
+            } catch (...) {
+                unlock_pair(pair);
+                throw;
+            }
+            unlock_pair(pair);
+            if (placed) {
+                size_counter_.add(1);
+                return true;
+            }
+            size_t hash_power = hash_power_.load(std::memory_order_acquire);
+            SearchResult result = make_room(hash_val, hash_power);
+            if (result == kPathNotFound) {
+                resize(hash_power, hash_power + 1);
+            }
+        }
+    }
+
+    /**
+     * @brief 在键的两个候选桶之一中腾出一个槽位，不持有锁时调用
+     *        腾出的槽位可能在重新加锁之前被其他线程占用，调用者需要重试
+     */
+    SearchResult make_room(size_t hash_val, size_t hash_power) {
+        PathSlot path[CUCKOO_MAX_BFS_PATH_LEN];
+        size_t depth = 0;
+        SearchResult result = search_path(buckets_.load(std::memory_order_acquire), hash_val, hash_power, true,
+            path, &depth);
+        if (result != kPathFound) {
+            return result;
+        }
+        // 从路径末端开始搬动，每一步把前一个槽位的元素搬到后一个空闲槽位
+        for (size_t d = depth; d > 0; --d) {
+            const PathSlot& from = path[d - 1];
+            const PathSlot& to = path[d];
+            lock_two(from.bucket, to.bucket);
+            if (hash_power_.load(std::memory_order_relaxed) != hash_power) {
+                unlock_two(from.bucket, to.bucket);
+                return kPathRetry;
+            }
+            Bucket* buckets = buckets_.load(std::memory_order_relaxed);
+            bool ok = buckets[to.bucket].tags[to.slot] == 0 && buckets[from.bucket].tags[from.slot] == from.tag;
+            if (ok) {
+                move_slot(buckets, from, to);
+            }
+            unlock_two(from.bucket, to.bucket);
+            if (!ok) {
+                // 已经完成的搬动仍然是合法的状态，元素都在自己的候选桶中
+                return kPathRetry;
+            }
+        }
+        return kPathFound;
+    }
+
+    static void move_slot(Bucket* buckets, const PathSlot& from, const PathSlot& to) {
+        Bucket& src = buckets[from.bucket];
+        buckets[to.bucket].construct(to.slot, from.tag, std::move(src.entry(from.slot)));
+        src.destroy(from.slot);
+    }
+
+    /**
+     * @brief 从键的两个候选桶出发，广度优先搜索一条以空闲槽位结尾的搬动路径
+     *        concurrent 为 true 时每次锁住一个桶读取它的指纹，并检查表没有被扩容
+     * 
+     * @param buckets 
+     * @param hash_val 
+     * @param hash_power 
+     * @param concurrent 
+     * @param path 输出路径，path[0] 是候选桶中的槽位，path[*depth] 是空闲槽位
+     * @param depth 
+     * @return SearchResult 
+     */
+    SearchResult search_path(Bucket* buckets, size_t hash_val, size_t hash_power, bool concurrent,
+                             PathSlot* path, size_t* depth) const {
+        uint8_t tag = tag_of(hash_val);
+        size_t first = hash_val & mask(hash_power);
+        size_t starts[2] = {first, alt_index(first, tag, hash_power)};
+        BfsEntry queue[CUCKOO_BFS_MAX_BUCKETS];
+        size_t head = 0;
+        size_t tail = 0;
+        queue[tail++] = BfsEntry{starts[0], 0, 0};
+        queue[tail++] = BfsEntry{starts[1], 1, 0};
+        for (; head < tail;) {
+            BfsEntry cur = queue[head++];
+            uint8_t tags[CUCKOO_SLOTS_PER_BUCKET];
+            if (!read_tags(buckets, cur.bucket, hash_power, concurrent, tags)) {
+                return kPathRetry;
+            }
+            for (size_t slot = 0; slot < CUCKOO_SLOTS_PER_BUCKET; ++slot) {
+                size_t path_code = cur.path_code * CUCKOO_SLOTS_PER_BUCKET + slot;
+                if (tags[slot] == 0) {
+                    *depth = cur.depth;
+                    return build_path(buckets, starts, path_code, cur.depth, hash_power, concurrent, path);
+                }
+                if (cur.depth + 1 < CUCKOO_MAX_BFS_PATH_LEN && tail < CUCKOO_BFS_MAX_BUCKETS) {
+                    queue[tail++] = BfsEntry{alt_index(cur.bucket, tags[slot], hash_power), path_code, cur.depth + 1};
+                }
+            }
+        }
+        return kPathNotFound;
+    }
+
+    // 读取一个桶的指纹
+    bool read_tags(Bucket* buckets, size_t index, size_t hash_power, bool concurrent, uint8_t* tags) const {
+        if (!concurrent) {
+            memcpy(tags, buckets[index].tags, CUCKOO_SLOTS_PER_BUCKET);
+            return true;
+        }
+        SpinLock& lock = lock_of(index);
+        lock.lock();
+        bool ok = hash_power_.load(std::memory_order_relaxed) == hash_power;
+        if (ok) {
+            memcpy(tags, buckets[index].tags, CUCKOO_SLOTS_PER_BUCKET);
+        }
+        lock.unlock();
+        return ok;
+    }
+
+    // 由 path_code 还原路径，并记录每一步要搬动的元素的指纹；途中的槽位已经空闲时提前结束
+    SearchResult build_path(Bucket* buckets, const size_t* starts, size_t path_code, size_t depth,
+                            size_t hash_power, bool concurrent, PathSlot* path) const {
+        for (size_t d = depth + 1; d > 0; --d) {
+            path[d - 1].slot = path_code % CUCKOO_SLOTS_PER_BUCKET;
+            path_code /= CUCKOO_SLOTS_PER_BUCKET;
+        }
+        size_t index = starts[path_code];
+        for (size_t d = 0; d <= depth; ++d) {
+            path[d].bucket = index;
+            uint8_t tags[CUCKOO_SLOTS_PER_BUCKET];
+            if (!read_tags(buckets, index, hash_power, concurrent, tags)) {
+                return kPathRetry;
+            }
+            path[d].tag = tags[path[d].slot];
+            if (d == depth) {
+                // 终点需要空闲，make_room 搬动时还会再检查一次
+                return path[d].tag == 0 ? kPathFound : kPathRetry;
+            }
+            if (path[d].tag == 0) {
+                // 路径中途的槽位已经被腾空，也能用，但是为了简单起见，让调用者重试
+                return kPathRetry;
+            }
+            index = alt_index(index, path[d].tag, hash_power);
+        }
+        return kPathFound;
+    }
+
+    /**
+     * @brief 扩容到 2^new_hash_power 个桶，当前桶数不是 2^old_hash_power 时说明其他线程已经扩容，直接返回
+     *        锁住所有的分片后，把所有元素搬到新的桶数组中
+     */
+    void resize(size_t old_hash_power, size_t new_hash_power) {
+        if (new_hash_power <= old_hash_power) {
+            return;
+        }
+        pthread_rwlock_wrlock(&resize_lock_);
+        lock_all();
+        if (hash_power_.load(std::memory_order_relaxed) == old_hash_power) {
+            Bucket* old_buckets = buckets_.load(std::memory_order_relaxed);
+            size_t hash_power = new_hash_power;
+            Bucket* buckets = nullptr;
+            try {
+                // 第一次分配新数组失败时还没有搬动任何元素，哈希表保持不变
+                buckets = rehash(old_buckets, old_hash_power, &hash_power);
+            } catch (...) {
+                unlock_all();
+                pthread_rwlock_unlock(&resize_lock_);
+                throw;
+            }
+            cache_aligned_delete(old_buckets, static_cast<size_t>(1) << old_hash_power);
+            buckets_.store(buckets, std::memory_order_relaxed);
+            hash_power_.store(hash_power, std::memory_order_release);
+        }
+        unlock_all();
+        pthread_rwlock_unlock(&resize_lock_);
+    }
+
+    /**
+     * @brief 把 old_buckets 中的所有元素搬到 2^(*hash_power) 个桶的新数组中，不加锁
+     *        新数组中找不到搬动路径时（极少发生）再翻倍，*hash_power 输出最终的值
+     *        返回后 old_buckets 中所有的槽位都是空闲的
+     */
+    Bucket* rehash(Bucket* old_buckets, size_t old_hash_power, size_t* hash_power) const {
+        Bucket* buckets = new_buckets(*hash_power);
+        size_t old_count = static_cast<size_t>(1) << old_hash_power;
+        for (size_t i = 0; i < old_count; ++i) {
+            for (size_t slot = 0; slot < CUCKOO_SLOTS_PER_BUCKET; ++slot) {
+                if (old_buckets[i].tags[slot] == 0) {
+                    continue;
+                }
+                Entry& entry = old_buckets[i].entry(slot);
+                size_t hash_val = hash_of(entry.key);
+                for (; !insert_unlocked(buckets, *hash_power, hash_val, entry);) {
+                    size_t grown_power = *hash_power + 1;
+                    Bucket* grown = rehash(buckets, *hash_power, &grown_power);
+                    cache_aligned_delete(buckets, static_cast<size_t>(1) << *hash_power);
+                    buckets = grown;
+                    *hash_power = grown_power;
+                }
+                old_buckets[i].destroy(slot);
+            }
+        }
+        return buckets;
+    }
+
+    // 不加锁地把 entry 搬进 buckets，必要时沿搬动路径腾出槽位
+    bool insert_unlocked(Bucket* buckets, size_t hash_power, size_t hash_val, Entry& entry) const {
+        uint8_t tag = tag_of(hash_val);
+        size_t first = hash_val & mask(hash_power);
+        BucketPair pair{buckets, first, alt_index(first, tag, hash_power)};
+        if (place(pair, tag, std::move(entry))) {
+            return true;
+        }
+        PathSlot path[CUCKOO_MAX_BFS_PATH_LEN];
+        size_t depth = 0;
+        if (search_path(buckets, hash_val, hash_power, false, path, &depth) != kPathFound) {
+            return false;
+        }
+        for (size_t d = depth; d > 0; --d) {
+            move_slot(buckets, path[d - 1], path[d]);
+        }
+        return place(pair, tag, std::move(entry));
+    }
+
+private:
+    // 桶数组与桶数的位数，只在持有所有锁分片时修改
+    std::atomic<Bucket*> buckets_;
+    std::atomic<size_t> hash_power_;
+    // 锁分片
+    SpinLock* locks_;
+    // 扩容与遍历互斥：遍历持有读锁，扩容和清空持有写锁，获取顺序在锁分片之前
+    mutable pthread_rwlock_t resize_lock_;
+    // 元素个数
+    StripedCounter size_counter_;
+    F hasher_;
+    E key_eq_;
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
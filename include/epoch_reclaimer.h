@@ -0,0 +1,319 @@
+/**
+ * @file epoch_reclaimer.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "cache_aligned.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 每个线程累计退休多少个对象后尝试推进一次全局 epoch 并回收
+#define EPOCH_RECLAIM_BATCH (64)
+
+/**
+ * @brief 等待回收的对象，deleter 负责真正释放
+ */
+struct RetiredObject {
+    void* ptr;
+    void (*deleter)(void*);
+    // 退休时的全局 epoch
+    uint64_t epoch;
+};
+
+/**
+ * @brief 每个线程的 epoch 记录
+ *        独占一个缓存行，进入、退出临界区只写自己的记录，读者之间不共享任何被写的缓存行
+ */
+struct alignas(CACHE_LINE_SIZE) EpochRecord {
+    // 进入临界区时为 (全局 epoch << 1) | 1，不在临界区时为 0
+    std::atomic<uint64_t> local_epoch{0};
+    // 此记录是否被某个线程占用，线程退出后记录可以被新线程复用
+    std::atomic<bool> in_use{false};
+    // 记录链表的下一个，记录只增不减
+    EpochRecord* next = nullptr;
+    // 临界区嵌套层数，只有所属线程访问
+    uint32_t nesting = 0;
+    // 此线程退休的对象，按 epoch 递增排列，只有所属线程访问
+    std::vector<RetiredObject> retired;
+    // 距离上次回收又退休了多少个对象
+    uint32_t retired_since_reclaim = 0;
+};
+
+/**
+ * @brief 基于 epoch 的内存回收（EBR）
+ *        读者在访问共享节点前进入临界区，记录下当前的全局 epoch；
+ *        写者删除节点后不立即释放，而是带上当前的全局 epoch 放入本线程的待回收列表；
+ *        所有处于临界区的线程都已经看到全局 epoch e 时，全局 epoch 才能推进到 e + 1，
+ *        因此全局 epoch 比退休时大 2 以后，不会再有读者持有这个节点，可以安全释放
+ * 
+ *        回收是分摊的：每个线程每退休 EPOCH_RECLAIM_BATCH 个对象尝试推进一次 epoch，并释放自己列表中可以释放的对象
+ *        线程退出时未释放的对象转交给全局的孤儿列表，由其他线程回收
+ *        进程内所有使用者共享一个 EpochDomain
+ */
+class EpochDomain {
+public:
+    EpochDomain() = default;
+    ~EpochDomain() {
+        // 进程退出时已经没有读者，剩余的对象全部释放
+        for (auto& obj : orphans_) {
+            obj.deleter(obj.ptr);
+        }
+        EpochRecord* record = records_.load(std::memory_order_acquire);
+        for (; record != nullptr;) {
+            EpochRecord* next = record->next;
+            for (auto& obj : record->retired) {
+                obj.deleter(obj.ptr);
+            }
+            cache_aligned_delete(record, 1);
+            record = next;
+        }
+    }
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+public:
+    /**
+     * @brief 全局唯一的实例
+     * 
+     * @return EpochDomain& 
+     */
+    static EpochDomain& instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    /**
+     * @brief 当前线程进入临界区，可以嵌套
+     * 
+     */
+    void enter() {
+        EpochRecord* record = local_record();
+        if (record->nesting++ == 0) {
+            // release 让回收者读到新的 epoch 时，也能看到本线程上一个临界区内的所有访问
+            record->local_epoch.store((global_epoch_.load(std::memory_order_relaxed) << 1) | 1,
+                std::memory_order_release);
+            // 保证之后对共享节点的读取不会被重排到发布 epoch 之前
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    /**
+     * @brief 当前线程退出临界区
+     * 
+     */
+    void exit() {
+        EpochRecord* record = local_record();
+        if (--record->nesting == 0) {
+            record->local_epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief 退休一个对象，等到没有读者可能持有它时再调用 deleter 释放
+     * 
+     * @param ptr 
+     * @param deleter 
+     */
+    void retire(void* ptr, void (*deleter)(void*)) {
+        EpochRecord* record = local_record();
+        record->retired.push_back(RetiredObject{ptr, deleter, global_epoch_.load(std::memory_order_acquire)});
+        if (++record->retired_since_reclaim >= EPOCH_RECLAIM_BATCH) {
+            record->retired_since_reclaim = 0;
+            try_advance();
+            reclaim(record);
+        }
+    }
+
+    /**
+     * @brief 尽可能推进 epoch 并回收当前线程和孤儿列表中的对象
+     *        没有其他线程处于临界区时，调用后当前线程退休的对象全部被释放
+     */
+    void flush() {
+        EpochRecord* record = local_record();
+        for (int i = 0; i < 3; ++i) {
+            try_advance();
+        }
+        reclaim(record);
+    }
+
+    /**
+     * @brief 当前线程待回收的对象个数
+     * 
+     * @return size_t 
+     */
+    size_t pending() {
+        return local_record()->retired.size();
+    }
+
+private:
+    // 线程退出时归还记录
+    struct RecordHolder {
+        EpochRecord* record;
+        RecordHolder() : record(EpochDomain::instance().acquire_record()) {}
+        ~RecordHolder() {
+            EpochDomain::instance().release_record(record);
+        }
+    };
+
+    static EpochRecord* local_record() {
+        static thread_local RecordHolder holder;
+        return holder.record;
+    }
+
+    // 优先复用已退出线程的记录，否则新建一个加入链表
+    EpochRecord* acquire_record() {
+        EpochRecord* record = records_.load(std::memory_order_acquire);
+        for (; record != nullptr; record = record->next) {
+            bool expected = false;
+            if (!record->in_use.load(std::memory_order_relaxed)
+                && record->in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                return record;
+            }
+        }
+        record = cache_aligned_new<EpochRecord>(1);
+        record->in_use.store(true, std::memory_order_relaxed);
+        EpochRecord* head = records_.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!records_.compare_exchange_weak(head, record, std::memory_order_release,
+            std::memory_order_relaxed));
+        return record;
+    }
+
+    // 未释放的对象转交给孤儿列表
+    void release_record(EpochRecord* record) {
+        if (!record->retired.empty()) {
+            std::lock_guard<std::mutex> guard(orphans_mutex_);
+            orphans_.insert(orphans_.end(), record->retired.begin(), record->retired.end());
+            record->retired.clear();
+        }
+        record->nesting = 0;
+        record->retired_since_reclaim = 0;
+        record->local_epoch.store(0, std::memory_order_release);
+        record->in_use.store(false, std::memory_order_release);
+    }
+
+    // 所有处于临界区的线程都已经看到当前的全局 epoch 时，推进全局 epoch
+    void try_advance() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = global_epoch_.load(std::memory_order_relaxed);
+        EpochRecord* record = records_.load(std::memory_order_acquire);
+        for (; record != nullptr; record = record->next) {
+            uint64_t local_epoch = record->local_epoch.load(std::memory_order_acquire);
+            if ((local_epoch & 1) != 0 && (local_epoch >> 1) != epoch) {
+                return;
+            }
+        }
+        global_epoch_.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel);
+    }
+
+    // 释放退休 epoch 比全局 epoch 小 2 及以上的对象
+    void reclaim(EpochRecord* record) {
+        uint64_t epoch = global_epoch_.load(std::memory_order_acquire);
+        size_t freed = 0;
+        for (; freed < record->retired.size() && record->retired[freed].epoch + 2 <= epoch; ++freed) {
+            record->retired[freed].deleter(record->retired[freed].ptr);
+        }
+        record->retired.erase(record->retired.begin(), record->retired.begin() + freed);
+
+        std::unique_lock<std::mutex> guard(orphans_mutex_, std::try_to_lock);
+        if (guard.owns_lock() && !orphans_.empty()) {
+            size_t kept = 0;
+            for (size_t i = 0; i < orphans_.size(); ++i) {
+                if (orphans_[i].epoch + 2 <= epoch) {
+                    orphans_[i].deleter(orphans_[i].ptr);
+                } else {
+                    orphans_[kept++] = orphans_[i];
+                }
+            }
+            orphans_.resize(kept);
+        }
+    }
+
+private:
+    // 全局 epoch
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> global_epoch_{1};
+    // 所有线程的记录
+    alignas(CACHE_LINE_SIZE) std::atomic<EpochRecord*> records_{nullptr};
+    // 已退出线程留下的待回收对象
+    std::mutex orphans_mutex_;
+    std::vector<RetiredObject> orphans_;
+};
+
+/**
+ * @brief 基于 epoch 的回收策略，HashBucket 默认使用
+ *        删除的节点延迟释放，不加锁的读者和迭代器在 Guard 的生命周期内访问到的节点不会被释放
+ */
+struct EpochReclaimer {
+    // 是否延迟释放
+    static constexpr bool kDeferred = true;
+
+    /**
+     * @brief 临界区守卫，构造时进入临界区，析构时退出，可以拷贝和嵌套
+     */
+    class Guard {
+    public:
+        Guard() {
+            EpochDomain::instance().enter();
+        }
+        Guard(const Guard&) : Guard() {}
+        Guard& operator=(const Guard&) {
+            return *this;
+        }
+        ~Guard() {
+            EpochDomain::instance().exit();
+        }
+    };
+
+    /**
+     * @brief 退休一个对象
+     * 
+     * @param ptr 
+     * @param deleter 
+     */
+    static void retire(void* ptr, void (*deleter)(void*)) {
+        EpochDomain::instance().retire(ptr, deleter);
+    }
+};
+
+/**
+ * @brief 立即释放的回收策略，适用于只加锁访问的场景，不支持不加锁读
+ */
+struct ImmediateReclaimer {
+    // 是否延迟释放
+    static constexpr bool kDeferred = false;
+
+    /**
+     * @brief 临界区守卫，什么也不做
+     */
+    class Guard {
+    public:
+        Guard() {}
+    };
+
+    /**
+     * @brief 立即释放对象
+     * 
+     * @param ptr 
+     * @param deleter 
+     */
+    static void retire(void* ptr, void (*deleter)(void*)) {
+        deleter(ptr);
+    }
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
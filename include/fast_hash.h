@@ -0,0 +1,154 @@
+/**
+ * @file fast_hash.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace noahyzhang {
+namespace concurrent {
+
+namespace detail {
+
+// wyhash 使用的常量
+static constexpr uint64_t kWySecret0 = 0x2d358dccaa6c78a5ULL;
+static constexpr uint64_t kWySecret1 = 0x8bb84b93962eacc9ULL;
+static constexpr uint64_t kWySecret2 = 0x4b33a62ed433d4a3ULL;
+static constexpr uint64_t kWySecret3 = 0x4d5a2da51de1aa47ULL;
+
+// 64 位乘法得到 128 位结果，低 64 位写回 a，高 64 位写回 b
+inline void wy_mum(uint64_t* a, uint64_t* b) {
+    __uint128_t r = static_cast<__uint128_t>(*a) * *b;
+    *a = static_cast<uint64_t>(r);
+    *b = static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+inline uint64_t wy_read8(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t wy_read4(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 读取 1 到 3 个字节
+inline uint64_t wy_read3(const unsigned char* p, size_t len) {
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+}
+
+}  // namespace detail
+
+/**
+ * @brief 对一段字节计算 64 位哈希值（wyhash）
+ *        每次处理 48 字节，三条相互独立的乘法链可以在 CPU 上并行执行，长字符串上比 MurmurHash64A 快数倍
+ * 
+ * @param data 
+ * @param len 
+ * @param seed 
+ * @return size_t 
+ */
+inline size_t wyhash_bytes(const void* data, size_t len, uint64_t seed = 0) {
+    using namespace detail;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    seed ^= wy_mix(seed ^ kWySecret0, kWySecret1);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_read4(p) << 32) | wy_read4(p + ((len >> 3) << 2));
+            b = (wy_read4(p + len - 4) << 32) | wy_read4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wy_read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mix(wy_read8(p) ^ kWySecret1, wy_read8(p + 8) ^ seed);
+                see1 = wy_mix(wy_read8(p + 16) ^ kWySecret2, wy_read8(p + 24) ^ see1);
+                see2 = wy_mix(wy_read8(p + 32) ^ kWySecret3, wy_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        for (; i > 16; i -= 16, p += 16) {
+            seed = wy_mix(wy_read8(p) ^ kWySecret1, wy_read8(p + 8) ^ seed);
+        }
+        a = wy_read8(p + i - 16);
+        b = wy_read8(p + i - 8);
+    }
+    a ^= kWySecret1;
+    b ^= seed;
+    wy_mum(&a, &b);
+    return static_cast<size_t>(wy_mix(a ^ kWySecret0 ^ len, b ^ kWySecret1));
+}
+
+/**
+ * @brief 对 64 位整数计算哈希值，一次 128 位乘法，结果的每一位都依赖输入的所有位
+ * 
+ * @param key 
+ * @return size_t 
+ */
+inline size_t wyhash_int(uint64_t key) {
+    using namespace detail;
+    uint64_t a = key ^ kWySecret0, b = kWySecret1;
+    wy_mum(&a, &b);
+    return static_cast<size_t>(wy_mix(a ^ kWySecret0, b ^ kWySecret1));
+}
+
+/**
+ * @brief 透明的快速哈希函数，可以作为 ConcurrentHashMap 的 F
+ *        1. 整数、枚举：wyhash_int，低位分布均匀，不依赖桶数是质数
+ *        2. std::string、const char*（以及 C++17 的 std::string_view）：wyhash_bytes，内容相同时哈希值相同
+ *        字符串键与 StringEqual 一起使用时可以不构造 std::string 直接查找
+ */
+struct FastHash {
+    typedef void is_transparent;
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, size_t>::type
+    operator()(T key) const {
+        return wyhash_int(static_cast<uint64_t>(key));
+    }
+    size_t operator()(const std::string& key) const {
+        return wyhash_bytes(key.data(), key.size());
+    }
+    size_t operator()(const char* key) const {
+        return wyhash_bytes(key, strlen(key));
+    }
+#if __cplusplus >= 201703L
+    size_t operator()(std::string_view key) const {
+        return wyhash_bytes(key.data(), key.size());
+    }
+#endif
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
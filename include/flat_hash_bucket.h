@@ -0,0 +1,442 @@
+/**
+ * @file flat_hash_bucket.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <new>
+#include <utility>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "concurrent_hash_map.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 连续数组存储引擎默认的最大负载因子，一个桶中的元素连续存放，可以容纳更多的元素
+#define DEFAULT_FLAT_MAX_LOAD_FACTOR (4.0f)
+// 桶中槽位数组的初始容量
+#define FLAT_BUCKET_INIT_CAPACITY (4)
+// 指纹数组中空闲位置填充的值，最高位为 1，不会与任何 7 位指纹相同
+#define FLAT_BUCKET_EMPTY_TAG (0x80)
+
+/**
+ * @brief 指纹组匹配：一次比较一组指纹，返回匹配位置的位图，第 i 位对应第 i 个指纹
+ *        不支持 SIMD 的平台使用 64 位整数一次比较 8 个指纹（SWAR），
+ *        可能有少量误报，误报会在随后比较完整的键时被排除
+ */
+struct ScalarTagGroup {
+    static const uint32_t kWidth = 8;
+
+    static uint32_t match(const uint8_t* tags, uint8_t tag) {
+        const uint64_t lsb = 0x0101010101010101ULL;
+        const uint64_t msb = 0x8080808080808080ULL;
+        uint64_t word;
+        memcpy(&word, tags, sizeof(word));
+        // 与指纹相同的字节异或后为 0，再用经典的找零字节方法把这些字节的最高位置 1
+        uint64_t diff = word ^ (lsb * tag);
+        uint64_t zero = (diff - lsb) & ~diff & msb;
+        // 把每个字节的最高位收集到低 8 位
+        return static_cast<uint32_t>(((zero >> 7) * 0x0102040810204080ULL) >> 56);
+    }
+};
+
+#if defined(__SSE2__)
+/**
+ * @brief SSE2 指纹组匹配，一次比较 16 个指纹
+ */
+struct Sse2TagGroup {
+    static const uint32_t kWidth = 16;
+
+    static uint32_t match(const uint8_t* tags, uint8_t tag) {
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags));
+        return static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(group, _mm_set1_epi8(static_cast<char>(tag)))));
+    }
+};
+#endif
+
+#if defined(__AVX2__)
+/**
+ * @brief AVX2 指纹组匹配，一次比较 32 个指纹
+ */
+struct Avx2TagGroup {
+    static const uint32_t kWidth = 32;
+
+    static uint32_t match(const uint8_t* tags, uint8_t tag) {
+        __m256i group = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tags));
+        return static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(group, _mm256_set1_epi8(static_cast<char>(tag)))));
+    }
+};
+#endif
+
+// 根据编译时支持的指令集选择默认的指纹组匹配方式
+#if defined(__AVX2__)
+typedef Avx2TagGroup DefaultTagGroup;
+#elif defined(__SSE2__)
+typedef Sse2TagGroup DefaultTagGroup;
+#else
+typedef ScalarTagGroup DefaultTagGroup;
+#endif
+
+/**
+ * @brief 连续数组存储引擎中的槽位，与 HashNode 提供相同的访问接口
+ * 
+ * @tparam K 
+ * @tparam V 
+ */
+template <typename K, typename V>
+class FlatSlot : public CachedHash<StoreHash<K>::value> {
+public:
+    template <typename KArg, typename... Args>
+    FlatSlot(std::piecewise_construct_t, size_t hash_val, KArg&& key, Args&&... args)
+        : CachedHash<StoreHash<K>::value>(hash_val), key_(std::forward<KArg>(key)),
+          value_(std::forward<Args>(args)...) {}
+    FlatSlot(FlatSlot&&) = default;
+    FlatSlot& operator=(FlatSlot&&) = default;
+    FlatSlot(const FlatSlot&) = delete;
+    FlatSlot& operator=(const FlatSlot&) = delete;
+
+public:
+    /**
+     * @brief 获取槽位的键
+     * 
+     * @return const K& 
+     */
+    const K& get_key() const {
+        return key_;
+    }
+
+    /**
+     * @brief 获取槽位的值
+     * 
+     * @return const V& 
+     */
+    const V& get_value() const {
+        return value_;
+    }
+
+    /**
+     * @brief 获取槽位的值
+     * 
+     * @return V& 
+     */
+    V& get_value() {
+        return value_;
+    }
+
+    /**
+     * @brief 设置槽位的值
+     * 
+     * @param value 
+     */
+    template <typename M>
+    void set_value(M&& value) {
+        value_ = std::forward<M>(value);
+    }
+
+private:
+    // 槽位的键
+    K key_;
+    // 槽位的值
+    V value_;
+};
+
+/**
+ * @brief 以连续数组存储的哈希桶
+ *        桶中的元素紧凑地存放在一块内存中：前面是每个元素的 7 位哈希指纹，后面是键值槽位，
+ *        查找时先比较指纹，只有指纹相同才比较完整的键，一次查找通常只访问一到两个缓存行
+ *        指纹按组比较，支持 AVX2 时一次比较 32 个，SSE2 时 16 个，否则退化为 64 位整数一次比较 8 个
+ *        删除时把最后一个元素移到空洞处，因此前 size_ 个槽位始终有效，不需要墓碑标记
+ * 
+ *        使用方法：ConcurrentHashMap<K, V, std::hash<K>, FlatHashBucket<K, V>>
+ *        要求 K、V 可以移动构造
+ * 
+ * @tparam K 
+ * @tparam V 
+ * @tparam G 指纹组匹配方式，默认根据编译时支持的指令集选择
+ */
+template <typename K, typename V, typename G = DefaultTagGroup>
+class FlatHashBucket : public HashBucketBase {
+public:
+    // 迭代器访问的元素类型
+    typedef FlatSlot<K, V> node_type;
+    // 槽位数组原地修改，释放立即进行
+    typedef ImmediateReclaimer reclaimer_type;
+    // 槽位数组会重新分配，不支持不加锁的乐观读
+    static constexpr bool kOptimisticRead = false;
+
+    FlatHashBucket() = default;
+    ~FlatHashBucket() {
+        clear();
+    }
+
+public:
+    /**
+     * @brief 默认的最大负载因子
+     * 
+     * @return float 
+     */
+    static float default_max_load_factor() {
+        return DEFAULT_FLAT_MAX_LOAD_FACTOR;
+    }
+
+    /**
+     * @brief 查找某个键所在的槽位，需要持有锁
+     * 
+     * @param hash_val 
+     * @param key 
+     * @param eq 键的相等比较，以 eq(槽位的键, key) 调用
+     * @return node_type* 不存在时返回 nullptr
+     */
+    template <typename Q, typename E>
+    node_type* find_node(size_t hash_val, const Q& key, const E& eq) const {
+        return lookup(hash_val, key, eq);
+    }
+
+    /**
+     * @brief 键不存在时用 key 和 args 原地构造新元素，键存在时对值调用 update，需要持有写锁
+     * 
+     * @param hash_val 
+     * @param key 键，只在新建元素时转发给槽位的构造函数
+     * @param eq 
+     * @param update 以 update(V&) 调用
+     * @param args 转发给值的构造函数
+     * @return true 新插入了元素
+     * @return false 键已存在，调用了 update
+     */
+    template <typename E, typename KArg, typename U, typename... Args>
+    bool upsert(size_t hash_val, KArg&& key, const E& eq, U&& update, Args&&... args) {
+        FlatSlot<K, V>* slot = lookup(hash_val, key, eq);
+        if (slot != nullptr) {
+            update(slot->get_value());
+            return false;
+        }
+        emplace_back(hash_tag(hash_val), std::piecewise_construct, hash_val, std::forward<KArg>(key),
+            std::forward<Args>(args)...);
+        return true;
+    }
+
+    /**
+     * @brief 不检查重复，直接在末尾插入新元素，调用者保证 key 不在桶中，需要持有写锁
+     * 
+     * @param hash_val 
+     * @param key 
+     * @param args 转发给值的构造函数
+     */
+    template <typename KArg, typename... Args>
+    void insert_unique(size_t hash_val, KArg&& key, Args&&... args) {
+        emplace_back(hash_tag(hash_val), std::piecewise_construct, hash_val, std::forward<KArg>(key),
+            std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief 删除某个键值，需要持有写锁
+     * 
+     * @param hash_val 
+     * @param key 
+     * @param eq 
+     * @return true 删除成功
+     * @return false key 不存在
+     */
+    template <typename Q, typename E>
+    bool erase(size_t hash_val, const Q& key, const E& eq) {
+        FlatSlot<K, V>* slot = lookup(hash_val, key, eq);
+        if (slot == nullptr) {
+            return false;
+        }
+        remove_at(static_cast<uint32_t>(slot - slots_));
+        return true;
+    }
+
+    /**
+     * @brief 删除满足条件的元素，需要持有写锁
+     * 
+     * @param pred 以 pred(node_type&) 判断元素是否需要删除
+     * @return size_t 删除的元素个数
+     */
+    template <typename P>
+    size_t erase_if(P pred) {
+        size_t count = 0;
+        for (uint32_t i = 0; i < size_;) {
+            if (pred(slots_[i])) {
+                remove_at(i);
+                ++count;
+            } else {
+                ++i;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief 清理桶中所有元素并释放槽位数组，需要持有写锁
+     * 
+     * @return size_t 删除的元素个数
+     */
+    size_t clear() {
+        size_t count = size_;
+        for (uint32_t i = 0; i < size_; ++i) {
+            slots_[i].~FlatSlot<K, V>();
+        }
+        ::operator delete(tags_);
+        tags_ = nullptr;
+        slots_ = nullptr;
+        size_ = 0;
+        capacity_ = 0;
+        return count;
+    }
+
+    /**
+     * @brief 把满足条件的元素迁移到另一个桶，用于桶的分裂，需要持有两个桶的写锁
+     * 
+     * @param other 新桶
+     * @param should_move 以 should_move(const node_type&) 判断元素是否需要迁移
+     */
+    template <typename P>
+    void split_to(FlatHashBucket* other, P should_move) {
+        for (uint32_t i = 0; i < size_;) {
+            if (should_move(slots_[i])) {
+                other->emplace_back(tags_[i], std::move(slots_[i]));
+                remove_at(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    /**
+     * @brief 把另一个桶的所有元素并入此桶，用于桶的合并，需要持有两个桶的写锁
+     * 
+     * @param other 被合并的桶
+     */
+    void merge_from(FlatHashBucket* other) {
+        for (uint32_t i = 0; i < other->size_; ++i) {
+            emplace_back(other->tags_[i], std::move(other->slots_[i]));
+        }
+        other->clear();
+    }
+
+    /**
+     * @brief 批量操作加锁前的预取，不需要持有锁
+     *        指纹数组的指针在扩容时会被修改，不加锁不能读取，这里什么也不做，桶本身已经由调用者预取
+     */
+    void prefetch() const {}
+
+    /**
+     * @brief 获取桶中第一个元素，用于迭代，需要持有锁
+     * 
+     * @return node_type* 
+     */
+    node_type* first() const {
+        return size_ == 0 ? nullptr : slots_;
+    }
+
+    /**
+     * @brief 获取桶中下一个元素，用于迭代，需要持有锁
+     * 
+     * @param slot 
+     * @return node_type* 
+     */
+    node_type* next(node_type* slot) const {
+        return slot + 1 < slots_ + size_ ? slot + 1 : nullptr;
+    }
+
+private:
+    /**
+     * @brief 由哈希值计算 7 位指纹
+     *        桶的下标用的是哈希值的低位，这里先乘一个奇数常量打散，再取最高的 7 位，
+     *        避免 std::hash 对整数是恒等映射时指纹全部相同
+     * 
+     * @param hash_val 
+     * @return uint8_t 
+     */
+    static uint8_t hash_tag(size_t hash_val) {
+        return static_cast<uint8_t>((static_cast<uint64_t>(hash_val) * 0x9E3779B97F4A7C15ULL) >> 57);
+    }
+
+    // 先按组比较指纹，指纹相同再比较完整的键
+    template <typename Q, typename E>
+    FlatSlot<K, V>* lookup(size_t hash_val, const Q& key, const E& eq) const {
+        uint8_t tag = hash_tag(hash_val);
+        for (uint32_t group = 0; group < size_; group += G::kWidth) {
+            uint32_t mask = G::match(tags_ + group, tag);
+            // 屏蔽掉超出有效元素个数的位置
+            if (size_ - group < G::kWidth) {
+                mask &= (static_cast<uint32_t>(1) << (size_ - group)) - 1;
+            }
+            for (; mask != 0; mask &= mask - 1) {
+                uint32_t i = group + static_cast<uint32_t>(__builtin_ctz(mask));
+                if (slots_[i].hash_equals(hash_val) && eq(slots_[i].get_key(), key)) {
+                    return slots_ + i;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    // 在末尾原地构造一个元素，容量不足时成倍扩大槽位数组
+    template <typename... Args>
+    void emplace_back(uint8_t tag, Args&&... args) {
+        if (size_ == capacity_) {
+            grow(capacity_ == 0 ? FLAT_BUCKET_INIT_CAPACITY : capacity_ * 2);
+        }
+        new (slots_ + size_) FlatSlot<K, V>(std::forward<Args>(args)...);
+        tags_[size_] = tag;
+        ++size_;
+    }
+
+    // 删除第 index 个元素，把最后一个元素移到此处
+    void remove_at(uint32_t index) {
+        uint32_t last = size_ - 1;
+        if (index != last) {
+            slots_[index] = std::move(slots_[last]);
+            tags_[index] = tags_[last];
+        }
+        slots_[last].~FlatSlot<K, V>();
+        --size_;
+    }
+
+    // 重新分配槽位数组，指纹和槽位放在同一块内存中
+    // 指纹数组按组宽度补齐，按组读取时不会越界
+    void grow(uint32_t capacity) {
+        size_t tag_bytes = (capacity + G::kWidth - 1) / G::kWidth * G::kWidth;
+        tag_bytes = (tag_bytes + alignof(FlatSlot<K, V>) - 1) / alignof(FlatSlot<K, V>) * alignof(FlatSlot<K, V>);
+        uint8_t* tags = static_cast<uint8_t*>(::operator new(tag_bytes + capacity * sizeof(FlatSlot<K, V>)));
+        memset(tags, FLAT_BUCKET_EMPTY_TAG, tag_bytes);
+        FlatSlot<K, V>* slots = reinterpret_cast<FlatSlot<K, V>*>(tags + tag_bytes);
+        for (uint32_t i = 0; i < size_; ++i) {
+            new (slots + i) FlatSlot<K, V>(std::move(slots_[i]));
+            slots_[i].~FlatSlot<K, V>();
+            tags[i] = tags_[i];
+        }
+        ::operator delete(tags_);
+        tags_ = tags;
+        slots_ = slots;
+        capacity_ = capacity;
+    }
+
+private:
+    // 哈希指纹数组，也是整块内存的起始地址
+    uint8_t* tags_ = nullptr;
+    // 键值槽位数组，紧跟在指纹数组之后
+    FlatSlot<K, V>* slots_ = nullptr;
+    // 有效元素个数
+    uint32_t size_ = 0;
+    // 槽位数组的容量
+    uint32_t capacity_ = 0;
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
@@ -0,0 +1,524 @@
+/**
+ * @file inline_hash_bucket.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "cache_aligned.h"
+#include "concurrent_hash_map.h"
+#include "epoch_reclaimer.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 每个桶内嵌的槽位数
+#define INLINE_BUCKET_SLOTS (8)
+// 内嵌存储引擎默认的最大负载因子，略低于内嵌槽位数，大部分桶不需要溢出数组
+#define DEFAULT_INLINE_MAX_LOAD_FACTOR (6.0f)
+// 溢出数组的初始容量
+#define INLINE_OVERFLOW_INIT_CAPACITY (4)
+
+/**
+ * @brief 内嵌存储引擎的空键：取值等于空键的槽位是空闲的，空键本身不能插入
+ *        整数类型默认以最大值作为空键，其他类型需要提供同样接口的类作为 InlineHashBucket 的模板参数
+ * 
+ * @tparam K 
+ */
+template <typename K>
+struct InlineEmptyKey {
+    static_assert(std::is_integral<K>::value, "InlineEmptyKey only supports integral keys, provide an empty key type");
+
+    static K empty_key() {
+        return std::numeric_limits<K>::max();
+    }
+};
+
+template <typename K, typename V, typename X = InlineEmptyKey<K>, size_t N = INLINE_BUCKET_SLOTS>
+class InlineHashBucket;
+
+/**
+ * @brief 内嵌存储引擎中的槽位，与 HashNode 提供相同的访问接口，不缓存哈希值
+ *        键以字节数组存放在值之后，get_key 返回拷贝，槽位按值对齐，键的对齐要求更高时也没有填充，
+ *        例如 uint64_t 键、uint32_t 值的槽位是 12 字节而不是 16 字节
+ * 
+ * @tparam K 
+ * @tparam V 
+ */
+template <typename K, typename V>
+class InlineSlot : public CachedHash<false> {
+public:
+    // 不初始化，空闲槽位由桶设置为空键
+    InlineSlot() : CachedHash<false>(0) {}
+    template <typename KArg, typename... Args>
+    explicit InlineSlot(KArg&& key, Args&&... args) : CachedHash<false>(0), value_(std::forward<Args>(args)...) {
+        set_key(std::forward<KArg>(key));
+    }
+
+public:
+    /**
+     * @brief 获取槽位的键
+     * 
+     * @return K 
+     */
+    K get_key() const {
+        K key;
+        memcpy(&key, key_, sizeof(K));
+        return key;
+    }
+
+    /**
+     * @brief 获取槽位的值
+     * 
+     * @return const V& 
+     */
+    const V& get_value() const {
+        return value_;
+    }
+
+    /**
+     * @brief 获取槽位的值
+     * 
+     * @return V& 
+     */
+    V& get_value() {
+        return value_;
+    }
+
+    /**
+     * @brief 设置槽位的值
+     * 
+     * @param value 
+     */
+    template <typename M>
+    void set_value(M&& value) {
+        value_ = std::forward<M>(value);
+    }
+
+private:
+    template <typename, typename, typename, size_t>
+    friend class InlineHashBucket;
+
+    void set_key(const K& key) {
+        memcpy(key_, &key, sizeof(K));
+    }
+
+    // 槽位的值
+    V value_;
+    // 槽位的键，等于空键时槽位空闲
+    unsigned char key_[sizeof(K)];
+};
+
+/**
+ * @brief 键值内嵌在桶中的存储引擎，用于平凡可复制的小键值，例如 ConcurrentHashMap<uint64_t, uint32_t>
+ *        每个桶直接包含 N 个槽位，桶数组就是槽位数组，元素没有单独的内存分配，也没有节点指针和缓存的哈希值；
+ *        键等于空键（X::empty_key()）的槽位是空闲的，不需要另外记录元素个数
+ *        桶中的元素超过 N 个时，多出的元素放在按需分配的溢出数组中，负载因子低于 N 时只有少数桶需要溢出数组
+ *        元素紧凑地放在内嵌槽位和溢出数组的前面，删除时把最后一个元素移到空洞处，遇到空闲槽位即可结束查找
+ *        支持不加锁的乐观读：内嵌槽位的内存在哈希表的生命周期内不会释放，溢出数组以 epoch 延迟释放，
+ *        读到一半被修改的槽位会被版本号校验发现；槽位会被其他键复用，因此 visit_concurrent 仍然需要加锁
+ * 
+ *        使用方法：ConcurrentHashMap<K, V, std::hash<K>, InlineHashBucket<K, V>>
+ *        要求 K、V 是平凡可复制的类型，插入空键会抛出 std::invalid_argument
+ * 
+ * @tparam K 
+ * @tparam V 
+ * @tparam X 空键，提供 static K empty_key()
+ * @tparam N 每个桶内嵌的槽位数
+ */
+template <typename K, typename V, typename X, size_t N>
+class InlineHashBucket : public HashBucketBase {
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+        "InlineHashBucket requires trivially copyable keys and values");
+    static_assert(N > 0, "InlineHashBucket requires at least one inline slot");
+
+public:
+    // 迭代器访问的元素类型
+    typedef InlineSlot<K, V> node_type;
+    // 槽位会被复用，不能在找到槽位之后不加锁地访问
+    typedef ImmediateReclaimer reclaimer_type;
+    // 槽位的内存不会被释放，支持不加锁的乐观读
+    static constexpr bool kOptimisticRead = true;
+
+    InlineHashBucket() {
+        for (size_t i = 0; i < N; ++i) {
+            set_empty(slots_ + i);
+        }
+    }
+    ~InlineHashBucket() {
+        // 析构时不会再有读者，直接释放
+        ::operator delete(overflow_.load(std::memory_order_relaxed));
+    }
+
+public:
+    /**
+     * @brief 默认的最大负载因子
+     * 
+     * @return float 
+     */
+    static float default_max_load_factor() {
+        return DEFAULT_INLINE_MAX_LOAD_FACTOR;
+    }
+
+    /**
+     * @brief 查找某个键所在的槽位，需要持有锁
+     * 
+     * @param hash_val 
+     * @param key 
+     * @param eq 键的相等比较，以 eq(槽位的键, key) 调用
+     * @return node_type* 不存在时返回 nullptr
+     */
+    template <typename Q, typename E>
+    node_type* find_node(size_t, const Q& key, const E& eq) const {
+        if (eq(X::empty_key(), key)) {
+            return nullptr;
+        }
+        size_t count = 0;
+        node_type* slot = scan(slots_, N, key, eq, &count);
+        Overflow* overflow = overflow_.load(std::memory_order_relaxed);
+        if (slot == nullptr && count == N && overflow != nullptr) {
+            slot = scan(overflow->slots(), overflow->capacity, key, eq, &count);
+        }
+        return slot;
+    }
+
+    /**
+     * @brief 不加锁查找某个键值
+     *        先查找内嵌槽位，需要查找溢出数组时才进入 epoch 临界区，溢出数组在临界区内不会被释放
+     * 
+     * @param version 查找前通过 read_version 获取的版本号
+     * @param hash_val 
+     * @param key 
+     * @param eq 
+     * @param value 
+     * @param is_exist 查找结果
+     * @return true 读取过程中没有写操作，查找结果有效
+     * @return false 读取过程中有写操作，需要重试
+     */
+    template <typename Q, typename E>
+    bool try_find(uint32_t version, size_t, const Q& key, const E& eq, V& value, bool& is_exist) const {
+        is_exist = false;
+        if (eq(X::empty_key(), key)) {
+            return true;
+        }
+        size_t count = 0;
+        const node_type* slot = scan(slots_, N, key, eq, &count);
+        if (slot == nullptr && count == N && overflow_.load(std::memory_order_relaxed) != nullptr) {
+            EpochReclaimer::Guard guard;
+            // 进入临界区之后重新读取，此后读到的溢出数组不会被释放
+            Overflow* overflow = overflow_.load(std::memory_order_acquire);
+            if (read_version() != version) {
+                return false;
+            }
+            if (overflow != nullptr) {
+                slot = scan(overflow->slots(), overflow->capacity, key, eq, &count);
+            }
+        }
+        if (slot != nullptr) {
+            value = slot->value_;
+            is_exist = true;
+        }
+        return validate(version);
+    }
+
+    /**
+     * @brief 键不存在时用 key 和 args 构造新元素，键存在时对值调用 update，需要持有写锁
+     * 
+     * @param hash_val 
+     * @param key 键，只在新建元素时使用
+     * @param eq 
+     * @param update 以 update(V&) 调用
+     * @param args 转发给值的构造函数
+     * @return true 新插入了元素
+     * @return false 键已存在，调用了 update
+     */
+    template <typename E, typename KArg, typename U, typename... Args>
+    bool upsert(size_t hash_val, KArg&& key, const E& eq, U&& update, Args&&... args) {
+        node_type* slot = find_node(hash_val, key, eq);
+        if (slot != nullptr) {
+            update(slot->value_);
+            return false;
+        }
+        append(node_type(std::forward<KArg>(key), std::forward<Args>(args)...));
+        return true;
+    }
+
+    /**
+     * @brief 不检查重复，直接在末尾插入新元素，调用者保证 key 不在桶中，需要持有写锁
+     * 
+     * @param hash_val 
+     * @param key 
+     * @param args 转发给值的构造函数
+     */
+    template <typename KArg, typename... Args>
+    void insert_unique(size_t, KArg&& key, Args&&... args) {
+        append(node_type(std::forward<KArg>(key), std::forward<Args>(args)...));
+    }
+
+    /**
+     * @brief 删除某个键值，需要持有写锁
+     * 
+     * @param hash_val 
+     * @param key 
+     * @param eq 
+     * @return true 删除成功
+     * @return false key 不存在
+     */
+    template <typename Q, typename E>
+    bool erase(size_t hash_val, const Q& key, const E& eq) {
+        node_type* slot = find_node(hash_val, key, eq);
+        if (slot == nullptr) {
+            return false;
+        }
+        remove(slot, size());
+        return true;
+    }
+
+    /**
+     * @brief 删除满足条件的元素，需要持有写锁
+     * 
+     * @param pred 以 pred(node_type&) 判断元素是否需要删除
+     * @return size_t 删除的元素个数
+     */
+    template <typename P>
+    size_t erase_if(P pred) {
+        size_t removed = 0;
+        size_t count = size();
+        for (size_t i = 0; i < count;) {
+            node_type* slot = slot_at(i);
+            if (pred(*slot)) {
+                remove(slot, count);
+                --count;
+                ++removed;
+            } else {
+                ++i;
+            }
+        }
+        return removed;
+    }
+
+    /**
+     * @brief 清理桶中所有元素，溢出数组交给 epoch 延迟释放，需要持有写锁
+     * 
+     * @return size_t 删除的元素个数
+     */
+    size_t clear() {
+        size_t count = size();
+        for (size_t i = 0; i < N; ++i) {
+            set_empty(slots_ + i);
+        }
+        retire_overflow();
+        return count;
+    }
+
+    /**
+     * @brief 把满足条件的元素迁移到另一个桶，用于桶的分裂，需要持有两个桶的写锁
+     * 
+     * @param other 新桶
+     * @param should_move 以 should_move(const node_type&) 判断元素是否需要迁移
+     */
+    template <typename P>
+    void split_to(InlineHashBucket* other, P should_move) {
+        size_t count = size();
+        for (size_t i = 0; i < count;) {
+            node_type* slot = slot_at(i);
+            if (should_move(static_cast<const node_type&>(*slot))) {
+                other->append(*slot);
+                remove(slot, count);
+                --count;
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    /**
+     * @brief 把另一个桶的所有元素并入此桶，用于桶的合并，需要持有两个桶的写锁
+     * 
+     * @param other 被合并的桶
+     */
+    void merge_from(InlineHashBucket* other) {
+        size_t count = other->size();
+        for (size_t i = 0; i < count; ++i) {
+            append(*other->slot_at(i));
+        }
+        other->clear();
+    }
+
+    /**
+     * @brief 批量操作加锁前的预取，不需要持有锁
+     *        调用者已经预取了桶的第一个缓存行，这里预取内嵌槽位剩下的缓存行
+     */
+    void prefetch() const {
+        const char* begin = reinterpret_cast<const char*>(this);
+        for (size_t offset = CACHE_LINE_SIZE; offset < sizeof(*this); offset += CACHE_LINE_SIZE) {
+            __builtin_prefetch(begin + offset);
+        }
+    }
+
+    /**
+     * @brief 获取桶中第一个元素，用于迭代，需要持有锁
+     * 
+     * @return node_type* 
+     */
+    node_type* first() const {
+        return is_empty(slots_) ? nullptr : const_cast<node_type*>(slots_);
+    }
+
+    /**
+     * @brief 获取桶中下一个元素，用于迭代，需要持有锁
+     * 
+     * @param slot 
+     * @return node_type* 
+     */
+    node_type* next(node_type* slot) const {
+        Overflow* overflow = overflow_.load(std::memory_order_relaxed);
+        node_type* next_slot = slot + 1;
+        if (next_slot == slots_ + N) {
+            next_slot = overflow == nullptr ? nullptr : overflow->slots();
+        } else if (overflow != nullptr && next_slot == overflow->slots() + overflow->capacity) {
+            next_slot = nullptr;
+        }
+        return next_slot == nullptr || is_empty(next_slot) ? nullptr : next_slot;
+    }
+
+private:
+    // 溢出数组：容量之后紧跟槽位
+    struct Overflow {
+        size_t capacity;
+
+        node_type* slots() {
+            return reinterpret_cast<node_type*>(this + 1);
+        }
+    };
+    static_assert(sizeof(Overflow) % alignof(node_type) == 0, "overflow slots are misaligned");
+
+    static bool is_empty(const node_type* slot) {
+        K empty = X::empty_key();
+        return memcmp(slot->key_, &empty, sizeof(K)) == 0;
+    }
+
+    static void set_empty(node_type* slot) {
+        slot->set_key(X::empty_key());
+    }
+
+    // 在 count 个紧凑存放的槽位中查找，遇到空闲槽位时结束，*count 返回检查过的有效槽位个数
+    template <typename Q, typename E>
+    static node_type* scan(const node_type* slots, size_t capacity, const Q& key, const E& eq, size_t* count) {
+        for (size_t i = 0; i < capacity; ++i) {
+            if (is_empty(slots + i)) {
+                return nullptr;
+            }
+            if (eq(slots[i].get_key(), key)) {
+                return const_cast<node_type*>(slots + i);
+            }
+            ++*count;
+        }
+        return nullptr;
+    }
+
+    // 有效元素个数
+    size_t size() const {
+        size_t count = 0;
+        for (; count < N && !is_empty(slots_ + count); ++count) {}
+        Overflow* overflow = overflow_.load(std::memory_order_relaxed);
+        if (count == N && overflow != nullptr) {
+            node_type* slots = overflow->slots();
+            for (size_t i = 0; i < overflow->capacity && !is_empty(slots + i); ++i, ++count) {}
+        }
+        return count;
+    }
+
+    // 第 index 个元素的槽位，前 N 个在桶中，其余在溢出数组中
+    node_type* slot_at(size_t index) const {
+        if (index < N) {
+            return const_cast<node_type*>(slots_ + index);
+        }
+        return overflow_.load(std::memory_order_relaxed)->slots() + (index - N);
+    }
+
+    // 在末尾追加一个元素，溢出数组不足时成倍扩大
+    void append(const node_type& entry) {
+        if (is_empty(&entry)) {
+            throw std::invalid_argument("InlineHashBucket cannot store the empty key");
+        }
+        size_t count = size();
+        if (count < N) {
+            slots_[count] = entry;
+            return;
+        }
+        Overflow* overflow = overflow_.load(std::memory_order_relaxed);
+        size_t capacity = overflow == nullptr ? 0 : overflow->capacity;
+        if (count - N == capacity) {
+            overflow = grow_overflow(capacity == 0 ? INLINE_OVERFLOW_INIT_CAPACITY : capacity * 2);
+        }
+        overflow->slots()[count - N] = entry;
+    }
+
+    // 删除 slot 处的元素，把最后一个元素移到此处，溢出数组空了之后释放
+    void remove(node_type* slot, size_t count) {
+        node_type* last = slot_at(count - 1);
+        if (slot != last) {
+            *slot = *last;
+        }
+        set_empty(last);
+        if (count - 1 == N) {
+            retire_overflow();
+        }
+    }
+
+    // 分配新的溢出数组并拷贝已有的元素，旧数组交给 epoch 延迟释放
+    Overflow* grow_overflow(size_t capacity) {
+        Overflow* overflow = static_cast<Overflow*>(::operator new(sizeof(Overflow) + capacity * sizeof(node_type)));
+        overflow->capacity = capacity;
+        node_type* slots = overflow->slots();
+        Overflow* old = overflow_.load(std::memory_order_relaxed);
+        size_t old_capacity = old == nullptr ? 0 : old->capacity;
+        if (old_capacity != 0) {
+            memcpy(static_cast<void*>(slots), old->slots(), old_capacity * sizeof(node_type));
+        }
+        for (size_t i = old_capacity; i < capacity; ++i) {
+            set_empty(slots + i);
+        }
+        overflow_.store(overflow, std::memory_order_release);
+        if (old != nullptr) {
+            EpochReclaimer::retire(old, &InlineHashBucket::free_overflow);
+        }
+        return overflow;
+    }
+
+    void retire_overflow() {
+        Overflow* overflow = overflow_.load(std::memory_order_relaxed);
+        if (overflow != nullptr) {
+            overflow_.store(nullptr, std::memory_order_release);
+            EpochReclaimer::retire(overflow, &InlineHashBucket::free_overflow);
+        }
+    }
+
+    static void free_overflow(void* ptr) {
+        ::operator delete(ptr);
+    }
+
+private:
+    // 内嵌的槽位
+    node_type slots_[N];
+    // 溢出数组，内嵌槽位放满之后才会使用
+    std::atomic<Overflow*> overflow_{nullptr};
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
@@ -0,0 +1,568 @@
+/**
+ * @file map_file.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "fast_hash.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 哈希表文件中各个数组的起始偏移的对齐
+#define MAP_FILE_ALIGN (64)
+// 使用序列化器保存时写缓冲区的大小，超过后写入文件
+#define MAP_FILE_WRITE_BUFFER_SIZE (1 << 20)
+// 使用序列化器加载时每次反序列化、批量插入的元素个数
+#define MAP_FILE_LOAD_CHUNK_SIZE (1 << 16)
+
+/**
+ * @brief 哈希表文件的格式
+ *        1. kMapFilePod：键值都是平凡可拷贝的类型，按字节原样存放。文件中自带一个只读的哈希索引：
+ *           offsets 数组（bucket_count + 1 个 uint64_t），以及按桶排好序的 keys 数组和 values 数组，
+ *           第 b 个桶的元素是 keys[offsets[b], offsets[b + 1])，桶的下标为 wyhash_int(F(key)) & (bucket_count - 1)
+ *           可以直接 mmap 后通过 MappedHashTable 查找，不需要构建哈希表
+ *        2. kMapFileStream：由用户提供的序列化器编码，每个元素依次存放键和值，各自以 4 字节的长度开头
+ */
+enum MapFileFormat : uint32_t {
+    kMapFilePod = 1,
+    kMapFileStream = 2,
+};
+
+/**
+ * @brief 哈希表文件的头部，位于文件开头，各字段都是本机字节序
+ */
+struct MapFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    // kMapFilePod 时为 sizeof(K) 与 sizeof(V)，kMapFileStream 时为 0
+    uint64_t key_size;
+    uint64_t value_size;
+    uint64_t element_count;
+    // 以下三个偏移只对 kMapFilePod 有效，kMapFileStream 的元素从 keys_offset 开始
+    uint64_t bucket_count;
+    uint64_t offsets_offset;
+    uint64_t keys_offset;
+    uint64_t values_offset;
+    // 文件的总长度，用于发现被截断的文件
+    uint64_t file_size;
+};
+
+static constexpr char kMapFileMagic[8] = {'C', 'H', 'M', 'A', 'P', 'F', 'I', 'L'};
+static constexpr uint32_t kMapFileVersion = 1;
+
+/**
+ * @brief 平凡可拷贝类型的序列化器，按字节原样编码，可以与自定义的序列化器混用
+ *        序列化器需要提供：
+ *        1. void serialize(const T& value, std::string& out) const：把编码追加到 out 的末尾
+ *        2. bool deserialize(const char* data, size_t len, T& value) const：解码一段数据，数据不合法时返回 false
+ * 
+ * @tparam T 
+ */
+template <typename T>
+struct PodSerializer {
+    static_assert(std::is_trivially_copyable<T>::value, "PodSerializer requires a trivially copyable type");
+
+    void serialize(const T& value, std::string& out) const {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    bool deserialize(const char* data, size_t len, T& value) const {
+        if (len != sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, data, sizeof(T));
+        return true;
+    }
+};
+
+/**
+ * @brief 以只读方式映射整个文件，析构时解除映射
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() {
+        close();
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+public:
+    /**
+     * @brief 映射文件，之前映射的文件会被解除映射
+     * 
+     * @param path 
+     * @return true 
+     * @return false 文件不存在、为空或者映射失败
+     */
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<const char*>(data);
+        size_ = static_cast<size_t>(st.st_size);
+        return true;
+    }
+
+    /**
+     * @brief 解除映射
+     */
+    void close() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+            data_ = nullptr;
+            size_ = 0;
+        }
+    }
+
+    /**
+     * @brief 提示内核即将顺序读取整个文件，提前预读
+     */
+    void advise_sequential() const {
+        if (data_ != nullptr) {
+            madvise(const_cast<char*>(data_), size_, MADV_SEQUENTIAL);
+            madvise(const_cast<char*>(data_), size_, MADV_WILLNEED);
+        }
+    }
+
+    const char* data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/**
+ * @brief 读取并检查文件头部：魔数、版本、格式、键值大小以及各个偏移都与文件长度一致
+ * 
+ * @param file 
+ * @param format 
+ * @param key_size kMapFilePod 时为 sizeof(K)
+ * @param value_size kMapFilePod 时为 sizeof(V)
+ * @param header 
+ * @return true 
+ * @return false 不是此格式的文件或者文件已损坏
+ */
+inline bool read_map_file_header(const MappedFile& file, uint32_t format, size_t key_size, size_t value_size,
+                                 MapFileHeader& header) {
+    if (file.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, kMapFileMagic, sizeof(kMapFileMagic)) != 0 || header.version != kMapFileVersion
+        || header.format != format || header.key_size != key_size || header.value_size != value_size
+        || header.file_size != file.size() || header.keys_offset > file.size()) {
+        return false;
+    }
+    if (format != kMapFilePod) {
+        return true;
+    }
+    // 检查各个数组都在文件范围内并且满足对齐，除法避免乘法溢出
+    uint64_t bucket_count = header.bucket_count, count = header.element_count;
+    return bucket_count != 0 && (bucket_count & (bucket_count - 1)) == 0
+        && header.offsets_offset % MAP_FILE_ALIGN == 0 && header.keys_offset % MAP_FILE_ALIGN == 0
+        && header.values_offset % MAP_FILE_ALIGN == 0 && header.offsets_offset <= file.size()
+        && (file.size() - header.offsets_offset) / sizeof(uint64_t) > bucket_count
+        && (key_size == 0 || (file.size() - header.keys_offset) / key_size >= count)
+        && header.values_offset <= file.size()
+        && (value_size == 0 || (file.size() - header.values_offset) / value_size >= count);
+}
+
+/**
+ * @brief 写入哈希表文件，内容先写入 path.tmp，commit 时写入头部、同步到磁盘后再重命名为 path，
+ *        进程在写入过程中崩溃不会破坏已有的文件；没有 commit 就析构时删除临时文件
+ */
+class MapFileWriter {
+public:
+    MapFileWriter() = default;
+    ~MapFileWriter() {
+        if (file_ != nullptr) {
+            fclose(file_);
+            unlink(tmp_path_.c_str());
+        }
+    }
+    MapFileWriter(const MapFileWriter&) = delete;
+    MapFileWriter& operator=(const MapFileWriter&) = delete;
+
+public:
+    /**
+     * @brief 创建临时文件，并为头部预留空间
+     * 
+     * @param path 
+     * @return true 
+     * @return false 
+     */
+    bool open(const std::string& path) {
+        path_ = path;
+        tmp_path_ = path + ".tmp";
+        file_ = fopen(tmp_path_.c_str(), "wb");
+        MapFileHeader header;
+        memset(&header, 0, sizeof(header));
+        return file_ != nullptr && write(&header, sizeof(header));
+    }
+
+    /**
+     * @brief 在当前位置追加数据
+     * 
+     * @param data 
+     * @param len 
+     * @return true 
+     * @return false 
+     */
+    bool write(const void* data, size_t len) {
+        if (len != 0 && fwrite(data, 1, len, file_) != len) {
+            return false;
+        }
+        offset_ += len;
+        return true;
+    }
+
+    /**
+     * @brief 以 0 填充到 MAP_FILE_ALIGN 的倍数
+     * 
+     * @return true 
+     * @return false 
+     */
+    bool align() {
+        static const char zeros[MAP_FILE_ALIGN] = {};
+        return write(zeros, (MAP_FILE_ALIGN - offset_ % MAP_FILE_ALIGN) % MAP_FILE_ALIGN);
+    }
+
+    /**
+     * @brief 当前的写入位置
+     * 
+     * @return uint64_t 
+     */
+    uint64_t offset() const {
+        return offset_;
+    }
+
+    /**
+     * @brief 填写魔数、版本与文件长度后写入头部，同步到磁盘并重命名为目标文件
+     * 
+     * @param header 
+     * @return true 
+     * @return false 
+     */
+    bool commit(MapFileHeader header) {
+        memcpy(header.magic, kMapFileMagic, sizeof(kMapFileMagic));
+        header.version = kMapFileVersion;
+        header.file_size = offset_;
+        bool ok = fseek(file_, 0, SEEK_SET) == 0 && fwrite(&header, 1, sizeof(header), file_) == sizeof(header)
+            && fflush(file_) == 0 && fsync(fileno(file_)) == 0;
+        ok = fclose(file_) == 0 && ok;
+        file_ = nullptr;
+        if (!ok || rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+            unlink(tmp_path_.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    FILE* file_ = nullptr;
+    std::string path_;
+    std::string tmp_path_;
+    uint64_t offset_ = 0;
+};
+
+/**
+ * @brief 以 kMapFilePod 格式写入 count 个键值对，元素按桶做一次计数排序后依次写入 offsets、keys、values
+ * 
+ * @tparam K 
+ * @tparam V 
+ * @tparam F 
+ * @param path 
+ * @param keys 
+ * @param values 
+ * @param count 
+ * @param hash_fn 
+ * @return true 
+ * @return false 写入失败
+ */
+template <typename K, typename V, typename F>
+bool write_pod_map_file(const std::string& path, const K* keys, const V* values, size_t count, const F& hash_fn) {
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+        "the pod map file format requires trivially copyable keys and values");
+    uint64_t bucket_count = 1;
+    for (; bucket_count < count; bucket_count <<= 1) {}
+    std::vector<uint64_t> offsets(bucket_count + 1, 0);
+    std::vector<uint64_t> buckets(count);
+    for (size_t i = 0; i < count; ++i) {
+        buckets[i] = wyhash_int(hash_fn(keys[i])) & (bucket_count - 1);
+        ++offsets[buckets[i] + 1];
+    }
+    for (uint64_t b = 0; b < bucket_count; ++b) {
+        offsets[b + 1] += offsets[b];
+    }
+    // 按桶排序后的键值，K、V 不要求可以默认构造，以字节数组存放
+    std::vector<char> sorted_keys(count * sizeof(K)), sorted_values(count * sizeof(V));
+    std::vector<uint64_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t pos = cursor[buckets[i]]++;
+        memcpy(sorted_keys.data() + pos * sizeof(K), keys + i, sizeof(K));
+        memcpy(sorted_values.data() + pos * sizeof(V), values + i, sizeof(V));
+    }
+
+    MapFileWriter writer;
+    MapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.format = kMapFilePod;
+    header.key_size = sizeof(K);
+    header.value_size = sizeof(V);
+    header.element_count = count;
+    header.bucket_count = bucket_count;
+    if (!writer.open(path) || !writer.align()) {
+        return false;
+    }
+    header.offsets_offset = writer.offset();
+    if (!writer.write(offsets.data(), offsets.size() * sizeof(uint64_t)) || !writer.align()) {
+        return false;
+    }
+    header.keys_offset = writer.offset();
+    if (!writer.write(sorted_keys.data(), sorted_keys.size()) || !writer.align()) {
+        return false;
+    }
+    header.values_offset = writer.offset();
+    if (!writer.write(sorted_values.data(), sorted_values.size())) {
+        return false;
+    }
+    return writer.commit(header);
+}
+
+/**
+ * @brief 使用序列化器编码一个字段，以 4 字节的长度开头追加到 out 的末尾
+ * 
+ * @tparam S 
+ * @tparam T 
+ * @param serializer 
+ * @param value 
+ * @param out 
+ */
+template <typename S, typename T>
+void append_map_file_field(const S& serializer, const T& value, std::string& out) {
+    size_t pos = out.size();
+    out.append(sizeof(uint32_t), '\0');
+    serializer.serialize(value, out);
+    uint32_t len = static_cast<uint32_t>(out.size() - pos - sizeof(uint32_t));
+    memcpy(&out[pos], &len, sizeof(len));
+}
+
+/**
+ * @brief 从 [pos, end) 解码一个以 append_map_file_field 编码的字段，成功后 pos 移动到下一个字段
+ * 
+ * @tparam S 
+ * @tparam T 
+ * @param serializer 
+ * @param pos 
+ * @param end 
+ * @param value 
+ * @return true 
+ * @return false 数据被截断或者序列化器解码失败
+ */
+template <typename S, typename T>
+bool read_map_file_field(const S& serializer, const char*& pos, const char* end, T& value) {
+    uint32_t len;
+    if (static_cast<size_t>(end - pos) < sizeof(len)) {
+        return false;
+    }
+    memcpy(&len, pos, sizeof(len));
+    pos += sizeof(len);
+    if (static_cast<size_t>(end - pos) < len || !serializer.deserialize(pos, len, value)) {
+        return false;
+    }
+    pos += len;
+    return true;
+}
+
+/**
+ * @brief 直接在映射的 kMapFilePod 文件上查找的只读哈希表
+ *        打开文件只做映射和头部检查，不读取、不复制元素，内存由页缓存按需载入，多个进程映射同一个文件时共享物理内存
+ *        F 需要与保存时使用的哈希函数相同，并且在不同进程中对同一个键得到相同的哈希值
+ *        打开之后只读，可以在多个线程中并发查找
+ * 
+ * @tparam K 平凡可拷贝的类型
+ * @tparam V 平凡可拷贝的类型
+ * @tparam F 
+ * @tparam E 
+ */
+template <typename K, typename V, typename F = std::hash<K>, typename E = std::equal_to<K>>
+class MappedHashTable {
+public:
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+        "MappedHashTable requires trivially copyable keys and values");
+
+    explicit MappedHashTable(const F& hash_fn = F(), const E& key_eq = E())
+        : hash_fn_(hash_fn), key_eq_(key_eq) {}
+    MappedHashTable(const MappedHashTable&) = delete;
+    MappedHashTable& operator=(const MappedHashTable&) = delete;
+
+public:
+    /**
+     * @brief 映射由 ConcurrentHashMap::save 保存的文件
+     * 
+     * @param path 
+     * @return true 
+     * @return false 文件不存在、格式或者键值大小不匹配，此时之前打开的文件也已经关闭，哈希表为空
+     */
+    bool open(const std::string& path) {
+        MapFileHeader header;
+        close();
+        if (!file_.open(path) || !read_map_file_header(file_, kMapFilePod, sizeof(K), sizeof(V), header)) {
+            close();
+            return false;
+        }
+        const uint64_t* offsets = reinterpret_cast<const uint64_t*>(file_.data() + header.offsets_offset);
+        if (offsets[header.bucket_count] != header.element_count) {
+            close();
+            return false;
+        }
+        offsets_ = offsets;
+        keys_ = reinterpret_cast<const K*>(file_.data() + header.keys_offset);
+        values_ = reinterpret_cast<const V*>(file_.data() + header.values_offset);
+        bucket_mask_ = header.bucket_count - 1;
+        count_ = header.element_count;
+        return true;
+    }
+
+    /**
+     * @brief 解除映射，之后哈希表为空
+     */
+    void close() {
+        file_.close();
+        offsets_ = nullptr;
+        keys_ = nullptr;
+        values_ = nullptr;
+        bucket_mask_ = 0;
+        count_ = 0;
+    }
+
+    /**
+     * @brief 查找某个键，返回值在文件中的地址，不存在时返回 nullptr
+     * 
+     * @param key 
+     * @return const V* 
+     */
+    const V* find_ptr(const K& key) const {
+        if (count_ == 0) {
+            return nullptr;
+        }
+        uint64_t bucket = wyhash_int(hash_fn_(key)) & bucket_mask_;
+        uint64_t end = offsets_[bucket + 1];
+        if (end > count_) {
+            return nullptr;
+        }
+        for (uint64_t i = offsets_[bucket]; i < end; ++i) {
+            if (key_eq_(keys_[i], key)) {
+                return values_ + i;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 查找某个键，存在时拷贝出值
+     * 
+     * @param key 
+     * @param value 
+     * @return true 
+     * @return false 
+     */
+    bool find(const K& key, V& value) const {
+        const V* ptr = find_ptr(key);
+        if (ptr == nullptr) {
+            return false;
+        }
+        value = *ptr;
+        return true;
+    }
+
+    /**
+     * @brief 是否存在某个键
+     * 
+     * @param key 
+     * @return true 
+     * @return false 
+     */
+    bool contains(const K& key) const {
+        return find_ptr(key) != nullptr;
+    }
+
+    /**
+     * @brief 元素个数
+     * 
+     * @return size_t 
+     */
+    size_t size() const {
+        return count_;
+    }
+
+    /**
+     * @brief 按桶排序的所有键，与 values() 一一对应
+     * 
+     * @return const K* 
+     */
+    const K* keys() const {
+        return keys_;
+    }
+
+    /**
+     * @brief 按桶排序的所有值
+     * 
+     * @return const V* 
+     */
+    const V* values() const {
+        return values_;
+    }
+
+private:
+    F hash_fn_;
+    E key_eq_;
+    MappedFile file_;
+    const uint64_t* offsets_ = nullptr;
+    const K* keys_ = nullptr;
+    const V* values_ = nullptr;
+    uint64_t bucket_mask_ = 0;
+    size_t count_ = 0;
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
@@ -0,0 +1,295 @@
+/**
+ * @file node_pool.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 节点池每次向系统申请的内存块大小
+#define NODE_POOL_SLAB_SIZE (64 * 1024)
+// 线程本地空闲链表与全局交换的批大小，本地空闲节点超过两批时归还一批
+#define NODE_POOL_BATCH (256)
+// 定义 NODE_POOL_DISABLE 后 NodePoolAllocator 直接使用 operator new，便于 ASan 检查节点的释放后使用
+#if defined(__SANITIZE_ADDRESS__) && !defined(NODE_POOL_DISABLE)
+#define NODE_POOL_DISABLE
+#endif
+
+/**
+ * @brief 节点池的内存块来源，直接使用 malloc，不区分内存区域
+ */
+struct MallocSlabSource {
+    /**
+     * @brief 申请一个内存块
+     * 
+     * @param arena 内存区域的编号，忽略
+     * @param size 输出内存块可用的字节数
+     * @return char* 失败时返回 nullptr
+     */
+    static char* allocate(size_t arena, size_t* size) {
+        (void)arena;
+        *size = NODE_POOL_SLAB_SIZE;
+        return static_cast<char*>(malloc(NODE_POOL_SLAB_SIZE));
+    }
+};
+
+/**
+ * @brief 固定大小内存块的对象池
+ *        每个线程有自己的缓存：一段连续的未分配区域和一个空闲链表，分配、释放只操作本线程的缓存，不需要加锁
+ *        1. 分配：优先从空闲链表取，其次在未分配区域上移动指针，都没有时从全局取回一批空闲块，或者新申请一个内存块
+ *        2. 释放：放入本线程的空闲链表，其他线程分配的节点也一样，空闲块过多时整批归还全局
+ *        线程退出时剩余的空闲块整批归还全局，由其他线程取用
+ *        内存块只在进程退出时归还系统，节点池本身永不析构，进程退出阶段仍然可以安全地释放节点
+ *        Arenas 大于 1 时分为多个互相独立的区域，每个区域有自己的全局空闲块和线程缓存，
+ *        内存块由 S 按区域申请（例如放在不同的 NUMA 节点上），释放时需要给出块所属的区域
+ * 
+ * @tparam Size 块大小，至少能放下一个指针
+ * @tparam S 内存块的来源，提供 static char* allocate(size_t arena, size_t* size)
+ * @tparam Arenas 区域的个数
+ */
+template <size_t Size, typename S = MallocSlabSource, size_t Arenas = 1>
+class NodePool {
+public:
+    static_assert(Size >= sizeof(void*) && Size % sizeof(void*) == 0, "invalid node pool block size");
+
+    /**
+     * @brief 分配一个块
+     * 
+     * @param arena 区域的编号，小于 Arenas
+     * @return void* 
+     */
+    static void* allocate(size_t arena = 0) {
+        ThreadCache& cache = local_cache(arena);
+        FreeBlock* block = cache.free_head;
+        if (block != nullptr) {
+            cache.free_head = block->next;
+            --cache.free_count;
+            return block;
+        }
+        if (cache.bump_cur != cache.bump_end) {
+            void* ptr = cache.bump_cur;
+            cache.bump_cur += Size;
+            return ptr;
+        }
+        return instance(arena).refill(&cache, arena);
+    }
+
+    /**
+     * @brief 释放一个块
+     * 
+     * @param ptr 
+     * @param arena 块所属的区域
+     */
+    static void deallocate(void* ptr, size_t arena = 0) {
+        ThreadCache& cache = local_cache(arena);
+        FreeBlock* block = static_cast<FreeBlock*>(ptr);
+        if (cache.dead) {
+            // 线程缓存已经归还，直接还给全局
+            block->next = nullptr;
+            instance(arena).push_batch(block, 1);
+            return;
+        }
+        block->next = cache.free_head;
+        cache.free_head = block;
+        if (++cache.free_count >= 2 * NODE_POOL_BATCH) {
+            FreeBlock* tail = cache.free_head;
+            for (size_t i = 1; i < NODE_POOL_BATCH; ++i) {
+                tail = tail->next;
+            }
+            FreeBlock* batch = cache.free_head;
+            cache.free_head = tail->next;
+            cache.free_count -= NODE_POOL_BATCH;
+            tail->next = nullptr;
+            instance(arena).push_batch(batch, NODE_POOL_BATCH);
+        }
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Batch {
+        FreeBlock* head;
+        size_t count;
+    };
+
+    // 线程本地缓存，平凡析构，线程的其他 thread_local 析构过程中也可以访问
+    struct ThreadCache {
+        FreeBlock* free_head;
+        size_t free_count;
+        char* bump_cur;
+        char* bump_end;
+        // 是否已经注册了线程退出时的归还
+        bool registered;
+        // 线程退出，缓存已经归还
+        bool dead;
+    };
+
+    // 线程退出时归还各个区域的线程缓存
+    struct CacheReleaser {
+        ThreadCache* caches;
+        ~CacheReleaser() {
+            for (size_t i = 0; i < Arenas; ++i) {
+                instance(i).release_cache(caches + i);
+            }
+        }
+    };
+
+    static NodePool& instance(size_t arena) {
+        // 故意不析构，保证进程退出阶段延迟释放的节点仍然可以归还
+        static NodePool* pools = new NodePool[Arenas];
+        return pools[arena];
+    }
+
+    static ThreadCache& local_cache(size_t arena) {
+        static thread_local ThreadCache caches[Arenas];
+        if (!caches[0].registered) {
+            caches[0].registered = true;
+            static thread_local CacheReleaser releaser;
+            releaser.caches = caches;
+        }
+        return caches[arena];
+    }
+
+    // 本地缓存用完，从全局取回一批空闲块，或者申请新的内存块
+    void* refill(ThreadCache* cache, size_t arena) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (!batches_.empty()) {
+            Batch batch = batches_.back();
+            batches_.pop_back();
+            FreeBlock* block = batch.head;
+            if (!cache->dead) {
+                cache->free_head = block->next;
+                cache->free_count = batch.count - 1;
+            } else if (block->next != nullptr) {
+                batches_.push_back(Batch{block->next, batch.count - 1});
+            }
+            return block;
+        }
+        size_t slab_size = 0;
+        char* slab = S::allocate(arena, &slab_size);
+        if (slab == nullptr) {
+            throw std::bad_alloc();
+        }
+        slabs_.push_back(slab);
+        char* slab_end = slab + slab_size / Size * Size;
+        if (!cache->dead) {
+            cache->bump_cur = slab + Size;
+            cache->bump_end = slab_end;
+        } else {
+            push_range_locked(slab + Size, slab_end);
+        }
+        return slab;
+    }
+
+    void push_batch(FreeBlock* head, size_t count) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        batches_.push_back(Batch{head, count});
+    }
+
+    // 把一段未分配区域切成空闲块作为一批归还，需要持有锁
+    void push_range_locked(char* begin, char* end) {
+        if (begin == end) {
+            return;
+        }
+        FreeBlock* head = nullptr;
+        size_t count = 0;
+        for (char* ptr = end; ptr != begin; ++count) {
+            ptr -= Size;
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(ptr);
+            block->next = head;
+            head = block;
+        }
+        batches_.push_back(Batch{head, count});
+    }
+
+    void release_cache(ThreadCache* cache) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (cache->free_head != nullptr) {
+            batches_.push_back(Batch{cache->free_head, cache->free_count});
+        }
+        push_range_locked(cache->bump_cur, cache->bump_end);
+        cache->free_head = nullptr;
+        cache->free_count = 0;
+        cache->bump_cur = cache->bump_end = nullptr;
+        cache->dead = true;
+    }
+
+private:
+    std::mutex mutex_;
+    // 全局的空闲块，每批是一个链表
+    std::vector<Batch> batches_;
+    // 所有申请过的内存块
+    std::vector<char*> slabs_;
+};
+
+/**
+ * @brief 节点分配器，HashBucket 默认使用
+ *        单个对象从 NodePool 分配，同样大小的类型共享一个池，多个对象的分配退化为 operator new
+ *        分配器是无状态的，任意两个实例都相等
+ * 
+ * @tparam T 
+ */
+template <typename T>
+class NodePoolAllocator {
+public:
+    typedef T value_type;
+
+    NodePoolAllocator() = default;
+    template <typename U>
+    NodePoolAllocator(const NodePoolAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+#ifndef NODE_POOL_DISABLE
+        if (n == 1) {
+            return static_cast<T*>(NodePool<kBlockSize>::allocate());
+        }
+#endif
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+#ifndef NODE_POOL_DISABLE
+        if (n == 1) {
+            NodePool<kBlockSize>::deallocate(ptr);
+            return;
+        }
+#endif
+        (void)n;
+        ::operator delete(ptr);
+    }
+
+private:
+    static_assert(alignof(T) <= alignof(max_align_t), "node pool does not support over-aligned types");
+    // 块大小向上取整到指针大小和 T 的对齐的倍数，块起始地址都满足 T 的对齐
+    static constexpr size_t kAlign = alignof(T) > sizeof(void*) ? alignof(T) : sizeof(void*);
+    static constexpr size_t kBlockSize = (sizeof(T) + kAlign - 1) / kAlign * kAlign;
+};
+
+template <typename T, typename U>
+bool operator==(const NodePoolAllocator<T>&, const NodePoolAllocator<U>&) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const NodePoolAllocator<T>&, const NodePoolAllocator<U>&) {
+    return false;
+}
+
+}  // namespace concurrent
+}  // namespace noahyzhang
@@ -0,0 +1,326 @@
+/**
+ * @file numa_alloc.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <new>
+#include "cache_aligned.h"
+#include "node_pool.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 支持的 NUMA 节点个数上限，超出的节点不单独放置
+#define NUMA_MAX_NODES (8)
+// NUMA 节点池每次申请的内存块大小，必须是 2 的幂，块按自身大小对齐
+#define NUMA_SLAB_SIZE (1024 * 1024)
+// mbind 的策略，优先在指定的节点上分配，节点内存不足时退回到其他节点
+#define NUMA_MPOL_PREFERRED (1)
+
+/**
+ * @brief 读取 /sys 下形如 "0-3,8-11" 的列表，对其中的每个编号调用 fn(id)
+ * 
+ * @param path 
+ * @param fn 
+ * @return true 
+ * @return false 文件不存在或者格式错误
+ */
+template <typename Fn>
+bool read_id_list(const char* path, Fn&& fn) {
+    FILE* fp = fopen(path, "r");
+    if (fp == nullptr) {
+        return false;
+    }
+    char buf[1024];
+    bool ok = fgets(buf, sizeof(buf), fp) != nullptr;
+    fclose(fp);
+    for (char* ptr = buf; ok && *ptr != '\0' && *ptr != '\n';) {
+        char* end = nullptr;
+        long first = strtol(ptr, &end, 10);
+        long last = first;
+        if (end == ptr) {
+            return false;
+        }
+        if (*end == '-') {
+            ptr = end + 1;
+            last = strtol(ptr, &end, 10);
+            if (end == ptr) {
+                return false;
+            }
+        }
+        for (long id = first; id <= last; ++id) {
+            fn(static_cast<int>(id));
+        }
+        ptr = *end == ',' ? end + 1 : end;
+    }
+    return ok;
+}
+
+/**
+ * @brief 本机的 NUMA 节点个数，不超过 NUMA_MAX_NODES，无法获取时（非 NUMA 的机器、容器中没有 /sys）返回 1
+ * 
+ * @return int 
+ */
+inline int numa_node_count() {
+    static const int count = []() {
+        int max_node = 0;
+        read_id_list("/sys/devices/system/node/online", [&](int id) {
+            max_node = id > max_node ? id : max_node;
+        });
+        return max_node + 1 < NUMA_MAX_NODES ? max_node + 1 : NUMA_MAX_NODES;
+    }();
+    return count;
+}
+
+/**
+ * @brief 当前线程所在 CPU 的 NUMA 节点，无法获取时返回 0
+ * 
+ * @return int 
+ */
+inline int current_numa_node() {
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0 || static_cast<int>(node) >= numa_node_count()) {
+        return 0;
+    }
+    return static_cast<int>(node);
+}
+
+/**
+ * @brief 把当前线程绑定到 node 的所有 CPU 上
+ * 
+ * @param node 
+ * @return true 
+ * @return false 节点不存在、无法读取它的 CPU 列表或者设置失败，线程的亲和性不变
+ */
+inline bool bind_thread_to_numa_node(int node) {
+    if (node < 0 || node >= numa_node_count()) {
+        return false;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    size_t cpu_count = 0;
+    if (!read_id_list(path, [&](int cpu) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpus);
+            ++cpu_count;
+        }
+    }) || cpu_count == 0) {
+        return false;
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+/**
+ * @brief 以 mmap 申请 size 字节，node 不小于 0 时以 mbind 优先放在该节点上
+ *        mbind 失败时（内核不支持、容器禁止）仍然返回这段内存，由第一次访问的线程决定位置
+ *        不依赖 libnuma，直接调用系统调用
+ * 
+ * @param size 
+ * @param node 
+ * @return void* 失败时返回 nullptr
+ */
+inline void* numa_alloc(size_t size, int node) {
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+    if (node >= 0 && node < numa_node_count()) {
+        unsigned long mask = 1UL << node;
+        // 内核会把 maxnode 减一，需要多传一位
+        syscall(SYS_mbind, mem, size, NUMA_MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0);
+    }
+    return mem;
+}
+
+/**
+ * @brief 释放 numa_alloc 申请的内存
+ * 
+ * @param mem 
+ * @param size 与申请时相同
+ */
+inline void numa_free(void* mem, size_t size) {
+    if (mem != nullptr) {
+        munmap(mem, size);
+    }
+}
+
+/**
+ * @brief 在 node 上分配并构造 count 个对象，node 小于 0 时不指定节点，对象按页对齐
+ * 
+ * @tparam T 
+ * @param count 
+ * @param node 
+ * @return T* 
+ */
+template <typename T>
+T* numa_new(size_t count, int node) {
+    static_assert(alignof(T) <= 4096, "numa_new does not support page over-aligned types");
+    T* objs = static_cast<T*>(numa_alloc(sizeof(T) * count, node));
+    if (objs == nullptr) {
+        throw std::bad_alloc();
+    }
+    for (size_t i = 0; i < count; ++i) {
+        new (objs + i) T();
+    }
+    return objs;
+}
+
+/**
+ * @brief 析构并释放 numa_new 分配的对象
+ * 
+ * @tparam T 
+ * @param objs 
+ * @param count 
+ */
+template <typename T>
+void numa_delete(T* objs, size_t count) {
+    if (objs == nullptr) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        objs[i].~T();
+    }
+    numa_free(objs, sizeof(T) * count);
+}
+
+/**
+ * @brief 节点池的内存块来源，区域 0 不指定 NUMA 节点，区域 i 放在节点 i - 1 上
+ *        内存块按 NUMA_SLAB_SIZE 对齐，第一个缓存行记录区域的编号，释放时由块的地址找回所属的区域
+ */
+struct NumaSlabSource {
+    static_assert((NUMA_SLAB_SIZE & (NUMA_SLAB_SIZE - 1)) == 0, "NUMA_SLAB_SIZE must be a power of two");
+
+    static char* allocate(size_t arena, size_t* size) {
+        // 多申请一个内存块的大小，从中截取对齐的部分，其余的归还
+        char* mem = static_cast<char*>(numa_alloc(2 * NUMA_SLAB_SIZE, static_cast<int>(arena) - 1));
+        if (mem == nullptr) {
+            return nullptr;
+        }
+        char* slab = reinterpret_cast<char*>(
+            (reinterpret_cast<uintptr_t>(mem) + NUMA_SLAB_SIZE - 1) & ~static_cast<uintptr_t>(NUMA_SLAB_SIZE - 1));
+        if (slab != mem) {
+            munmap(mem, slab - mem);
+        }
+        munmap(slab + NUMA_SLAB_SIZE, mem + NUMA_SLAB_SIZE - slab);
+        *reinterpret_cast<size_t*>(slab) = arena;
+        *size = NUMA_SLAB_SIZE - CACHE_LINE_SIZE;
+        return slab + CACHE_LINE_SIZE;
+    }
+
+    /**
+     * @brief 块所属的区域
+     * 
+     * @param ptr 
+     * @return size_t 
+     */
+    static size_t arena_of(const void* ptr) {
+        uintptr_t slab = reinterpret_cast<uintptr_t>(ptr) & ~static_cast<uintptr_t>(NUMA_SLAB_SIZE - 1);
+        return *reinterpret_cast<const size_t*>(slab);
+    }
+};
+
+/**
+ * @brief 当前线程新分配的节点放在哪个 NUMA 节点上，-1 表示不指定
+ * 
+ * @return int& 
+ */
+inline int& numa_target_node() {
+    static thread_local int node = -1;
+    return node;
+}
+
+/**
+ * @brief 在作用域内把当前线程新分配的节点放在 node 上，离开作用域时恢复
+ *        ShardedConcurrentHashMap 在写操作前设置为分片所在的节点
+ */
+class NumaNodeScope {
+public:
+    explicit NumaNodeScope(int node) : prev_node_(numa_target_node()) {
+        numa_target_node() = node;
+    }
+    ~NumaNodeScope() {
+        numa_target_node() = prev_node_;
+    }
+    NumaNodeScope(const NumaNodeScope&) = delete;
+    NumaNodeScope& operator=(const NumaNodeScope&) = delete;
+
+private:
+    int prev_node_;
+};
+
+/**
+ * @brief 按 NUMA 节点放置的节点分配器，单个对象从 numa_target_node() 对应的节点池分配
+ *        释放时由地址找回所属的节点池，可以在任意线程、任意作用域中释放（包括延迟回收）
+ *        与 NodePoolAllocator 一样是无状态的，多个对象的分配退化为 operator new
+ * 
+ * @tparam T 
+ */
+template <typename T>
+class NumaNodeAllocator {
+public:
+    typedef T value_type;
+
+    NumaNodeAllocator() = default;
+    template <typename U>
+    NumaNodeAllocator(const NumaNodeAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+#ifndef NODE_POOL_DISABLE
+        if (n == 1) {
+            int node = numa_target_node();
+            return static_cast<T*>(Pool::allocate(node >= 0 && node < NUMA_MAX_NODES ? node + 1 : 0));
+        }
+#endif
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+#ifndef NODE_POOL_DISABLE
+        if (n == 1) {
+            Pool::deallocate(ptr, NumaSlabSource::arena_of(ptr));
+            return;
+        }
+#endif
+        (void)n;
+        ::operator delete(ptr);
+    }
+
+private:
+    static_assert(alignof(T) <= alignof(max_align_t), "node pool does not support over-aligned types");
+    static constexpr size_t kAlign = alignof(T) > sizeof(void*) ? alignof(T) : sizeof(void*);
+    static constexpr size_t kBlockSize = (sizeof(T) + kAlign - 1) / kAlign * kAlign;
+    // 区域 0 不指定节点，区域 i 对应节点 i - 1
+    typedef NodePool<kBlockSize, NumaSlabSource, NUMA_MAX_NODES + 1> Pool;
+};
+
+template <typename T, typename U>
+bool operator==(const NumaNodeAllocator<T>&, const NumaNodeAllocator<U>&) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const NumaNodeAllocator<T>&, const NumaNodeAllocator<U>&) {
+    return false;
+}
+
+}  // namespace concurrent
+}  // namespace noahyzhang
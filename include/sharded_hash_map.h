@@ -0,0 +1,323 @@
+/**
+ * @file sharded_hash_map.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include "concurrent_hash_map.h"
+#include "numa_alloc.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 默认的分片数，不足 NUMA 节点个数时取节点个数，向上取整到 2 的幂
+#define DEFAULT_SHARD_COUNT (16)
+
+/**
+ * @brief 分片的哈希表，由多个互相独立的 ConcurrentHashMap 组成，按键的哈希值（混合后）的高位选择分片
+ *        多路服务器上，每个分片的桶、锁分片和节点都放在同一个 NUMA 节点上，分片依次均匀地分配到各个节点：
+ *        1. 桶和锁分片：分片构造时以 numa_node 参数指定，见 ConcurrentHashMap 的构造函数
+ *        2. 节点：写操作期间以 NumaNodeScope 把当前线程的分配指向分片的节点，由 NumaNodeAllocator 从该节点的节点池分配
+ *        单节点的机器上，或者读取不到 NUMA 信息、mbind 不可用时，退化为普通的分片哈希表
+ *        按 shard_index 把请求路由到固定的工作线程，并用 bind_thread_to_shard 把线程绑定到分片所在节点的 CPU 上，
+ *        这些线程的访问就都在本地的内存上
+ *        选择分片和分片内部各计算一次 F(key)
+ * 
+ * @tparam K 
+ * @tparam V 
+ * @tparam F 
+ * @tparam E 
+ */
+template <typename K, typename V, typename F = std::hash<K>, typename E = std::equal_to<K>>
+class ShardedConcurrentHashMap {
+public:
+    typedef ConcurrentHashMap<K, V, F, HashBucket<K, V, EpochReclaimer, NumaNodeAllocator<HashNode<K, V>>>, E>
+        shard_type;
+
+    /**
+     * @brief 构造函数
+     * 
+     * @param shard_count 分片数，0 表示使用 DEFAULT_SHARD_COUNT，向上取整到 2 的幂
+     * @param hash_bucket_size 每个分片的初始桶数
+     * @param max_load_factor 
+     * @param lock_stripe_count 每个分片的锁分片数
+     * @param numa_placement 是否把分片放在不同的 NUMA 节点上
+     */
+    explicit ShardedConcurrentHashMap(size_t shard_count = 0, size_t hash_bucket_size = DEFAULT_HASH_BUCKET_SIZE,
+                                      float max_load_factor = DEFAULT_MAX_LOAD_FACTOR,
+                                      size_t lock_stripe_count = DEFAULT_LOCK_STRIPE_COUNT,
+                                      bool numa_placement = true) {
+        int node_count = numa_node_count();
+        if (shard_count == 0) {
+            shard_count = DEFAULT_SHARD_COUNT > static_cast<size_t>(node_count) ? DEFAULT_SHARD_COUNT : node_count;
+        }
+        shard_bits_ = 0;
+        for (; (static_cast<size_t>(1) << shard_bits_) < shard_count;) {
+            ++shard_bits_;
+        }
+        shard_count = static_cast<size_t>(1) << shard_bits_;
+        bool place = numa_placement && node_count > 1;
+        for (size_t i = 0; i < shard_count; ++i) {
+            int node = place ? static_cast<int>(i * node_count / shard_count) : -1;
+            shard_nodes_.push_back(node);
+            shards_.emplace_back(new shard_type(hash_bucket_size, max_load_factor, lock_stripe_count, node));
+        }
+    }
+    ShardedConcurrentHashMap(const ShardedConcurrentHashMap&) = delete;
+    ShardedConcurrentHashMap& operator=(const ShardedConcurrentHashMap&) = delete;
+
+public:
+    /**
+     * @brief 查找，找到时给 value 赋值
+     * 
+     * @param key 
+     * @param value 
+     * @return true 
+     * @return false 
+     */
+    bool find(const K& key, V& value) const {
+        return shards_[shard_index(key)]->find(key, value);
+    }
+
+    /**
+     * @brief 在读锁保护下对 key 对应的值调用 fn(const V&)
+     * 
+     * @param key 
+     * @param fn 
+     * @return true 找到了 key 并调用了 fn
+     * @return false 
+     */
+    template <typename Fn>
+    bool visit(const K& key, Fn&& fn) const {
+        return shards_[shard_index(key)]->visit(key, std::forward<Fn>(fn));
+    }
+
+    /**
+     * @brief 是否存在 key
+     * 
+     * @param key 
+     * @return true 
+     * @return false 
+     */
+    bool contains(const K& key) const {
+        return shards_[shard_index(key)]->contains(key);
+    }
+
+    /**
+     * @brief 插入，键已存在时更新值
+     * 
+     * @param key 
+     * @param value 
+     */
+    void insert(const K& key, const V& value) {
+        size_t index = shard_index(key);
+        NumaNodeScope scope(shard_nodes_[index]);
+        shards_[index]->insert(key, value);
+    }
+
+    void insert(K&& key, V&& value) {
+        size_t index = shard_index(key);
+        NumaNodeScope scope(shard_nodes_[index]);
+        shards_[index]->insert(std::move(key), std::move(value));
+    }
+
+    /**
+     * @brief 插入或者赋值
+     * 
+     * @param key 
+     * @param obj 
+     * @return true 新插入了键
+     * @return false 键已存在，赋值
+     */
+    template <typename M>
+    bool insert_or_assign(const K& key, M&& obj) {
+        size_t index = shard_index(key);
+        NumaNodeScope scope(shard_nodes_[index]);
+        return shards_[index]->insert_or_assign(key, std::forward<M>(obj));
+    }
+
+    /**
+     * @brief 键不存在时用 args 原地构造值
+     * 
+     * @param key 
+     * @param args 
+     * @return true 新插入了键
+     * @return false 键已存在
+     */
+    template <typename... Args>
+    bool try_emplace(const K& key, Args&&... args) {
+        size_t index = shard_index(key);
+        NumaNodeScope scope(shard_nodes_[index]);
+        return shards_[index]->try_emplace(key, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief 键不存在时用 init 构造值，存在时在写锁下调用 updater(V&)
+     * 
+     * @param key 
+     * @param init 
+     * @param updater 
+     * @return true 新插入了键
+     * @return false 键已存在，调用了 updater
+     */
+    template <typename Init, typename Updater>
+    bool upsert(const K& key, Init&& init, Updater&& updater) {
+        size_t index = shard_index(key);
+        NumaNodeScope scope(shard_nodes_[index]);
+        return shards_[index]->upsert(key, std::forward<Init>(init), std::forward<Updater>(updater));
+    }
+
+    /**
+     * @brief 删除某个键，节点释放回它所在节点的节点池
+     * 
+     * @param key 
+     */
+    void erase(const K& key) {
+        shards_[shard_index(key)]->erase(key);
+    }
+
+    /**
+     * @brief 键存在且 pred(V&) 返回 true 时删除
+     * 
+     * @param key 
+     * @param pred 
+     * @return true 删除了键
+     * @return false 
+     */
+    template <typename Pred>
+    bool erase_if(const K& key, Pred&& pred) {
+        return shards_[shard_index(key)]->erase_if(key, std::forward<Pred>(pred));
+    }
+
+    /**
+     * @brief 清空所有分片
+     */
+    void clear() {
+        for (auto& shard : shards_) {
+            shard->clear();
+        }
+    }
+
+    /**
+     * @brief 预先扩容到能容纳 element_count 个元素，平均分给各个分片
+     * 
+     * @param element_count 
+     */
+    void reserve(size_t element_count) {
+        size_t per_shard = (element_count + shards_.size() - 1) / shards_.size();
+        for (auto& shard : shards_) {
+            shard->reserve(per_shard);
+        }
+    }
+
+    /**
+     * @brief 依次遍历各个分片，对每个元素调用 fn(const K&, const V&)，见 ConcurrentHashMap::for_each
+     * 
+     * @param fn 
+     * @param thread_count 
+     */
+    template <typename Fn>
+    void for_each(Fn&& fn, size_t thread_count = 0) {
+        for (auto& shard : shards_) {
+            shard->for_each(fn, thread_count);
+        }
+    }
+
+    /**
+     * @brief 所有分片的元素个数之和
+     * 
+     * @return size_t 
+     */
+    size_t size() const {
+        size_t total = 0;
+        for (auto& shard : shards_) {
+            total += shard->size();
+        }
+        return total;
+    }
+
+    /**
+     * @brief 所有分片的桶数之和
+     * 
+     * @return size_t 
+     */
+    size_t bucket_count() const {
+        size_t total = 0;
+        for (auto& shard : shards_) {
+            total += shard->bucket_count();
+        }
+        return total;
+    }
+
+    /**
+     * @brief 分片数
+     * 
+     * @return size_t 
+     */
+    size_t shard_count() const {
+        return shards_.size();
+    }
+
+    /**
+     * @brief key 所在的分片，取混合后的哈希值的高 shard_bits_ 位
+     * 
+     * @param key 
+     * @return size_t 
+     */
+    size_t shard_index(const K& key) const {
+        return shard_bits_ == 0 ? 0 : mix_hash(hasher_(key)) >> (sizeof(size_t) * 8 - shard_bits_);
+    }
+
+    /**
+     * @brief 第 index 个分片，用于调用分片上的其他接口
+     *        在分片上直接插入时，节点放在当前线程 numa_target_node() 指定的节点上
+     * 
+     * @param index 
+     * @return shard_type& 
+     */
+    shard_type& shard(size_t index) {
+        return *shards_[index];
+    }
+
+    /**
+     * @brief 第 index 个分片所在的 NUMA 节点，-1 表示没有指定
+     * 
+     * @param index 
+     * @return int 
+     */
+    int shard_numa_node(size_t index) const {
+        return shard_nodes_[index];
+    }
+
+    /**
+     * @brief 把当前线程绑定到第 index 个分片所在 NUMA 节点的 CPU 上，用于只访问这个分片（或者同一节点上的分片）的线程
+     * 
+     * @param index 
+     * @return true 
+     * @return false 分片没有指定节点，或者绑定失败
+     */
+    bool bind_thread_to_shard(size_t index) const {
+        return bind_thread_to_numa_node(shard_nodes_[index]);
+    }
+
+private:
+    std::vector<std::unique_ptr<shard_type>> shards_;
+    // 每个分片所在的 NUMA 节点
+    std::vector<int> shard_nodes_;
+    // 分片数的位数
+    size_t shard_bits_;
+    F hasher_;
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang
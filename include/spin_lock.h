@@ -0,0 +1,257 @@
+/**
+ * @file spin_lock.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#include "cache_aligned.h"
+
+namespace noahyzhang {
+namespace concurrent {
+
+// 自旋多少次之后让出 CPU，持锁线程被换出时（例如线程数多于核数）不会空转整个时间片
+#define SPIN_LOCK_YIELD_COUNT (64)
+// 读写自旋锁每轮退避最多执行的 pause 次数，第 n 轮执行 2^n 次，直到此上限
+#define RW_SPIN_LOCK_MAX_BACKOFF (64)
+// 读写自旋锁退避多少轮之后在 futex 上休眠，临界区很长或者持锁线程被换出时不再空转
+#define RW_SPIN_LOCK_SPIN_ROUNDS (10)
+
+/**
+ * @brief 自旋等待时提示 CPU，降低功耗，并让出超线程的执行资源
+ */
+inline void cpu_pause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+ * @brief 独占自旋锁，占一个缓存行，适合临界区很短的场景
+ *        先只读地等待锁释放，再尝试交换，等待期间不会反复写锁所在的缓存行
+ */
+class alignas(CACHE_LINE_SIZE) SpinLock {
+public:
+    SpinLock() = default;
+    SpinLock(const SpinLock&) = delete;
+    SpinLock& operator=(const SpinLock&) = delete;
+
+public:
+    void lock() {
+        for (size_t spins = 0; locked_.exchange(true, std::memory_order_acquire);) {
+            for (; locked_.load(std::memory_order_relaxed);) {
+                if (++spins >= SPIN_LOCK_YIELD_COUNT) {
+                    spins = 0;
+                    std::this_thread::yield();
+                } else {
+                    cpu_pause();
+                }
+            }
+        }
+    }
+
+    bool try_lock() {
+        return !locked_.load(std::memory_order_relaxed) && !locked_.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        locked_.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic<bool> locked_{false};
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex requires a plain 32-bit word");
+
+/**
+ * @brief 锁字仍等于 expected 时休眠，直到被 futex_wake_all 唤醒，也可能被虚假唤醒
+ *        非 Linux 平台上退化为让出 CPU
+ * 
+ * @param word 
+ * @param expected 
+ */
+inline void futex_wait(std::atomic<uint32_t>* word, uint32_t expected) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+    (void)word;
+    (void)expected;
+    std::this_thread::yield();
+#endif
+}
+
+/**
+ * @brief 唤醒在锁字上休眠的所有线程
+ * 
+ * @param word 
+ */
+inline void futex_wake_all(std::atomic<uint32_t>* word) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+
+/**
+ * @brief 4 字节的读写自旋锁，可以作为 ConcurrentHashMap 的锁策略
+ *        锁字的第 0 位表示写者持有锁，第 1 位表示有线程在锁字上休眠，
+ *        第 2 到 15 位是等待中的写者数（只在写者优先时使用），第 16 到 31 位是持有读锁的读者数
+ *        加锁失败后以指数退避自旋，超过 RW_SPIN_LOCK_SPIN_ROUNDS 轮还没有拿到锁就在 futex 上休眠；
+ *        解锁时如果有休眠的线程，清除休眠位并全部唤醒，由它们重新竞争
+ *        没有竞争时加锁和解锁各是一次原子操作，不会进入内核
+ *        读锁和写锁都用 unlock 释放，持有写锁时写者位一定被置位，由此区分释放的是哪一种
+ * 
+ * @tparam WriterPreferring 是否写者优先。为 false 时只有写者持有锁才挡住读者，
+ *         读者源源不断时写者可能一直等待；为 true 时有写者在等待就不再接纳新的读者，
+ *         代价是同一线程不能嵌套加读锁，否则两次加锁之间到来的写者会与它互相等待
+ */
+template <bool WriterPreferring>
+class BasicRWSpinLock {
+public:
+    BasicRWSpinLock() = default;
+    BasicRWSpinLock(const BasicRWSpinLock&) = delete;
+    BasicRWSpinLock& operator=(const BasicRWSpinLock&) = delete;
+
+public:
+    void rdlock() {
+        if (!try_rdlock()) {
+            rdlock_slow();
+        }
+    }
+
+    bool try_rdlock() {
+        for (uint32_t state = state_.load(std::memory_order_relaxed); (state & kReaderBlocked) == 0;) {
+            if (state_.compare_exchange_weak(state, state + kReader, std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void wrlock() {
+        if (!try_wrlock()) {
+            wrlock_slow();
+        }
+    }
+
+    bool try_wrlock() {
+        uint32_t state = state_.load(std::memory_order_relaxed);
+        return (state & (kWriter | kReaderMask)) == 0 &&
+            state_.compare_exchange_strong(state, state | kWriter, std::memory_order_acquire,
+                                           std::memory_order_relaxed);
+    }
+
+    void unlock() {
+        uint32_t state = 0;
+        if (state_.load(std::memory_order_relaxed) & kWriter) {
+            state = state_.fetch_and(~(kWriter | kParked), std::memory_order_release);
+        } else {
+            state = state_.fetch_sub(kReader, std::memory_order_release);
+            // 还有其他读者时，休眠的只可能是等读者退出的写者，或者被等待中的写者挡住的读者，都不必唤醒
+            if ((state & kReaderMask) != kReader || (state & kParked) == 0) {
+                return;
+            }
+            state = state_.fetch_and(~kParked, std::memory_order_relaxed);
+        }
+        if (state & kParked) {
+            futex_wake_all(&state_);
+        }
+    }
+
+private:
+    void rdlock_slow() {
+        for (size_t round = 0;;) {
+            uint32_t state = state_.load(std::memory_order_relaxed);
+            if ((state & kReaderBlocked) == 0) {
+                if (state_.compare_exchange_weak(state, state + kReader, std::memory_order_acquire,
+                                                 std::memory_order_relaxed)) {
+                    return;
+                }
+                continue;
+            }
+            wait(state, round);
+        }
+    }
+
+    void wrlock_slow() {
+        // 写者优先时先登记为等待中的写者，挡住新来的读者，拿到锁时在同一次原子操作中注销
+        const uint32_t waiting = WriterPreferring ? kWaitingWriter : 0;
+        if (WriterPreferring) {
+            state_.fetch_add(kWaitingWriter, std::memory_order_relaxed);
+        }
+        for (size_t round = 0;;) {
+            uint32_t state = state_.load(std::memory_order_relaxed);
+            if ((state & (kWriter | kReaderMask)) == 0) {
+                if (state_.compare_exchange_weak(state, state - waiting + kWriter, std::memory_order_acquire,
+                                                 std::memory_order_relaxed)) {
+                    return;
+                }
+                continue;
+            }
+            wait(state, round);
+        }
+    }
+
+    /**
+     * @brief 锁字为 state 时拿不到锁，先指数退避，超过自旋的轮数后置上休眠位并休眠
+     *        置休眠位的 CAS 失败说明锁字已经变化，直接返回重新尝试；
+     *        成功后解锁的线程一定会看到休眠位，不会漏掉唤醒
+     * 
+     * @param state 
+     * @param round 已经退避的轮数
+     */
+    void wait(uint32_t state, size_t& round) {
+        if (round < RW_SPIN_LOCK_SPIN_ROUNDS) {
+            size_t backoff = static_cast<size_t>(1) << round;
+            for (size_t i = 0; i < backoff && i < RW_SPIN_LOCK_MAX_BACKOFF; ++i) {
+                cpu_pause();
+            }
+            ++round;
+            return;
+        }
+        if ((state & kParked) == 0 &&
+            !state_.compare_exchange_strong(state, state | kParked, std::memory_order_relaxed)) {
+            return;
+        }
+        futex_wait(&state_, state | kParked);
+    }
+
+private:
+    static constexpr uint32_t kWriter = 1;
+    static constexpr uint32_t kParked = 2;
+    static constexpr uint32_t kWaitingWriter = 4;
+    static constexpr uint32_t kWaitingWriterMask = 0xfffc;
+    static constexpr uint32_t kReader = 0x10000;
+    static constexpr uint32_t kReaderMask = 0xffff0000;
+    // 哪些位被置位时读者不能加锁
+    static constexpr uint32_t kReaderBlocked = WriterPreferring ? (kWriter | kWaitingWriterMask) : kWriter;
+
+    std::atomic<uint32_t> state_{0};
+};
+
+// 读者优先的读写自旋锁，与 glibc 默认的 pthread 读写锁行为一致
+typedef BasicRWSpinLock<false> RWSpinLock;
+// 写者优先的读写自旋锁，读多写少且写操作不能被饿死时使用
+typedef BasicRWSpinLock<true> WriterPreferringRWSpinLock;
+
+}  // namespace concurrent
+}  // namespace noahyzhang
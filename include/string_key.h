@@ -0,0 +1,98 @@
+/**
+ * @file string_key.h
+ * @author noahyzhang
+ * @brief 
+ * @version 0.1
+ * @date 2023-03-23
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace noahyzhang {
+namespace concurrent {
+
+/**
+ * @brief 对一段字节计算 64 位哈希值（MurmurHash64A）
+ * 
+ * @param data 
+ * @param len 
+ * @return size_t 
+ */
+inline size_t hash_bytes(const void* data, size_t len) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ (len * m);
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + (len & ~static_cast<size_t>(7));
+    for (; p != end; p += 8) {
+        uint64_t k;
+        memcpy(&k, p, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, len & 7);
+    if ((len & 7) != 0) {
+        h ^= tail;
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return static_cast<size_t>(h);
+}
+
+/**
+ * @brief 透明的字符串哈希函数，std::string、const char*（以及 C++17 的 std::string_view）
+ *        内容相同时哈希值相同，作为 ConcurrentHashMap 的 F 可以不构造 std::string 直接查找
+ */
+struct StringHash {
+    typedef void is_transparent;
+
+    size_t operator()(const std::string& key) const {
+        return hash_bytes(key.data(), key.size());
+    }
+    size_t operator()(const char* key) const {
+        return hash_bytes(key, strlen(key));
+    }
+#if __cplusplus >= 201703L
+    size_t operator()(std::string_view key) const {
+        return hash_bytes(key.data(), key.size());
+    }
+#endif
+};
+
+/**
+ * @brief 透明的字符串相等比较，与 StringHash 配合使用
+ */
+struct StringEqual {
+    typedef void is_transparent;
+
+    bool operator()(const std::string& lhs, const std::string& rhs) const {
+        return lhs == rhs;
+    }
+    bool operator()(const std::string& lhs, const char* rhs) const {
+        return lhs.compare(rhs) == 0;
+    }
+#if __cplusplus >= 201703L
+    bool operator()(const std::string& lhs, std::string_view rhs) const {
+        return std::string_view(lhs) == rhs;
+    }
+#endif
+};
+
+}  // namespace concurrent
+}  // namespace noahyzhang